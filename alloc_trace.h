@@ -0,0 +1,341 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Records every ALLOC, CALLOC, REALLOC and FREE made through the allocator interface
+// macros into a compact binary trace, and reads traces back for replay.
+//
+// To capture, define MEM_TRACKING_ENABLED and BM_ALLOC_TRACE and include this header
+// before any allocator header. Define BM_ALLOC_TRACE_IMPLEMENTATION in one file, then
+// call AllocTraceBegin(path) and AllocTraceEnd() around the part of the program to trace.
+// Only the outermost allocator in a stack is traced, its parents are called directly.
+//
+// A failed in place REALLOC is not recorded, the ALLOC and FREE that move the block are.
+//
+// File layout: "BMAT", a uint32_t version, then one record after another. A record is
+// a byte holding the op and log2 of the alignment, followed by LEB128 varints: thread,
+// nanoseconds since the previous record, size (alloc and realloc), address as a zigzag
+// delta from the previous address, and the old address for realloc.
+
+enum alloc_trace_op : uint8_t
+{
+    AllocTraceAlloc = 0,
+    AllocTraceFree = 1,
+    AllocTraceReAlloc = 2,
+};
+
+struct alloc_trace_record
+{
+    alloc_trace_op op;
+    uint32_t thread;
+    uint32_t alignment;
+
+    // Nanoseconds since the trace began.
+    uint64_t timestamp;
+    uint64_t size;
+
+    // The new block for alloc and realloc, the freed block for free.
+    uint64_t addr;
+    uint64_t oldAddr;
+};
+
+struct alloc_trace_writer
+{
+    bool Open(const char *path);
+    void Close();
+
+    // Thread safe.
+    void Write(alloc_trace_op op, void *addr, void *oldAddr, size_t size, uint32_t alignment);
+
+    FILE *m_file;
+    uint32_t m_lock;
+    uint32_t m_threadCount;
+    uint64_t m_start;
+    uint64_t m_lastTimestamp;
+    uint64_t m_lastAddr;
+    size_t m_used;
+    uint8_t m_buffer[64 * 1024];
+};
+
+struct alloc_trace_reader
+{
+    bool Open(const char *path);
+    void Close();
+
+    // Returns false at the end of the trace, or on a truncated record.
+    bool Next(alloc_trace_record *record);
+
+    FILE *m_file;
+    uint64_t m_lastTimestamp;
+    uint64_t m_lastAddr;
+};
+
+bool AllocTraceBegin(const char *path);
+void AllocTraceEnd();
+void AllocTraceRecordAlloc(void *addr, size_t size, uint32_t alignment);
+void AllocTraceRecordReAlloc(void *addr, void *oldAddr, size_t size);
+void AllocTraceRecordFree(void *addr);
+
+#if defined(MEM_TRACKING_ENABLED) && defined(BM_ALLOC_TRACE)
+#if defined(ALLOC)
+#error "alloc_trace.h has to be included before allocator_interface.h"
+#endif
+
+#define POSTALLOC_CALLBACK(newMem, size, alignment, line, file) AllocTraceRecordAlloc(newMem, size, alignment)
+#define POSTREALLOC_CALLBACK(newMem, oldMem, size, line, file) AllocTraceRecordReAlloc(newMem, oldMem, size)
+#define PREFREE_CALLBACK(mem, line, file) AllocTraceRecordFree(mem)
+#endif
+
+#include "allocator_interface.h"
+
+#if defined(BM_ALLOC_TRACE_IMPLEMENTATION)
+#include "platform.h"
+#include <chrono>
+
+static const char alloc_trace_magic[4] = { 'B', 'M', 'A', 'T' };
+static const uint32_t alloc_trace_version = 1;
+
+static alloc_trace_writer *g_allocTrace = nullptr;
+
+static inline uint64_t AllocTraceNow()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline uint8_t *AllocTracePutVarint(uint8_t *out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static inline bool AllocTraceGetVarint(FILE *file, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(file);
+        if (byte == EOF)
+        {
+            return false;
+        }
+
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool alloc_trace_writer::Open(const char *path)
+{
+    m_file = fopen(path, "wb");
+    if (!m_file)
+    {
+        return false;
+    }
+
+    m_lock = 0;
+    m_threadCount = 0;
+    m_start = AllocTraceNow();
+    m_lastTimestamp = 0;
+    m_lastAddr = 0;
+    m_used = 0;
+
+    fwrite(alloc_trace_magic, 1, sizeof(alloc_trace_magic), m_file);
+    fwrite(&alloc_trace_version, sizeof(alloc_trace_version), 1, m_file);
+    return true;
+}
+
+void alloc_trace_writer::Close()
+{
+    fwrite(m_buffer, 1, m_used, m_file);
+    fclose(m_file);
+    m_file = nullptr;
+}
+
+void alloc_trace_writer::Write(alloc_trace_op op, void *addr, void *oldAddr, size_t size, uint32_t alignment)
+{
+    static thread_local uint32_t thread = UINT32_MAX;
+
+    while (ICE(&m_lock, 1, 0) != 0);
+
+    if (thread == UINT32_MAX)
+    {
+        thread = m_threadCount++;
+    }
+
+    // Taken under the lock so timestamps never go backwards.
+    uint64_t timestamp = AllocTraceNow() - m_start;
+
+    // A record is at most 1 + 4 varints of 10 bytes and one of 5.
+    if (m_used + 64 > sizeof(m_buffer))
+    {
+        fwrite(m_buffer, 1, m_used, m_file);
+        m_used = 0;
+    }
+
+    uint8_t *out = m_buffer + m_used;
+    *out++ = (uint8_t)(op | ((alignment ? CTZ64(alignment) : 0) << 2));
+    out = AllocTracePutVarint(out, thread);
+    out = AllocTracePutVarint(out, timestamp - m_lastTimestamp);
+
+    if (op != AllocTraceFree)
+    {
+        out = AllocTracePutVarint(out, size);
+    }
+
+    int64_t delta = (int64_t)((uint64_t)addr - m_lastAddr);
+    out = AllocTracePutVarint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+
+    if (op == AllocTraceReAlloc)
+    {
+        out = AllocTracePutVarint(out, (uint64_t)oldAddr);
+    }
+
+    m_used = (size_t)(out - m_buffer);
+    m_lastTimestamp = timestamp;
+    m_lastAddr = (uint64_t)addr;
+
+    STORE_RELEASE(&m_lock, 0u);
+}
+
+bool alloc_trace_reader::Open(const char *path)
+{
+    m_file = fopen(path, "rb");
+    if (!m_file)
+    {
+        return false;
+    }
+
+    m_lastTimestamp = 0;
+    m_lastAddr = 0;
+
+    char magic[4];
+    uint32_t version;
+    if (fread(magic, 1, sizeof(magic), m_file) != sizeof(magic) ||
+        fread(&version, sizeof(version), 1, m_file) != 1 ||
+        magic[0] != alloc_trace_magic[0] || magic[1] != alloc_trace_magic[1] ||
+        magic[2] != alloc_trace_magic[2] || magic[3] != alloc_trace_magic[3] ||
+        version != alloc_trace_version)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+void alloc_trace_reader::Close()
+{
+    fclose(m_file);
+    m_file = nullptr;
+}
+
+bool alloc_trace_reader::Next(alloc_trace_record *record)
+{
+    int header = fgetc(m_file);
+    if (header == EOF)
+    {
+        return false;
+    }
+
+    record->op = (alloc_trace_op)(header & 3);
+    record->alignment = 1u << (header >> 2);
+
+    uint64_t thread;
+    uint64_t timestampDelta;
+    if (!AllocTraceGetVarint(m_file, &thread) || !AllocTraceGetVarint(m_file, &timestampDelta))
+    {
+        return false;
+    }
+
+    record->thread = (uint32_t)thread;
+    record->timestamp = m_lastTimestamp + timestampDelta;
+    record->size = 0;
+    record->oldAddr = 0;
+
+    if (record->op != AllocTraceFree && !AllocTraceGetVarint(m_file, &record->size))
+    {
+        return false;
+    }
+
+    uint64_t zigzag;
+    if (!AllocTraceGetVarint(m_file, &zigzag))
+    {
+        return false;
+    }
+
+    record->addr = m_lastAddr + ((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+
+    if (record->op == AllocTraceReAlloc && !AllocTraceGetVarint(m_file, &record->oldAddr))
+    {
+        return false;
+    }
+
+    m_lastTimestamp = record->timestamp;
+    m_lastAddr = record->addr;
+    return true;
+}
+
+bool AllocTraceBegin(const char *path)
+{
+    alloc_trace_writer *writer = new alloc_trace_writer;
+    if (!writer->Open(path))
+    {
+        delete writer;
+        return false;
+    }
+
+    g_allocTrace = writer;
+    return true;
+}
+
+void AllocTraceEnd()
+{
+    alloc_trace_writer *writer = g_allocTrace;
+    g_allocTrace = nullptr;
+
+    if (writer)
+    {
+        writer->Close();
+        delete writer;
+    }
+}
+
+void AllocTraceRecordAlloc(void *addr, size_t size, uint32_t alignment)
+{
+    if (g_allocTrace && addr)
+    {
+        g_allocTrace->Write(AllocTraceAlloc, addr, nullptr, size, alignment);
+    }
+}
+
+void AllocTraceRecordReAlloc(void *addr, void *oldAddr, size_t size)
+{
+    if (g_allocTrace && addr)
+    {
+        g_allocTrace->Write(AllocTraceReAlloc, addr, oldAddr, size, 0);
+    }
+}
+
+void AllocTraceRecordFree(void *addr)
+{
+    if (g_allocTrace && addr)
+    {
+        g_allocTrace->Write(AllocTraceFree, addr, nullptr, 0, 0);
+    }
+}
+#endif
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "allocator_interface.h"
+#include <stdint.h>
+
+// Allocator building blocks that route calls between other allocators at compile time.
+// Like allocator_spin_lock they hold pointers to the allocators they combine, and they
+// implement the allocator interface themselves so they can be nested.
+//
+// Frees and reallocs are routed with Owns(addr), so every allocator that may be asked
+// about ownership must implement it.
+
+// Sends requests of at most Threshold bytes to Small and everything else to Large.
+template <size_t Threshold, typename Small, typename Large>
+struct segregator
+{
+    segregator(Small *small, Large *large);
+
+    Small *m_small;
+    Large *m_large;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
+};
+
+// Tries Primary first and falls back to Secondary when it returns nullptr.
+// Only Primary needs to implement Owns, unless this allocator is itself asked about ownership.
+template <typename Primary, typename Secondary>
+struct fallback_allocator
+{
+    fallback_allocator(Primary *primary, Secondary *secondary);
+
+    Primary *m_primary;
+    Secondary *m_secondary;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
+};
+
+// One allocator per Step sized range in (Min, Max]. allocators[i] serves
+// sizes in (Min + i * Step, Min + (i + 1) * Step]. Requests outside of the range fail.
+template <typename A, size_t Min, size_t Max, size_t Step>
+struct bucketizer
+{
+    static_assert(Max > Min, "Max must be larger than Min");
+    static_assert((Max - Min) % Step == 0, "The size range must be a multiple of Step");
+
+    static constexpr size_t bucket_count = (Max - Min) / Step;
+
+    bucketizer(A **allocators);
+
+    A *m_buckets[bucket_count];
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
+
+private:
+    A *FindOwner(void *addr);
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+template <size_t Threshold, typename Small, typename Large>
+segregator<Threshold, Small, Large>::segregator(Small *small, Large *large)
+    : m_small(small),
+      m_large(large)
+{
+}
+
+template <size_t Threshold, typename Small, typename Large>
+void *segregator<Threshold, Small, Large>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    if (size <= Threshold)
+    {
+        return m_small->AllocInternal(size, alignment, line, file);
+    }
+
+    return m_large->AllocInternal(size, alignment, line, file);
+}
+
+template <size_t Threshold, typename Small, typename Large>
+void segregator<Threshold, Small, Large>::FreeInternal(void *addr, int line, const char *file)
+{
+    if (m_small->Owns(addr))
+    {
+        m_small->FreeInternal(addr, line, file);
+    }
+    else
+    {
+        m_large->FreeInternal(addr, line, file);
+    }
+}
+
+template <size_t Threshold, typename Small, typename Large>
+void *segregator<Threshold, Small, Large>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    // Allocations stay with their owner. The caller moves the allocation if the owner
+    // can't resize it in place.
+    if (m_small->Owns(addr))
+    {
+        return m_small->ReAllocInternal(addr, size, line, file);
+    }
+
+    return m_large->ReAllocInternal(addr, size, line, file);
+}
+
+template <size_t Threshold, typename Small, typename Large>
+void *segregator<Threshold, Small, Large>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    if (size <= Threshold)
+    {
+        return m_small->CAllocInternal(size, alignment, line, file);
+    }
+
+    return m_large->CAllocInternal(size, alignment, line, file);
+}
+
+template <size_t Threshold, typename Small, typename Large>
+bool segregator<Threshold, Small, Large>::Owns(void *addr)
+{
+    return m_small->Owns(addr) || m_large->Owns(addr);
+}
+
+template <typename Primary, typename Secondary>
+fallback_allocator<Primary, Secondary>::fallback_allocator(Primary *primary, Secondary *secondary)
+    : m_primary(primary),
+      m_secondary(secondary)
+{
+}
+
+template <typename Primary, typename Secondary>
+void *fallback_allocator<Primary, Secondary>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    void *result = m_primary->AllocInternal(size, alignment, line, file);
+    if (result == nullptr)
+    {
+        result = m_secondary->AllocInternal(size, alignment, line, file);
+    }
+
+    return result;
+}
+
+template <typename Primary, typename Secondary>
+void fallback_allocator<Primary, Secondary>::FreeInternal(void *addr, int line, const char *file)
+{
+    if (m_primary->Owns(addr))
+    {
+        m_primary->FreeInternal(addr, line, file);
+    }
+    else
+    {
+        m_secondary->FreeInternal(addr, line, file);
+    }
+}
+
+template <typename Primary, typename Secondary>
+void *fallback_allocator<Primary, Secondary>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    if (m_primary->Owns(addr))
+    {
+        return m_primary->ReAllocInternal(addr, size, line, file);
+    }
+
+    return m_secondary->ReAllocInternal(addr, size, line, file);
+}
+
+template <typename Primary, typename Secondary>
+void *fallback_allocator<Primary, Secondary>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    void *result = m_primary->CAllocInternal(size, alignment, line, file);
+    if (result == nullptr)
+    {
+        result = m_secondary->CAllocInternal(size, alignment, line, file);
+    }
+
+    return result;
+}
+
+template <typename Primary, typename Secondary>
+bool fallback_allocator<Primary, Secondary>::Owns(void *addr)
+{
+    return m_primary->Owns(addr) || m_secondary->Owns(addr);
+}
+
+template <typename A, size_t Min, size_t Max, size_t Step>
+bucketizer<A, Min, Max, Step>::bucketizer(A **allocators)
+{
+    for (size_t i = 0; i < bucket_count; ++i)
+    {
+        m_buckets[i] = allocators[i];
+    }
+}
+
+template <typename A, size_t Min, size_t Max, size_t Step>
+A *bucketizer<A, Min, Max, Step>::FindOwner(void *addr)
+{
+    for (size_t i = 0; i < bucket_count; ++i)
+    {
+        if (m_buckets[i]->Owns(addr))
+        {
+            return m_buckets[i];
+        }
+    }
+
+    return nullptr;
+}
+
+template <typename A, size_t Min, size_t Max, size_t Step>
+void *bucketizer<A, Min, Max, Step>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    if (size <= Min || size > Max)
+    {
+        return nullptr;
+    }
+
+    return m_buckets[(size - Min - 1) / Step]->AllocInternal(size, alignment, line, file);
+}
+
+template <typename A, size_t Min, size_t Max, size_t Step>
+void bucketizer<A, Min, Max, Step>::FreeInternal(void *addr, int line, const char *file)
+{
+    A *owner = FindOwner(addr);
+    BM_ASSERT(owner, "Tried to free memory that no bucket owns");
+    owner->FreeInternal(addr, line, file);
+}
+
+template <typename A, size_t Min, size_t Max, size_t Step>
+void *bucketizer<A, Min, Max, Step>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    A *owner = FindOwner(addr);
+    BM_ASSERT(owner, "Tried to realloc memory that no bucket owns");
+    return owner->ReAllocInternal(addr, size, line, file);
+}
+
+template <typename A, size_t Min, size_t Max, size_t Step>
+void *bucketizer<A, Min, Max, Step>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    if (size <= Min || size > Max)
+    {
+        return nullptr;
+    }
+
+    return m_buckets[(size - Min - 1) / Step]->CAllocInternal(size, alignment, line, file);
+}
+
+template <typename A, size_t Min, size_t Max, size_t Step>
+bool bucketizer<A, Min, Max, Step>::Owns(void *addr)
+{
+    return FindOwner(addr) != nullptr;
+}
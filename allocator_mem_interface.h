@@ -2,6 +2,7 @@
 
 #include "memory_interface.h"
 #include "allocator_interface.h"
+#include "clear_memory.h"
 
 template <typename T>
 struct allocator_mem_interface
@@ -12,8 +13,14 @@ struct allocator_mem_interface
     T *m_allocator;
     DECLARE_MEMORY_INTERFACE_METHODS();
     DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
 };
 
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
 template <typename T>
 allocator_mem_interface<T>::allocator_mem_interface(T *allocator, uint32_t minAlignment)
     : m_minAlignment(minAlignment),
@@ -24,10 +31,10 @@ allocator_mem_interface<T>::allocator_mem_interface(T *allocator, uint32_t minAl
 template <typename T>
 void allocator_mem_interface<T>::Commit(void *addr, size_t size, size_t *actual)
 {
-    (void)addr;
-    (void)size;
-    (void)actual;
-    // Nothing to do.
+    // Committed memory reads as zero. Clearing here rather than on Reserve or DeCommit only
+    // touches what the child actually uses, and nothing is cleared just before it is freed.
+    ClearMemory(addr, size);
+    *actual = size;
 }
 
 template <typename T>
@@ -37,12 +44,20 @@ void *allocator_mem_interface<T>::Reserve(size_t size, size_t *actual)
     return m_allocator->AllocInternal(size, m_minAlignment, __LINE__, __FILE__);
 }
 
+template <typename T>
+void *allocator_mem_interface<T>::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    BM_ASSERT(alignment <= UINT32_MAX, "Alignment is too large for the allocator interface");
+    *actual = size;
+    return m_allocator->AllocInternal(size, alignment > m_minAlignment ? (uint32_t)alignment : m_minAlignment, __LINE__, __FILE__);
+}
+
 template <typename T>
 void allocator_mem_interface<T>::DeCommit(void *addr, size_t size)
 {
     (void)addr;
     (void)size;
-    // Nothing to do
+    // Nothing to do, Commit clears the memory when it is used again.
 }
 
 template <typename T>
@@ -75,3 +90,15 @@ void *allocator_mem_interface<T>::ReAllocInternal(void *addr, size_t size, int l
 {
     return m_allocator->ReAllocInternal(addr, size, line, file);
 }
+
+template <typename T>
+void *allocator_mem_interface<T>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    return m_allocator->CAllocInternal(size, alignment, line, file);
+}
+
+template <typename T>
+bool allocator_mem_interface<T>::Owns(void *addr)
+{
+    return m_allocator->Owns(addr);
+}
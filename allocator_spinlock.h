@@ -5,6 +5,16 @@
 #include "allocator_interface.h"
 #include <stdint.h>
 
+// Define BM_SPIN_LOCK_STATS to count how often the lock was contended.
+struct spin_lock_stats
+{
+    uint64_t acquisitions;
+
+    // Acquisitions that found the lock taken, and the failed attempts they made.
+    uint64_t contended;
+    uint64_t spins;
+};
+
 template <typename T>
 struct allocator_spin_lock
 {
@@ -12,7 +22,12 @@ struct allocator_spin_lock
 
     uint32_t m_lock;
     T *m_allocator;
+#if defined(BM_SPIN_LOCK_STATS)
+    // Only updated while the lock is held.
+    spin_lock_stats m_stats;
+#endif
     DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
     void Lock();
     void Unlock();
 };
@@ -21,18 +36,34 @@ template <typename T>
 allocator_spin_lock<T>::allocator_spin_lock(T *allocator)
     : m_lock(0),
       m_allocator(allocator)
-{}
+{
+#if defined(BM_SPIN_LOCK_STATS)
+    m_stats = {};
+#endif
+}
 
 template <typename T>
 inline void allocator_spin_lock<T>::Lock()
 {
+#if defined(BM_SPIN_LOCK_STATS)
+    uint64_t spins = 0;
+    while(ICE(&m_lock, 1, 0) != 0) ++spins;
+
+    ++m_stats.acquisitions;
+    if (spins)
+    {
+        ++m_stats.contended;
+        m_stats.spins += spins;
+    }
+#else
     while(ICE(&m_lock, 1, 0) != 0);
+#endif
 }
 
 template <typename T>
 inline void allocator_spin_lock<T>::Unlock()
 {
-    m_lock = 0;
+    STORE_RELEASE(&m_lock, 0u);
 }
 
 template <typename T>
@@ -61,3 +92,21 @@ void *allocator_spin_lock<T>::ReAllocInternal(void *addr, size_t size, int line,
     Unlock();
     return result;
 }
+
+template <typename T>
+void *allocator_spin_lock<T>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    Lock();
+    void *result = m_allocator->CAllocInternal(size, alignment, line, file);
+    Unlock();
+    return result;
+}
+
+template <typename T>
+bool allocator_spin_lock<T>::Owns(void *addr)
+{
+    Lock();
+    bool result = m_allocator->Owns(addr);
+    Unlock();
+    return result;
+}
@@ -0,0 +1,658 @@
+// Standard allocator workloads, run against best_fit_allocator, fixed_size_allocator and
+// the system heap.
+//
+// churn:             One thread keeps a window of small objects and replaces one at random.
+// producer-consumer: One thread allocates small objects, another frees them.
+// larson:            Threads replace random objects in a shared set of arrays, which
+//                    rotate between the threads every round, so most frees are remote.
+// realloc-growth:    Buffers grow by half their size until 64KB, then start over.
+// mixed:             A window of objects from 16 bytes to 64KB, sizes log-uniform.
+//
+// Every workload reports ops/sec, ns/op and the peak RSS of the run. An op is one alloc,
+// free or realloc. fixed_size_allocator only serves the small object workloads.
+//
+// --latency adds best_fit_timed, best_fit with every call and commit timed, and prints the
+// latency percentiles of each op after each of its runs.
+//
+// --sampled adds best_fit_sampled, best_fit behind the sampling heap profiler at its
+// default rate, to keep an eye on the profiler's overhead.
+//
+// --perf counts cycles, instructions, cache and dTLB misses and page faults around each run
+// (perf_event_open, Linux only) and prints them per op, so a regression can be told apart
+// as tree walking, TLB pressure or commit faults.
+//
+// usage: allocator_bench [--smoke] [--latency] [--sampled] [--perf] [--threads n]
+//                        [--workload name] [--allocator name]
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define BM_WIN32_MEMORY_INTERFACE_IMPLEMENTATION
+#include "win32_memory_interface.h"
+#include <psapi.h>
+using os_memory_interface = win32_virtual_memory_interface;
+#else
+#define BM_POSIX_MEMORY_INTERFACE_IMPLEMENTATION
+#include "posix_memory_interface.h"
+#include <sys/resource.h>
+using os_memory_interface = posix_virtual_memory_interface;
+#endif
+
+#define BM_MALLOCATOR_IMPLEMENTATION
+#include "mallocator.h"
+#include "allocator_interface.h"
+#include "allocator_spinlock.h"
+#include "best_fit_allocator.h"
+#include "fixed_size_allocator.h"
+#include "timed_allocator.h"
+#include "sampling_allocator.h"
+#include "bench_util.h"
+#include "perf_counters.h"
+
+static constexpr size_t small_max = 256;
+static constexpr size_t large_max = 64 * 1024;
+
+struct options
+{
+    uint64_t scale;
+    uint32_t threads;
+    const char *workload;
+    const char *allocator;
+    bool latency;
+    bool sampled;
+
+    // Null unless --perf found counters it may use.
+    perf_counters *counters;
+};
+
+struct run_result
+{
+    uint64_t ops;
+    double seconds;
+};
+
+static void ResetPeakRss()
+{
+#if defined(__linux__)
+    // Resets VmHWM. Without it the peak is the peak of the whole process so far.
+    FILE *clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs)
+    {
+        fputs("5", clearRefs);
+        fclose(clearRefs);
+    }
+#endif
+}
+
+static size_t PeakRssKilobytes()
+{
+#if defined(__linux__)
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status)
+    {
+        char line[256];
+        size_t peak = 0;
+        while (fgets(line, sizeof(line), status))
+        {
+            if (strncmp(line, "VmHWM:", 6) == 0)
+            {
+                peak = (size_t)strtoull(line + 6, nullptr, 10);
+                break;
+            }
+        }
+
+        fclose(status);
+        return peak;
+    }
+#endif
+
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return (size_t)usage.ru_maxrss / 1024;
+#else
+    return (size_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+// The allocators only resize in place, moving is up to the caller.
+template <typename A>
+static void *Grow(A *allocator, void *addr, size_t oldSize, size_t newSize)
+{
+    void *result = allocator->REALLOC(addr, newSize);
+    if (result)
+    {
+        return result;
+    }
+
+    result = allocator->ALLOC(newSize, 16);
+    memcpy(result, addr, oldSize);
+    allocator->FREE(addr);
+    return result;
+}
+
+template <typename A>
+static run_result ChurnWorkload(A *allocator, const options &opts)
+{
+    const size_t window = 4096;
+    uint64_t iterations = 20000 * opts.scale;
+    rng random = { 0x9E3779B97F4A7C15ull };
+
+    std::vector<void *> slots(window, nullptr);
+    uint64_t ops = 0;
+
+    clock_type::time_point begin = clock_type::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        size_t slot = (size_t)(random.Next() % window);
+        if (slots[slot])
+        {
+            allocator->FREE(slots[slot]);
+            ++ops;
+        }
+
+        size_t size = random.Range(16, small_max);
+        slots[slot] = allocator->ALLOC(size, 16);
+        Touch(slots[slot], size);
+        ++ops;
+    }
+
+    for (void *slot : slots)
+    {
+        if (slot)
+        {
+            allocator->FREE(slot);
+            ++ops;
+        }
+    }
+
+    return { ops, Elapsed(begin) };
+}
+
+template <typename A>
+static run_result ProducerConsumerWorkload(A *allocator, const options &opts)
+{
+    const size_t capacity = 1024;
+    uint64_t items = 10000 * opts.scale;
+
+    // Single producer, single consumer ring.
+    std::vector<void *> ring(capacity);
+    std::atomic<uint64_t> head(0);
+    std::atomic<uint64_t> tail(0);
+    std::atomic<bool> start(false);
+
+    std::thread consumer([&]()
+    {
+        while (!start.load(std::memory_order_acquire));
+
+        for (uint64_t i = 0; i < items; ++i)
+        {
+            while (tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            allocator->FREE(ring[i % capacity]);
+            tail.store(i + 1, std::memory_order_release);
+        }
+    });
+
+    clock_type::time_point begin = clock_type::now();
+    start.store(true, std::memory_order_release);
+
+    rng random = { 0xD1B54A32D192ED03ull };
+    for (uint64_t i = 0; i < items; ++i)
+    {
+        size_t size = random.Range(16, small_max);
+        void *item = allocator->ALLOC(size, 16);
+        Touch(item, size);
+
+        while (i - tail.load(std::memory_order_acquire) >= capacity)
+        {
+            std::this_thread::yield();
+        }
+
+        ring[i % capacity] = item;
+        head.store(i + 1, std::memory_order_release);
+    }
+
+    consumer.join();
+    return { items * 2, Elapsed(begin) };
+}
+
+template <typename A>
+static run_result LarsonWorkload(A *allocator, const options &opts)
+{
+    const size_t slotsPerThread = 1024;
+    const uint32_t rounds = 16;
+    uint32_t threadCount = opts.threads;
+    uint64_t opsPerRound = (2000 * opts.scale) / rounds;
+
+    // The main thread allocates the starting set, so even the first frees are remote.
+    std::vector<std::vector<void *>> arrays(threadCount);
+    rng seed = { 0x2545F4914F6CDD1Dull };
+    for (std::vector<void *> &slots : arrays)
+    {
+        for (size_t i = 0; i < slotsPerThread; ++i)
+        {
+            size_t size = seed.Range(16, small_max);
+            slots.push_back(allocator->ALLOC(size, 16));
+            Touch(slots.back(), size);
+        }
+    }
+
+    std::atomic<bool> start(false);
+    std::atomic<uint32_t> arrived(0);
+    std::vector<std::thread> threads;
+
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            rng random = { 0x9E3779B97F4A7C15ull * (t + 1) };
+            while (!start.load(std::memory_order_acquire));
+
+            for (uint32_t round = 0; round < rounds; ++round)
+            {
+                std::vector<void *> &slots = arrays[(t + round) % threadCount];
+                for (uint64_t i = 0; i < opsPerRound; ++i)
+                {
+                    size_t slot = (size_t)(random.Next() % slotsPerThread);
+                    allocator->FREE(slots[slot]);
+
+                    size_t size = random.Range(16, small_max);
+                    slots[slot] = allocator->ALLOC(size, 16);
+                    Touch(slots[slot], size);
+                }
+
+                // Wait for every thread before the arrays rotate.
+                uint32_t target = (round + 1) * threadCount;
+                arrived.fetch_add(1);
+                while (arrived.load() < target)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    clock_type::time_point begin = clock_type::now();
+    start.store(true, std::memory_order_release);
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    double seconds = Elapsed(begin);
+
+    for (std::vector<void *> &slots : arrays)
+    {
+        for (void *slot : slots)
+        {
+            allocator->FREE(slot);
+        }
+    }
+
+    return { opsPerRound * rounds * threadCount * 2, seconds };
+}
+
+template <typename A>
+static run_result ReallocGrowthWorkload(A *allocator, const options &opts)
+{
+    const size_t bufferCount = 64;
+    uint64_t iterations = 20000 * opts.scale;
+    rng random = { 0xBF58476D1CE4E5B9ull };
+
+    std::vector<void *> buffers(bufferCount, nullptr);
+    std::vector<size_t> sizes(bufferCount, 0);
+    uint64_t ops = 0;
+
+    clock_type::time_point begin = clock_type::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        size_t buffer = (size_t)(random.Next() % bufferCount);
+        size_t size = sizes[buffer];
+
+        if (size == 0)
+        {
+            buffers[buffer] = allocator->ALLOC(16, 16);
+            sizes[buffer] = 16;
+            Touch(buffers[buffer], 16);
+        }
+        else if (size >= large_max)
+        {
+            allocator->FREE(buffers[buffer]);
+            sizes[buffer] = 0;
+        }
+        else
+        {
+            size_t newSize = size + (size / 2);
+            buffers[buffer] = Grow(allocator, buffers[buffer], size, newSize);
+            sizes[buffer] = newSize;
+            Touch((uint8_t *)buffers[buffer] + size, newSize - size);
+        }
+
+        ++ops;
+    }
+
+    for (size_t buffer = 0; buffer < bufferCount; ++buffer)
+    {
+        if (sizes[buffer])
+        {
+            allocator->FREE(buffers[buffer]);
+            ++ops;
+        }
+    }
+
+    return { ops, Elapsed(begin) };
+}
+
+template <typename A>
+static run_result MixedWorkload(A *allocator, const options &opts)
+{
+    const size_t window = 2048;
+    uint64_t iterations = 10000 * opts.scale;
+    rng random = { 0x94D049BB133111EBull };
+
+    std::vector<void *> slots(window, nullptr);
+    uint64_t ops = 0;
+
+    clock_type::time_point begin = clock_type::now();
+    for (uint64_t i = 0; i < iterations; ++i)
+    {
+        size_t slot = (size_t)(random.Next() % window);
+        if (slots[slot])
+        {
+            allocator->FREE(slots[slot]);
+            slots[slot] = nullptr;
+        }
+        else
+        {
+            size_t size = random.LogUniform(4, 16);
+            slots[slot] = allocator->ALLOC(size, 16);
+            Touch(slots[slot], size);
+        }
+
+        ++ops;
+    }
+
+    for (void *slot : slots)
+    {
+        if (slot)
+        {
+            allocator->FREE(slot);
+            ++ops;
+        }
+    }
+
+    return { ops, Elapsed(begin) };
+}
+
+// Each fixture builds a fresh allocator for one run. max_size is the largest request it serves.
+struct best_fit_fixture
+{
+    static constexpr const char *name = "best_fit";
+    static constexpr size_t max_size = SIZE_MAX;
+
+    using heap_type = best_fit_allocator<os_memory_interface>;
+    using allocator_type = allocator_spin_lock<heap_type>;
+
+    best_fit_fixture()
+        : heap(&memory, (size_t)8 * 1024 * 1024 * 1024),
+          allocator(&heap)
+    {
+    }
+
+    void Report() {}
+
+    os_memory_interface memory;
+    heap_type heap;
+    allocator_type allocator;
+};
+
+struct best_fit_timed_fixture
+{
+    static constexpr const char *name = "best_fit_timed";
+    static constexpr size_t max_size = SIZE_MAX;
+
+    using memory_type = timed_memory_interface<os_memory_interface>;
+    using heap_type = best_fit_allocator<memory_type>;
+    using locked_type = allocator_spin_lock<heap_type>;
+    using allocator_type = timed_allocator<locked_type>;
+
+    best_fit_timed_fixture()
+        : memory(&os, &recorder),
+          heap(&memory, (size_t)8 * 1024 * 1024 * 1024),
+          locked(&heap),
+          allocator(&locked, &recorder)
+    {
+    }
+
+    void Report() { PrintLatencyReport(&recorder, stdout); }
+
+    latency_recorder<> recorder;
+    os_memory_interface os;
+    memory_type memory;
+    heap_type heap;
+    locked_type locked;
+    allocator_type allocator;
+};
+
+struct best_fit_sampled_fixture
+{
+    static constexpr const char *name = "best_fit_sampled";
+    static constexpr size_t max_size = SIZE_MAX;
+
+    using heap_type = best_fit_allocator<os_memory_interface>;
+    using locked_type = allocator_spin_lock<heap_type>;
+    using allocator_type = sampling_allocator<locked_type>;
+
+    best_fit_sampled_fixture()
+        : heap(&memory, (size_t)8 * 1024 * 1024 * 1024),
+          locked(&heap),
+          allocator(&locked)
+    {
+    }
+
+    void Report() {}
+
+    os_memory_interface memory;
+    heap_type heap;
+    locked_type locked;
+    allocator_type allocator;
+};
+
+struct fixed_size_fixture
+{
+    static constexpr const char *name = "fixed_size";
+    static constexpr size_t max_size = small_max;
+
+    using pool_type = fixed_size_allocator<mallocator>;
+    using allocator_type = allocator_spin_lock<pool_type>;
+
+    fixed_size_fixture()
+        : pool(&buckets, 4096, small_max, 16),
+          allocator(&pool)
+    {
+    }
+
+    void Report() {}
+
+    mallocator buckets;
+    pool_type pool;
+    allocator_type allocator;
+};
+
+struct malloc_fixture
+{
+    static constexpr const char *name = "malloc";
+    static constexpr size_t max_size = SIZE_MAX;
+
+    using allocator_type = mallocator;
+
+    void Report() {}
+
+    allocator_type allocator;
+};
+
+template <typename F, typename W>
+static void Run(const char *workload, W workloadFunction, size_t maxSize, uint32_t threads, const options &opts)
+{
+    if (maxSize > F::max_size)
+    {
+        return;
+    }
+
+    if ((opts.workload && strcmp(opts.workload, workload) != 0) ||
+        (opts.allocator && strcmp(opts.allocator, F::name) != 0))
+    {
+        return;
+    }
+
+    ResetPeakRss();
+
+    F *fixture = new F();
+    if (opts.counters)
+    {
+        opts.counters->Start();
+    }
+
+    run_result result = workloadFunction(&fixture->allocator, opts);
+
+    if (opts.counters)
+    {
+        opts.counters->Stop();
+    }
+
+    printf("%-18s %-12s %8u %12llu %14.0f %10.2f %12zu\n",
+           workload,
+           F::name,
+           threads,
+           (unsigned long long)result.ops,
+           (double)result.ops / result.seconds,
+           (result.seconds * 1e9) / (double)result.ops,
+           PeakRssKilobytes());
+
+    if (opts.counters)
+    {
+        PrintPerfCounters(*opts.counters, result.ops, stdout);
+    }
+
+    fixture->Report();
+    delete fixture;
+}
+
+template <typename F>
+static void RunAll(const options &opts)
+{
+    using A = typename F::allocator_type;
+
+    Run<F>("churn", ChurnWorkload<A>, small_max, 1, opts);
+    Run<F>("producer-consumer", ProducerConsumerWorkload<A>, small_max, 2, opts);
+    Run<F>("larson", LarsonWorkload<A>, small_max, opts.threads, opts);
+    Run<F>("realloc-growth", ReallocGrowthWorkload<A>, large_max, 1, opts);
+    Run<F>("mixed", MixedWorkload<A>, large_max, 1, opts);
+}
+
+int main(int argc, char **argv)
+{
+    options opts;
+    opts.scale = 100;
+    opts.threads = std::thread::hardware_concurrency();
+    opts.workload = nullptr;
+    opts.allocator = nullptr;
+    opts.latency = false;
+    opts.sampled = false;
+    opts.counters = nullptr;
+    bool perf = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--smoke") == 0)
+        {
+            // Just enough work to run every path.
+            opts.scale = 1;
+        }
+        else if (strcmp(argv[i], "--latency") == 0)
+        {
+            opts.latency = true;
+        }
+        else if (strcmp(argv[i], "--sampled") == 0)
+        {
+            opts.sampled = true;
+        }
+        else if (strcmp(argv[i], "--perf") == 0)
+        {
+            perf = true;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            opts.threads = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--workload") == 0 && i + 1 < argc)
+        {
+            opts.workload = argv[++i];
+        }
+        else if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc)
+        {
+            opts.allocator = argv[++i];
+        }
+        else
+        {
+            printf("usage: %s [--smoke] [--latency] [--sampled] [--perf] [--threads n] [--workload name] [--allocator name]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (opts.threads == 0)
+    {
+        opts.threads = 1;
+    }
+
+    // Opened before any workload thread exists, so every thread inherits them.
+    perf_counters counters;
+    if (perf)
+    {
+        if (counters.Open())
+        {
+            opts.counters = &counters;
+        }
+        else
+        {
+            printf("perf counters are not available here (see /proc/sys/kernel/perf_event_paranoid)\n");
+        }
+    }
+
+    printf("%-18s %-12s %8s %12s %14s %10s %12s\n", "workload", "allocator", "threads", "ops", "ops/sec", "ns/op", "peak RSS KB");
+    RunAll<best_fit_fixture>(opts);
+    if (opts.latency)
+    {
+        RunAll<best_fit_timed_fixture>(opts);
+    }
+    if (opts.sampled)
+    {
+        RunAll<best_fit_sampled_fixture>(opts);
+    }
+    RunAll<fixed_size_fixture>(opts);
+    RunAll<malloc_fixture>(opts);
+
+    if (opts.counters)
+    {
+        counters.Close();
+    }
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared by the benchmarks.
+
+using clock_type = std::chrono::steady_clock;
+
+static inline double Elapsed(clock_type::time_point begin)
+{
+    return std::chrono::duration<double>(clock_type::now() - begin).count();
+}
+
+// xorshift64, one per thread so the workloads don't share state.
+struct rng
+{
+    uint64_t state;
+
+    uint64_t Next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    // Uniform in [low, high].
+    size_t Range(size_t low, size_t high)
+    {
+        return low + (size_t)(Next() % (high - low + 1));
+    }
+
+    // Log-uniform in [1 << lowShift, 1 << highShift), every power of two is as likely as the next.
+    size_t LogUniform(uint32_t lowShift, uint32_t highShift)
+    {
+        uint32_t shift = lowShift + (uint32_t)(Next() % (highShift - lowShift));
+        size_t low = (size_t)1 << shift;
+        return low + (size_t)(Next() % low);
+    }
+};
+
+// Writes one byte per page, so every page of the allocation counts towards RSS.
+static inline void Touch(void *addr, size_t size)
+{
+    volatile uint8_t *bytes = (uint8_t *)addr;
+    for (size_t offset = 0; offset < size; offset += 4096)
+    {
+        bytes[offset] = 1;
+    }
+
+    bytes[size - 1] = 1;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Hardware and software counters around a benchmark phase, through perf_event_open.
+// Counters the kernel refuses (perf_event_paranoid, containers, no PMU, other platforms)
+// are left out, the rest still count. Counters are inherited by threads created after
+// Start, so multithreaded workloads are counted in full, and scaled up when the kernel had
+// to multiplex them.
+
+enum perf_counter_kind : uint32_t
+{
+    PerfCycles,
+    PerfInstructions,
+    PerfL1DMisses,
+    PerfLLCMisses,
+    PerfDTLBMisses,
+    PerfPageFaults,
+    perf_counter_count
+};
+
+static const char *const perf_counter_names[perf_counter_count] = { "cycles", "instructions", "L1d-misses", "LLC-misses", "dTLB-misses", "page-faults" };
+
+struct perf_counters
+{
+    int fds[perf_counter_count];
+    bool available[perf_counter_count];
+    uint64_t values[perf_counter_count];
+
+    // Returns false when no counter could be opened.
+    bool Open();
+    void Close();
+
+    void Start();
+    void Stop();
+
+    bool Any() const;
+};
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static inline int PerfEventOpen(uint32_t type, uint64_t config)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static inline uint64_t PerfCacheConfig(uint64_t cache, uint64_t op, uint64_t result)
+{
+    return cache | (op << 8) | (result << 16);
+}
+
+inline bool perf_counters::Open()
+{
+    static const uint32_t types[perf_counter_count] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_SOFTWARE
+    };
+
+    const uint64_t configs[perf_counter_count] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PerfCacheConfig(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+        PerfCacheConfig(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+        PerfCacheConfig(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+        PERF_COUNT_SW_PAGE_FAULTS,
+    };
+
+    for (uint32_t i = 0; i < perf_counter_count; ++i)
+    {
+        fds[i] = PerfEventOpen(types[i], configs[i]);
+        available[i] = fds[i] >= 0;
+        values[i] = 0;
+    }
+
+    return Any();
+}
+
+inline void perf_counters::Close()
+{
+    for (uint32_t i = 0; i < perf_counter_count; ++i)
+    {
+        if (available[i])
+        {
+            close(fds[i]);
+            available[i] = false;
+        }
+    }
+}
+
+inline void perf_counters::Start()
+{
+    for (uint32_t i = 0; i < perf_counter_count; ++i)
+    {
+        if (available[i])
+        {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+inline void perf_counters::Stop()
+{
+    for (uint32_t i = 0; i < perf_counter_count; ++i)
+    {
+        if (!available[i])
+        {
+            continue;
+        }
+
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        // value, time enabled, time running.
+        uint64_t data[3];
+        if (read(fds[i], data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0)
+        {
+            values[i] = 0;
+            continue;
+        }
+
+        values[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * ((double)data[1] / (double)data[2])) : data[0];
+    }
+}
+
+#else
+
+inline bool perf_counters::Open()
+{
+    for (uint32_t i = 0; i < perf_counter_count; ++i)
+    {
+        fds[i] = -1;
+        available[i] = false;
+        values[i] = 0;
+    }
+
+    return false;
+}
+
+inline void perf_counters::Close() {}
+inline void perf_counters::Start() {}
+inline void perf_counters::Stop() {}
+
+#endif
+
+inline bool perf_counters::Any() const
+{
+    for (uint32_t i = 0; i < perf_counter_count; ++i)
+    {
+        if (available[i])
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Counts per op, "-" for counters that weren't available.
+static inline void PrintPerfCounters(const perf_counters &counters, uint64_t ops, FILE *out)
+{
+    fprintf(out, "    ");
+    for (uint32_t i = 0; i < perf_counter_count; ++i)
+    {
+        if (counters.available[i])
+        {
+            fprintf(out, " %s/op %.2f", perf_counter_names[i], (double)counters.values[i] / (double)ops);
+        }
+        else
+        {
+            fprintf(out, " %s/op -", perf_counter_names[i]);
+        }
+    }
+
+    if (counters.available[PerfCycles] && counters.available[PerfInstructions] && counters.values[PerfCycles])
+    {
+        fprintf(out, " IPC %.2f", (double)counters.values[PerfInstructions] / (double)counters.values[PerfCycles]);
+    }
+
+    fprintf(out, "\n");
+}
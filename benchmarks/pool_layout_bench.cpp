@@ -0,0 +1,277 @@
+// Measures how fixed_size_allocator bucket coloring and cache line padding affect
+// multi-threaded update throughput.
+//
+// false-sharing: Objects are allocated round-robin for each thread from one shared pool,
+//                so tightly packed neighbours belong to different threads.
+// coloring:      Each thread updates the first chunk of many small page aligned buckets.
+//                Without coloring every one of those chunks lands in the same cache sets.
+//
+// Only meaningful with at least two cores and no more threads than cores.
+//
+// usage: pool_layout_bench [threads] [seconds per run]
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define BM_WIN32_MEMORY_INTERFACE_IMPLEMENTATION
+#include "win32_memory_interface.h"
+using os_memory_interface = win32_virtual_memory_interface;
+#else
+#define BM_POSIX_MEMORY_INTERFACE_IMPLEMENTATION
+#include "posix_memory_interface.h"
+using os_memory_interface = posix_virtual_memory_interface;
+#endif
+
+#include "allocator_interface.h"
+#include "fixed_size_allocator.h"
+
+// Gives every allocation its own pages, so all buckets start on a page boundary.
+struct page_allocator
+{
+    struct region
+    {
+        void *addr;
+        size_t size;
+    };
+
+    os_memory_interface *m_memory;
+    std::vector<region> m_regions;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+};
+
+void *page_allocator::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)alignment;
+    (void)line;
+    (void)file;
+
+    size_t reserved;
+    void *addr = m_memory->Reserve(size, &reserved);
+
+    size_t committed;
+    m_memory->Commit(addr, reserved, &committed);
+
+    m_regions.push_back({ addr, reserved });
+    return addr;
+}
+
+void page_allocator::FreeInternal(void *addr, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    for (size_t i = 0; i < m_regions.size(); ++i)
+    {
+        if (m_regions[i].addr == addr)
+        {
+            m_memory->DeCommit(addr, m_regions[i].size);
+            m_memory->Release(addr, m_regions[i].size);
+            m_regions[i] = m_regions.back();
+            m_regions.pop_back();
+            return;
+        }
+    }
+}
+
+void *page_allocator::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    (void)addr;
+    (void)size;
+    (void)line;
+    (void)file;
+    return nullptr;
+}
+
+void *page_allocator::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    // Every allocation is freshly committed.
+    return AllocInternal(size, alignment, line, file);
+}
+
+struct counter
+{
+    uint64_t value;
+};
+
+using clock_type = std::chrono::steady_clock;
+
+// Runs one update loop per thread over its objects, returns total updates per second.
+static double RunUpdates(std::vector<std::vector<counter *>> &perThread, double seconds)
+{
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::vector<uint64_t> updates(perThread.size(), 0);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < perThread.size(); ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            std::vector<counter *> &objects = perThread[t];
+            uint64_t count = 0;
+
+            while (!start.load(std::memory_order_acquire));
+
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                for (counter *object : objects)
+                {
+                    // Volatile so the compiler keeps every store.
+                    volatile uint64_t *value = &object->value;
+                    *value = *value + 1;
+                }
+
+                count += objects.size();
+            }
+
+            updates[t] = count;
+        });
+    }
+
+    clock_type::time_point begin = clock_type::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true, std::memory_order_relaxed);
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    double elapsed = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+    uint64_t total = 0;
+    for (uint64_t count : updates)
+    {
+        total += count;
+    }
+
+    return (double)total / elapsed;
+}
+
+static double FalseSharingRun(page_allocator *pages, uint32_t threadCount, uint32_t flags, double seconds)
+{
+    const uint32_t objectsPerThread = 256;
+
+    fixed_size_allocator<page_allocator> pool(pages, objectsPerThread * threadCount, sizeof(counter), alignof(counter), flags);
+
+    std::vector<std::vector<counter *>> perThread(threadCount);
+    for (uint32_t i = 0; i < objectsPerThread; ++i)
+    {
+        for (uint32_t t = 0; t < threadCount; ++t)
+        {
+            counter *object = (counter *)pool.ALLOC(sizeof(counter), alignof(counter));
+            object->value = 0;
+            perThread[t].push_back(object);
+        }
+    }
+
+    double result = RunUpdates(perThread, seconds);
+
+    for (std::vector<counter *> &objects : perThread)
+    {
+        for (counter *object : objects)
+        {
+            pool.FREE(object);
+        }
+    }
+
+    return result;
+}
+
+static double ColoringRun(page_allocator *pages, uint32_t threadCount, uint32_t flags, double seconds)
+{
+    const uint32_t bucketsPerThread = 512;
+    const uint32_t chunksPerBucket = 4;
+
+    std::vector<fixed_size_allocator<page_allocator> *> pools;
+    std::vector<std::vector<counter *>> perThread(threadCount);
+    std::vector<std::vector<counter *>> filler(threadCount);
+
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        fixed_size_allocator<page_allocator> *pool = new fixed_size_allocator<page_allocator>(pages, chunksPerBucket, sizeof(counter), alignof(counter), flags);
+        pools.push_back(pool);
+
+        for (uint32_t b = 0; b < bucketsPerThread; ++b)
+        {
+            // The first chunk of each bucket is the hot one, the rest only fill the bucket
+            // so the next allocation starts a new one.
+            for (uint32_t c = 0; c < chunksPerBucket; ++c)
+            {
+                counter *object = (counter *)pool->ALLOC(sizeof(counter), alignof(counter));
+                object->value = 0;
+                (c == 0 ? perThread[t] : filler[t]).push_back(object);
+            }
+        }
+    }
+
+    double result = RunUpdates(perThread, seconds);
+
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        for (counter *object : perThread[t]) pools[t]->FREE(object);
+        for (counter *object : filler[t]) pools[t]->FREE(object);
+        delete pools[t];
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t threadCount = argc > 1 ? (uint32_t)atoi(argv[1]) : std::thread::hardware_concurrency();
+    double seconds = argc > 2 ? atof(argv[2]) : 1.0;
+
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    }
+
+    // False sharing needs the threads running at the same time on different cores.
+    uint32_t cores = std::thread::hardware_concurrency();
+    if (cores < 2 || threadCount > cores)
+    {
+        fprintf(stderr, "warning: %u threads on %u cores, false sharing can't show up and the layouts can't be compared\n", threadCount, cores);
+    }
+
+    os_memory_interface memory;
+    page_allocator pages;
+    pages.m_memory = &memory;
+
+    struct layout
+    {
+        const char *name;
+        uint32_t flags;
+    };
+
+    layout layouts[] =
+    {
+        { "packed", 0 },
+        { "colored", FixedSizeColorBuckets },
+        { "padded", FixedSizeCacheLinePadding },
+        { "colored+padded", FixedSizeColorBuckets | FixedSizeCacheLinePadding },
+    };
+
+    printf("%-14s %-16s %8s %16s\n", "workload", "layout", "threads", "updates/sec");
+    for (layout &l : layouts)
+    {
+        double rate = FalseSharingRun(&pages, threadCount, l.flags, seconds);
+        printf("%-14s %-16s %8u %16.0f\n", "false-sharing", l.name, threadCount, rate);
+    }
+
+    for (layout &l : layouts)
+    {
+        double rate = ColoringRun(&pages, threadCount, l.flags, seconds);
+        printf("%-14s %-16s %8u %16.0f\n", "coloring", l.name, threadCount, rate);
+    }
+
+    return 0;
+}
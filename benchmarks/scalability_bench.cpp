@@ -0,0 +1,555 @@
+// Measures how the locked allocator stacks scale as threads are added.
+//
+// thread-local: Each thread replaces random objects in its own window.
+// shared:       All threads replace random objects in one window, so an object is
+//               usually freed by a different thread than the one that allocated it.
+// cross-thread: Each thread allocates objects and hands them to the next thread to free.
+//
+// Every run reports throughput, the latency percentiles of a sample of the individual
+// allocs and frees, and how often the allocator's spin lock was contended.
+//
+// usage: scalability_bench [--smoke] [--max-threads n] [--ops n] [--format table|csv|json]
+//                          [--pattern name] [--allocator name]
+
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define BM_WIN32_MEMORY_INTERFACE_IMPLEMENTATION
+#include "win32_memory_interface.h"
+using os_memory_interface = win32_virtual_memory_interface;
+#else
+#define BM_POSIX_MEMORY_INTERFACE_IMPLEMENTATION
+#include "posix_memory_interface.h"
+using os_memory_interface = posix_virtual_memory_interface;
+#endif
+
+#if !defined(BM_SPIN_LOCK_STATS)
+#define BM_SPIN_LOCK_STATS
+#endif
+
+#define BM_MALLOCATOR_IMPLEMENTATION
+#include "mallocator.h"
+#include "allocator_interface.h"
+#include "allocator_spinlock.h"
+#include "best_fit_allocator.h"
+#include "fixed_size_allocator.h"
+#include "bench_util.h"
+
+static constexpr size_t object_max = 256;
+
+// One op in sample_interval is timed.
+static constexpr uint64_t sample_interval = 8;
+
+enum output_format
+{
+    FormatTable,
+    FormatCsv,
+    FormatJson,
+};
+
+struct options
+{
+    uint32_t maxThreads;
+    uint64_t opsPerThread;
+    output_format format;
+    const char *pattern;
+    const char *allocator;
+};
+
+struct thread_state
+{
+    rng random;
+    uint64_t ops;
+    std::vector<uint32_t> samples;
+};
+
+struct run_result
+{
+    uint64_t ops;
+    double seconds;
+    uint32_t p50;
+    uint32_t p99;
+    uint32_t p999;
+    uint32_t max;
+};
+
+template <typename F>
+static inline void TimedOp(thread_state *state, F op)
+{
+    if (++state->ops % sample_interval != 0)
+    {
+        op();
+        return;
+    }
+
+    clock_type::time_point begin = clock_type::now();
+    op();
+    uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - begin).count();
+    state->samples.push_back(ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns);
+}
+
+template <typename A>
+static void *TimedAlloc(A *allocator, thread_state *state)
+{
+    size_t size = state->random.Range(16, object_max);
+    void *result = nullptr;
+    TimedOp(state, [&]() { result = allocator->ALLOC(size, 16); });
+    *(volatile uint8_t *)result = 1;
+    return result;
+}
+
+template <typename A>
+static void TimedFree(A *allocator, thread_state *state, void *addr)
+{
+    TimedOp(state, [&]() { allocator->FREE(addr); });
+}
+
+template <typename A>
+static void ThreadLocalPattern(A *allocator, thread_state *state, uint32_t t, uint32_t threadCount, const options &opts)
+{
+    (void)t;
+    (void)threadCount;
+
+    const size_t window = 1024;
+    std::vector<void *> slots(window, nullptr);
+
+    for (uint64_t i = 0; i < opts.opsPerThread / 2; ++i)
+    {
+        size_t slot = (size_t)(state->random.Next() % window);
+        if (slots[slot])
+        {
+            TimedFree(allocator, state, slots[slot]);
+        }
+
+        slots[slot] = TimedAlloc(allocator, state);
+    }
+
+    for (void *slot : slots)
+    {
+        if (slot)
+        {
+            TimedFree(allocator, state, slot);
+        }
+    }
+}
+
+struct shared_state
+{
+    std::vector<std::atomic<void *>> slots;
+    std::vector<std::vector<void *>> inboxes;
+    std::vector<std::atomic<uint64_t>> heads;
+    std::vector<std::atomic<uint64_t>> tails;
+    std::vector<std::atomic<bool>> done;
+
+    shared_state(uint32_t threadCount, size_t windowSize, size_t inboxSize)
+        : slots(windowSize),
+          inboxes(threadCount, std::vector<void *>(inboxSize)),
+          heads(threadCount),
+          tails(threadCount),
+          done(threadCount)
+    {
+        for (std::atomic<void *> &slot : slots) slot.store(nullptr);
+        for (uint32_t t = 0; t < threadCount; ++t)
+        {
+            heads[t].store(0);
+            tails[t].store(0);
+            done[t].store(false);
+        }
+    }
+};
+
+static shared_state *g_shared;
+
+template <typename A>
+static void SharedPattern(A *allocator, thread_state *state, uint32_t t, uint32_t threadCount, const options &opts)
+{
+    (void)t;
+    (void)threadCount;
+
+    std::vector<std::atomic<void *>> &slots = g_shared->slots;
+    for (uint64_t i = 0; i < opts.opsPerThread / 2; ++i)
+    {
+        size_t slot = (size_t)(state->random.Next() % slots.size());
+        void *previous = slots[slot].exchange(TimedAlloc(allocator, state));
+        if (previous)
+        {
+            TimedFree(allocator, state, previous);
+        }
+    }
+}
+
+// Frees everything waiting in thread t's inbox, returns how many.
+template <typename A>
+static uint64_t DrainInbox(A *allocator, thread_state *state, uint32_t t)
+{
+    std::vector<void *> &inbox = g_shared->inboxes[t];
+    uint64_t tail = g_shared->tails[t].load(std::memory_order_relaxed);
+    uint64_t head = g_shared->heads[t].load(std::memory_order_acquire);
+
+    for (uint64_t i = tail; i < head; ++i)
+    {
+        TimedFree(allocator, state, inbox[i % inbox.size()]);
+    }
+
+    g_shared->tails[t].store(head, std::memory_order_release);
+    return head - tail;
+}
+
+template <typename A>
+static void CrossThreadPattern(A *allocator, thread_state *state, uint32_t t, uint32_t threadCount, const options &opts)
+{
+    uint32_t next = (t + 1) % threadCount;
+    uint32_t previous = (t + threadCount - 1) % threadCount;
+    std::vector<void *> &nextInbox = g_shared->inboxes[next];
+
+    for (uint64_t i = 0; i < opts.opsPerThread / 2; ++i)
+    {
+        DrainInbox(allocator, state, t);
+
+        void *object = TimedAlloc(allocator, state);
+
+        // Only this thread pushes to the next inbox.
+        uint64_t head = g_shared->heads[next].load(std::memory_order_relaxed);
+        while (head - g_shared->tails[next].load(std::memory_order_acquire) >= nextInbox.size())
+        {
+            // Keep freeing while waiting, or a full ring of threads would deadlock.
+            if (DrainInbox(allocator, state, t) == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        nextInbox[head % nextInbox.size()] = object;
+        g_shared->heads[next].store(head + 1, std::memory_order_release);
+    }
+
+    g_shared->done[t].store(true, std::memory_order_release);
+
+    // Whatever the previous thread still sends has to be freed here.
+    for (;;)
+    {
+        bool previousDone = g_shared->done[previous].load(std::memory_order_acquire);
+        if (DrainInbox(allocator, state, t) == 0 && previousDone)
+        {
+            break;
+        }
+
+        std::this_thread::yield();
+    }
+}
+
+template <typename A, typename P>
+static run_result RunPattern(A *allocator, P pattern, uint32_t threadCount, const options &opts)
+{
+    shared_state shared(threadCount, 4096, 256);
+    g_shared = &shared;
+
+    std::vector<thread_state> states(threadCount);
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        states[t].random.state = 0x9E3779B97F4A7C15ull * (t + 1);
+        states[t].ops = 0;
+        states[t].samples.reserve((size_t)(opts.opsPerThread / sample_interval) + 16);
+    }
+
+    std::atomic<bool> start(false);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            while (!start.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            pattern(allocator, &states[t], t, threadCount, opts);
+        });
+    }
+
+    clock_type::time_point begin = clock_type::now();
+    start.store(true, std::memory_order_release);
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    run_result result = {};
+    result.seconds = Elapsed(begin);
+
+    for (std::atomic<void *> &slot : shared.slots)
+    {
+        if (slot.load())
+        {
+            allocator->FREE(slot.load());
+        }
+    }
+
+    std::vector<uint32_t> samples;
+    for (thread_state &state : states)
+    {
+        result.ops += state.ops;
+        samples.insert(samples.end(), state.samples.begin(), state.samples.end());
+    }
+
+    if (!samples.empty())
+    {
+        std::sort(samples.begin(), samples.end());
+        result.p50 = samples[samples.size() / 2];
+        result.p99 = samples[(samples.size() * 99) / 100];
+        result.p999 = samples[(samples.size() * 999) / 1000];
+        result.max = samples.back();
+    }
+
+    g_shared = nullptr;
+    return result;
+}
+
+template <typename T>
+static bool GetLockStats(allocator_spin_lock<T> *allocator, spin_lock_stats *stats)
+{
+    *stats = allocator->m_stats;
+    return true;
+}
+
+template <typename A>
+static bool GetLockStats(A *allocator, spin_lock_stats *stats)
+{
+    (void)allocator;
+    *stats = {};
+    return false;
+}
+
+struct best_fit_fixture
+{
+    static constexpr const char *name = "best_fit";
+
+    using heap_type = best_fit_allocator<os_memory_interface>;
+    using allocator_type = allocator_spin_lock<heap_type>;
+
+    best_fit_fixture()
+        : heap(&memory, (size_t)8 * 1024 * 1024 * 1024),
+          allocator(&heap)
+    {
+    }
+
+    os_memory_interface memory;
+    heap_type heap;
+    allocator_type allocator;
+};
+
+struct fixed_size_fixture
+{
+    static constexpr const char *name = "fixed_size";
+
+    using pool_type = fixed_size_allocator<mallocator>;
+    using allocator_type = allocator_spin_lock<pool_type>;
+
+    fixed_size_fixture()
+        : pool(&buckets, 4096, object_max, 16),
+          allocator(&pool)
+    {
+    }
+
+    mallocator buckets;
+    pool_type pool;
+    allocator_type allocator;
+};
+
+struct malloc_fixture
+{
+    static constexpr const char *name = "malloc";
+
+    using allocator_type = mallocator;
+
+    allocator_type allocator;
+};
+
+static bool g_firstRow = true;
+
+static void PrintHeader(const options &opts)
+{
+    switch (opts.format)
+    {
+    case FormatTable:
+        printf("%-12s %-13s %8s %12s %14s %8s %8s %8s %10s %14s %10s %12s\n",
+               "allocator", "pattern", "threads", "ops", "ops/sec", "p50 ns", "p99 ns", "p999 ns", "max ns",
+               "acquisitions", "contended", "spins/acq");
+        break;
+    case FormatCsv:
+        printf("allocator,pattern,threads,ops,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns,lock_acquisitions,lock_contended,lock_spins\n");
+        break;
+    case FormatJson:
+        printf("[\n");
+        break;
+    }
+}
+
+static void PrintFooter(const options &opts)
+{
+    if (opts.format == FormatJson)
+    {
+        printf("\n]\n");
+    }
+}
+
+static void PrintRow(const options &opts, const char *allocator, const char *pattern, uint32_t threads,
+                     const run_result &result, bool hasLock, const spin_lock_stats &lock)
+{
+    double opsPerSec = (double)result.ops / result.seconds;
+    double spinsPerAcquire = lock.acquisitions ? (double)lock.spins / (double)lock.acquisitions : 0.0;
+
+    switch (opts.format)
+    {
+    case FormatTable:
+        if (hasLock)
+        {
+            printf("%-12s %-13s %8u %12llu %14.0f %8u %8u %8u %10u %14llu %10llu %12.2f\n",
+                   allocator, pattern, threads, (unsigned long long)result.ops, opsPerSec,
+                   result.p50, result.p99, result.p999, result.max,
+                   (unsigned long long)lock.acquisitions, (unsigned long long)lock.contended, spinsPerAcquire);
+        }
+        else
+        {
+            printf("%-12s %-13s %8u %12llu %14.0f %8u %8u %8u %10u %14s %10s %12s\n",
+                   allocator, pattern, threads, (unsigned long long)result.ops, opsPerSec,
+                   result.p50, result.p99, result.p999, result.max, "-", "-", "-");
+        }
+        break;
+    case FormatCsv:
+        printf("%s,%s,%u,%llu,%.0f,%u,%u,%u,%u,%llu,%llu,%llu\n",
+               allocator, pattern, threads, (unsigned long long)result.ops, opsPerSec,
+               result.p50, result.p99, result.p999, result.max,
+               (unsigned long long)lock.acquisitions, (unsigned long long)lock.contended, (unsigned long long)lock.spins);
+        break;
+    case FormatJson:
+        printf("%s  {\"allocator\": \"%s\", \"pattern\": \"%s\", \"threads\": %u, \"ops\": %llu, \"ops_per_sec\": %.0f, "
+               "\"p50_ns\": %u, \"p99_ns\": %u, \"p999_ns\": %u, \"max_ns\": %u",
+               g_firstRow ? "" : ",\n", allocator, pattern, threads, (unsigned long long)result.ops, opsPerSec,
+               result.p50, result.p99, result.p999, result.max);
+        if (hasLock)
+        {
+            printf(", \"lock_acquisitions\": %llu, \"lock_contended\": %llu, \"lock_spins\": %llu}",
+                   (unsigned long long)lock.acquisitions, (unsigned long long)lock.contended, (unsigned long long)lock.spins);
+        }
+        else
+        {
+            printf("}");
+        }
+        break;
+    }
+
+    g_firstRow = false;
+    fflush(stdout);
+}
+
+template <typename F, typename P>
+static void Sweep(const char *pattern, P patternFunction, const options &opts)
+{
+    if ((opts.pattern && strcmp(opts.pattern, pattern) != 0) ||
+        (opts.allocator && strcmp(opts.allocator, F::name) != 0))
+    {
+        return;
+    }
+
+    // Powers of two up to the maximum, and the maximum itself.
+    for (uint32_t threads = 1;; threads *= 2)
+    {
+        if (threads > opts.maxThreads)
+        {
+            threads = opts.maxThreads;
+        }
+
+        F *fixture = new F();
+        run_result result = RunPattern(&fixture->allocator, patternFunction, threads, opts);
+
+        spin_lock_stats lock;
+        bool hasLock = GetLockStats(&fixture->allocator, &lock);
+        delete fixture;
+
+        PrintRow(opts, F::name, pattern, threads, result, hasLock, lock);
+
+        if (threads == opts.maxThreads)
+        {
+            break;
+        }
+    }
+}
+
+template <typename F>
+static void SweepAll(const options &opts)
+{
+    using A = typename F::allocator_type;
+
+    Sweep<F>("thread-local", ThreadLocalPattern<A>, opts);
+    Sweep<F>("shared", SharedPattern<A>, opts);
+    Sweep<F>("cross-thread", CrossThreadPattern<A>, opts);
+}
+
+int main(int argc, char **argv)
+{
+    options opts;
+    opts.maxThreads = std::thread::hardware_concurrency();
+    opts.opsPerThread = 1000000;
+    opts.format = FormatTable;
+    opts.pattern = nullptr;
+    opts.allocator = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--smoke") == 0)
+        {
+            opts.opsPerThread = 10000;
+            if (opts.maxThreads > 2) opts.maxThreads = 2;
+        }
+        else if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc)
+        {
+            opts.maxThreads = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc)
+        {
+            opts.opsPerThread = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            ++i;
+            if (strcmp(argv[i], "csv") == 0) opts.format = FormatCsv;
+            else if (strcmp(argv[i], "json") == 0) opts.format = FormatJson;
+            else opts.format = FormatTable;
+        }
+        else if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc)
+        {
+            opts.pattern = argv[++i];
+        }
+        else if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc)
+        {
+            opts.allocator = argv[++i];
+        }
+        else
+        {
+            printf("usage: %s [--smoke] [--max-threads n] [--ops n] [--format table|csv|json] [--pattern name] [--allocator name]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (opts.maxThreads == 0)
+    {
+        opts.maxThreads = 1;
+    }
+
+    PrintHeader(opts);
+    SweepAll<best_fit_fixture>(opts);
+    SweepAll<fixed_size_fixture>(opts);
+    SweepAll<malloc_fixture>(opts);
+    PrintFooter(opts);
+
+    return 0;
+}
@@ -2,6 +2,9 @@
 
 #include "memory_interface.h"
 #include "allocator_interface.h"
+#include "platform.h"
+#include "clear_memory.h"
+#include "heap_layout.h"
 
 #ifdef USE_STL
 #include <unordered_map>
@@ -11,6 +14,11 @@
 #define BM_RESTRICT __restrict
 #endif
 
+// Profiling hook, tests/timed_block.h defines it when included first.
+#if !defined(BM_TIMED_BLOCK)
+#define BM_TIMED_BLOCK(name)
+#endif
+
 static constexpr bool IsPowerOf2(size_t value)
 {
     return value && !(value & (value - 1));
@@ -31,6 +39,48 @@ static inline void *SnapUpToPow2Increment(void *value, size_t increment)
     return (void *)SnapUpToPow2Increment((size_t)value, increment);
 }
 
+// Occupancy of the commit granules (hugepages) of a best_fit_allocator.
+// allocated_bytes / ((full + partial) * hugepage_size) is how densely the hugepages in
+// use are packed.
+struct best_fit_hugepage_stats
+{
+    size_t hugepage_size;
+    size_t committed;
+    size_t full;
+    size_t partial;
+    size_t empty;
+    size_t purged;
+    size_t allocated_bytes;
+};
+
+// Heap totals of a best_fit_allocator. The allocator keeps them up to date as it runs, so
+// GetStats is cheap. Block sizes exclude their headers, header_bytes counts those.
+// external_fragmentation is 1 - largest_free_block / free_bytes: 0 when all free memory is
+// one block, close to 1 when it is scattered over many small ones.
+struct best_fit_stats
+{
+    size_t reserved;
+    size_t committed;
+    size_t peak_committed;
+    size_t purged;
+    size_t allocated_bytes;
+    size_t peak_allocated_bytes;
+    size_t free_bytes;
+    size_t header_bytes;
+    size_t allocated_blocks;
+    size_t free_blocks;
+    size_t largest_free_block;
+    double external_fragmentation;
+};
+
+// A range past the committed end of a best_fit_allocator being committed ahead of time.
+struct best_fit_precommit
+{
+    void *addr;
+    size_t size;
+    size_t generation;
+};
+
 // MI = Memory interface type.
 // MA = Minimum allowed alignment. Must be atleast 2 and a power of 2.
 template <typename MI, size_t MA=16>
@@ -43,7 +93,12 @@ struct best_fit_allocator
     // the free bit is also stored in the lsb of the prev pointer in the block_header.
     static_assert(MA > 1, "MA must be atleast 2");
 
-    best_fit_allocator(MI *memoryProvider, size_t minimumReservation);
+    // commitGranularity is the unit memory is committed and purged in, 0 for the page size.
+    // Pass the hugepage size (with a memory interface that backs it with hugepages) to keep
+    // the heap on whole hugepages. The allocator then counts the allocated bytes in each
+    // hugepage, and placement prefers a slightly larger free block in a partially used
+    // hugepage over the best fit in an empty one, so empty hugepages stay empty for Purge.
+    best_fit_allocator(MI *memoryProvider, size_t minimumReservation, size_t commitGranularity = 0);
     best_fit_allocator(const best_fit_allocator &) = delete;
     best_fit_allocator() = delete;
 
@@ -51,6 +106,37 @@ struct best_fit_allocator
 
 
     DECLARE_ALLOCATOR_INTERFACE_METHODS();    
+
+    // Frees every allocation at once by collapsing the heap back into a single free block.
+    // Committed memory past retainCommitted bytes (rounded up to a page) is decommitted.
+    void Reset(size_t retainCommitted = SIZE_MAX);
+
+    // True if addr lies within this allocator's reservation.
+    bool Owns(void *addr);
+
+    // Decommits every commit granule that lies entirely inside a free block.
+    // Returns the number of bytes decommitted.
+    size_t Purge();
+
+    // Walks every block, O(n). Meant for diagnostics, not for every allocation.
+    void GetHugePageStats(best_fit_hugepage_stats *stats);
+
+    // O(log n) for the largest free block, everything else is kept as the heap changes.
+    void GetStats(best_fit_stats *stats);
+
+    // Writes every block in address order, see heap_layout.h. Doesn't allocate. callsite,
+    // when given, names the allocated blocks. Returns false if the dump failed to write.
+    bool DumpLayout(FILE *out, heap_layout_format format = HeapLayoutBinary, heap_layout_callsite_fn callsite = nullptr, void *user = nullptr);
+
+    // Commits and faults in memory past the committed end, so growing the heap later doesn't
+    // take page faults. The slow middle step runs without the allocator's lock: BeginPreCommit
+    // and EndPreCommit must hold the same lock as the allocation calls, PreCommit must not.
+    // BeginPreCommit returns false when headroom bytes past the committed end are already ready,
+    // or another pre-commit is in flight. Growing the heap into an in flight range, Reset and
+    // Purge wait for PreCommit to finish, so the heap never touches pages it is faulting in.
+    bool BeginPreCommit(size_t headroom, best_fit_precommit *work);
+    void PreCommit(best_fit_precommit *work);
+    void EndPreCommit(best_fit_precommit *work);
     
     // Corruption detection.
     void DetectCorruption();
@@ -148,16 +234,69 @@ private:
     static constexpr size_t free_block_overhead = SnapUpToIncrement(sizeof(free_block), chunk_size);
     static constexpr size_t smallest_valid_free_block = free_block_overhead > (2 * chunk_size) ? free_block_overhead : (2 * chunk_size);
 
+    // How many free blocks past the best fit FindBestFit looks at for one in a used granule.
+    static constexpr uint32_t placement_candidates = 8;
+
+    static constexpr uint32_t precommit_idle = 0;
+    static constexpr uint32_t precommit_committing = 1;
+    static constexpr uint32_t precommit_committed = 2;
+
     MI *memory_provider;
 
     void *base;
     size_t mem_reserved;
     size_t mem_committed;
+    size_t commit_granularity;
+
+    // Bytes from base that are committed, including pre-committed memory past mem_committed.
+    size_t mem_ready;
+
+    // Bumped when ready memory is decommitted, so an in flight pre-commit isn't published.
+    size_t precommit_generation;
+
+    // precommit_idle, or where the in flight pre-commit is. PreCommit sets it without the lock.
+    uint32_t precommit_state;
+
+    // End offset of the in flight range, 0 once Reset has decommitted past its start.
+    size_t precommit_end;
+
+    // A set bit means the granule was decommitted by Purge. Only reserved on the first Purge.
+    uint64_t *purged_bits;
+    size_t purged_bits_size;
+    size_t purged_count;
+
+    // Allocated bytes in each commit granule, only kept when granules are larger than a page.
+    size_t *granule_used;
+    size_t granule_used_size;
+
+    // Offset past everything the heap has written to. Memory above it is still zero from
+    // its commit, so zeroed allocations only clear below it.
+    size_t zero_watermark;
+
+    // Running totals for GetStats. Committed memory minus the headers and the allocated
+    // bytes is free.
+    size_t block_count;
+    size_t allocated_bytes;
+    size_t allocated_blocks;
+    size_t peak_allocated_bytes;
+    size_t peak_committed;
 
     block_header *first;
     block_header *last;
     free_block *root;
 
+    void InitRootBlock();
+    void *Allocate(size_t size, uint32_t alignment, bool zeroed);
+    void ClearDirty(uint8_t *addr, size_t size);
+    void RaiseZeroWatermark(uint8_t *end);
+    size_t CommitMore(size_t size);
+    void WaitForPreCommit();
+    void EnsureCommitted(void *addr, size_t size);
+    void PurgeInternal(free_block *node);
+    bool IsPurged(size_t granule);
+    void TrackGranules(block_header *header, bool allocated);
+    bool InUsedGranule(free_block *block);
+    free_block *NextBySize(free_block *node);
     bool IsCommitted(void *addr, size_t size);
     void GetCommitParams(size_t requestedSize, void **paramAddress, size_t *paramSize);
     free_block *FindBestFit(size_t size);
@@ -364,6 +503,35 @@ void best_fit_allocator<MI, MA>::ValidateFreeListSize()
     }
 
     BM_ASSERT(mem == 0, "Internal allocation list leak detected");
+
+    size_t blocks = 0;
+    size_t allocatedBytes = 0;
+    size_t allocatedBlocks = 0;
+    for (block_header *header = first;
+         header != nullptr;
+         header = header->next)
+    {
+        ++blocks;
+        if (!header->GetFree())
+        {
+            allocatedBytes += header->GetSize(this);
+            ++allocatedBlocks;
+        }
+    }
+
+    BM_ASSERT(blocks == block_count, "Block count is out of sync with the block list");
+    BM_ASSERT(allocatedBytes == allocated_bytes && allocatedBlocks == allocated_blocks, "Allocated totals are out of sync with the block list");
+
+    if (granule_used)
+    {
+        size_t granuleBytes = 0;
+        for (size_t i = 0; i < mem_reserved / commit_granularity; ++i)
+        {
+            granuleBytes += granule_used[i];
+        }
+
+        BM_ASSERT(granuleBytes == allocated_bytes, "Granule occupancy is out of sync with the block list");
+    }
 }
 
 template <typename MI, size_t MA>
@@ -462,21 +630,63 @@ void best_fit_allocator<MI, MA>::DetectCorruption()
 template <typename MI, size_t MA>
 best_fit_allocator<MI, MA>::best_fit_allocator(
     MI *memoryProvider,
-    size_t minimumReservation) :
-    memory_provider(memoryProvider)
+    size_t minimumReservation,
+    size_t commitGranularity) :
+    memory_provider(memoryProvider),
+    precommit_generation(0),
+      precommit_state(precommit_idle),
+      precommit_end(0),
+    purged_bits(nullptr),
+    purged_bits_size(0),
+    purged_count(0),
+    granule_used(nullptr),
+    granule_used_size(0),
+    zero_watermark(free_block_overhead)
 {
-    base = memory_provider->Reserve(minimumReservation, &mem_reserved);
+    size_t pageSize = memory_provider->GetPageSize();
+
+    if (commitGranularity > pageSize)
+    {
+        BM_ASSERT(IsPowerOf2(commitGranularity), "The commit granularity must be a power of 2");
+
+        // Granules have to line up with the hugepages, so align the reservation to them.
+        commit_granularity = commitGranularity;
+        base = memory_provider->Reserve(SnapUpToPow2Increment(minimumReservation, commitGranularity), commitGranularity, &mem_reserved);
+    }
+    else
+    {
+        commit_granularity = pageSize;
+        base = memory_provider->Reserve(minimumReservation, &mem_reserved);
+    }
+
     BM_ASSERT(base, "Failed to reserve memory");
 
-    size_t pageSize = memory_provider->GetPageSize();
+    if (commit_granularity > pageSize)
+    {
+        size_t granules = mem_reserved / commit_granularity;
+        granule_used = (size_t *)memory_provider->Reserve(granules * sizeof(size_t), &granule_used_size);
+        BM_ASSERT(granule_used, "Failed to reserve the granule occupancy table");
 
-    // Commit the first page.
-    memory_provider->Commit(base, pageSize, &mem_committed);
+        size_t actualCommit;
+        memory_provider->Commit(granule_used, granule_used_size, &actualCommit);
+    }
+
+    // Commit the first granule.
+    memory_provider->Commit(base, commit_granularity, &mem_committed);
+    mem_ready = mem_committed;
+    peak_committed = mem_committed;
+    peak_allocated_bytes = 0;
 
     BM_ASSERT(pageSize >= sizeof(block_header), "The OS page size is smaller than a link in the internal list. The memory interface is probably not reporting an accurate page size");
     BM_ASSERT(GetAlignment(base) >= alignof(block_header), "");
 
-    // Initialize the first block.
+    InitRootBlock();
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::InitRootBlock()
+{
+    // The first block spans all committed memory.
     root = (free_block *)base;
     root->header.SetPrev(nullptr);
     root->header.next = nullptr;
@@ -488,13 +698,450 @@ best_fit_allocator<MI, MA>::best_fit_allocator(
 
     first = &root->header;
     last = first;
+
+    if (granule_used)
+    {
+        for (size_t i = 0; i < mem_reserved / commit_granularity; ++i)
+        {
+            granule_used[i] = 0;
+        }
+    }
+
+    block_count = 1;
+    allocated_bytes = 0;
+    allocated_blocks = 0;
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::Reset(size_t retainCommitted)
+{
+    if (retainCommitted < mem_ready)
+    {
+        WaitForPreCommit();
+
+        // Always keep the granule holding the root block.
+        size_t keep = SnapUpToIncrement(retainCommitted > commit_granularity ? retainCommitted : commit_granularity, commit_granularity);
+
+        if (keep < mem_ready)
+        {
+            memory_provider->DeCommit((uint8_t *)base + keep, mem_ready - keep);
+            mem_ready = keep;
+            precommit_end = 0;
+            ++precommit_generation;
+        }
+
+        if (keep < mem_committed)
+        {
+
+            // Granules past the new end are committed again by the normal growth path.
+            for (size_t granule = keep / commit_granularity; purged_count && granule < mem_committed / commit_granularity; ++granule)
+            {
+                if (IsPurged(granule))
+                {
+                    purged_bits[granule / 64] &= ~(1llu << (granule & 63));
+                    --purged_count;
+                }
+            }
+
+            mem_committed = keep;
+        }
+
+        if (keep < zero_watermark)
+        {
+            zero_watermark = keep;
+        }
+    }
+
+    InitRootBlock();
 }
 
 template<typename MI, size_t MA>
 best_fit_allocator<MI, MA>::~best_fit_allocator()
 {
-    memory_provider->DeCommit(base, mem_committed);
+    WaitForPreCommit();
+    memory_provider->DeCommit(base, mem_ready);
     memory_provider->Release(base, mem_reserved);
+
+    if (purged_bits)
+    {
+        memory_provider->DeCommit(purged_bits, purged_bits_size);
+        memory_provider->Release(purged_bits, purged_bits_size);
+    }
+
+    if (granule_used)
+    {
+        memory_provider->DeCommit(granule_used, granule_used_size);
+        memory_provider->Release(granule_used, granule_used_size);
+    }
+}
+
+template <typename MI, size_t MA>
+bool best_fit_allocator<MI, MA>::Owns(void *addr)
+{
+    return (uint8_t *)addr >= (uint8_t *)base && (uint8_t *)addr < (uint8_t *)base + mem_reserved;
+}
+
+template <typename MI, size_t MA>
+size_t best_fit_allocator<MI, MA>::CommitMore(size_t size)
+{
+    BM_TIMED_BLOCK("best_fit::CommitMore");
+
+    size_t actualCommit = size;
+
+    if (mem_committed + size > mem_ready && LOAD_ACQUIRE(&precommit_state) != precommit_idle)
+    {
+        // Growing into the range being pre-committed. Let it finish, then it's ready.
+        WaitForPreCommit();
+        if (precommit_end > mem_ready)
+        {
+            mem_ready = precommit_end;
+        }
+    }
+
+    // Pre-committed memory only needs to be counted.
+    if (mem_committed + size > mem_ready)
+    {
+        memory_provider->Commit((uint8_t *)base + mem_committed, size, &actualCommit);
+    }
+
+    mem_committed += actualCommit;
+    if (mem_committed > mem_ready)
+    {
+        mem_ready = mem_committed;
+    }
+
+    if (mem_committed > peak_committed)
+    {
+        peak_committed = mem_committed;
+    }
+
+    return actualCommit;
+}
+
+template <typename MI, size_t MA>
+bool best_fit_allocator<MI, MA>::BeginPreCommit(size_t headroom, best_fit_precommit *work)
+{
+    size_t target = SnapUpToPow2Increment(mem_committed + headroom, commit_granularity);
+    if (target > mem_reserved)
+    {
+        target = mem_reserved;
+    }
+
+    if (target <= mem_ready || LOAD_ACQUIRE(&precommit_state) != precommit_idle)
+    {
+        return false;
+    }
+
+    work->addr = (uint8_t *)base + mem_ready;
+    work->size = target - mem_ready;
+    work->generation = precommit_generation;
+    precommit_state = precommit_committing;
+    precommit_end = target;
+    return true;
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::PreCommit(best_fit_precommit *work)
+{
+    size_t actualCommit;
+    memory_provider->Commit(work->addr, work->size, &actualCommit);
+
+    // The allocator may hand out part of the range while this runs, so fault each page in
+    // with an atomic write that leaves its contents alone.
+    size_t pageSize = memory_provider->GetPageSize();
+    for (size_t offset = 0; offset < work->size; offset += pageSize)
+    {
+        ICE((volatile uint32_t *)((uint8_t *)work->addr + offset), 0, 0);
+    }
+
+    STORE_RELEASE(&precommit_state, (uint32_t)precommit_committed);
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::EndPreCommit(best_fit_precommit *work)
+{
+    precommit_state = precommit_idle;
+
+    // Reset may have decommitted the range in the meantime.
+    if (work->generation != precommit_generation)
+    {
+        return;
+    }
+
+    size_t end = (size_t)((uint8_t *)work->addr - (uint8_t *)base) + work->size;
+    if (end > mem_ready)
+    {
+        mem_ready = end;
+    }
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::WaitForPreCommit()
+{
+    // Called with the lock held. PreCommit doesn't take it, so it always gets to finish.
+    while (LOAD_ACQUIRE(&precommit_state) == precommit_committing);
+}
+
+template <typename MI, size_t MA>
+inline bool best_fit_allocator<MI, MA>::IsPurged(size_t granule)
+{
+    return (purged_bits[granule / 64] >> (granule & 63)) & 1;
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::TrackGranules(block_header *header, bool allocated)
+{
+    if (!granule_used)
+    {
+        return;
+    }
+
+    size_t start = (size_t)((uint8_t *)header - (uint8_t *)base) + chunk_size;
+    size_t end = start + header->GetSize(this);
+    while (start < end)
+    {
+        size_t index = start / commit_granularity;
+        size_t granuleEnd = (index + 1) * commit_granularity;
+        size_t chunkEnd = end < granuleEnd ? end : granuleEnd;
+        if (allocated)
+        {
+            granule_used[index] += chunkEnd - start;
+        }
+        else
+        {
+            granule_used[index] -= chunkEnd - start;
+        }
+
+        start = chunkEnd;
+    }
+}
+
+template <typename MI, size_t MA>
+inline bool best_fit_allocator<MI, MA>::InUsedGranule(free_block *block)
+{
+    // Allocations are placed at the start of a free block.
+    size_t offset = (size_t)((uint8_t *)block - (uint8_t *)base) + chunk_size;
+    return granule_used[offset / commit_granularity] != 0;
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::EnsureCommitted(void *addr, size_t size)
+{
+    if (purged_count == 0)
+    {
+        return;
+    }
+
+    BM_TIMED_BLOCK("best_fit::EnsureCommitted");
+
+    size_t offset = (size_t)((uint8_t *)addr - (uint8_t *)base);
+    size_t granule = offset / commit_granularity;
+    size_t endGranule = (offset + size + commit_granularity - 1) / commit_granularity;
+
+    // Commit each run of purged granules with a single call.
+    while (granule < endGranule)
+    {
+        if (!IsPurged(granule))
+        {
+            ++granule;
+            continue;
+        }
+
+        size_t runStart = granule;
+        while (granule < endGranule && IsPurged(granule))
+        {
+            purged_bits[granule / 64] &= ~(1llu << (granule & 63));
+            --purged_count;
+            ++granule;
+        }
+
+        size_t actualCommit;
+        memory_provider->Commit((uint8_t *)base + (runStart * commit_granularity), (granule - runStart) * commit_granularity, &actualCommit);
+    }
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::PurgeInternal(free_block *node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    // Past its free_block struct, a block needs a whole granule to have anything to purge.
+    // Everything to the left is no larger.
+    size_t blockSize = node->header.GetSize(this) + chunk_size;
+    if (blockSize >= free_block_overhead + commit_granularity)
+    {
+        PurgeInternal(node->left);
+
+        size_t start = SnapUpToPow2Increment((size_t)((uint8_t *)node - (uint8_t *)base) + free_block_overhead, commit_granularity);
+        size_t end = ((size_t)((uint8_t *)node - (uint8_t *)base) + blockSize) & ~(commit_granularity - 1);
+
+        size_t granule = start / commit_granularity;
+        size_t endGranule = end / commit_granularity;
+        while (granule < endGranule)
+        {
+            if (IsPurged(granule))
+            {
+                ++granule;
+                continue;
+            }
+
+            size_t runStart = granule;
+            while (granule < endGranule && !IsPurged(granule))
+            {
+                purged_bits[granule / 64] |= 1llu << (granule & 63);
+                ++purged_count;
+                ++granule;
+            }
+
+            memory_provider->DeCommit((uint8_t *)base + (runStart * commit_granularity), (granule - runStart) * commit_granularity);
+        }
+    }
+
+    PurgeInternal(node->right);
+}
+
+template <typename MI, size_t MA>
+size_t best_fit_allocator<MI, MA>::Purge()
+{
+    BM_TIMED_BLOCK("best_fit::Purge");
+
+    if (!purged_bits)
+    {
+        size_t words = ((mem_reserved / commit_granularity) + 63) / 64;
+        purged_bits = (uint64_t *)memory_provider->Reserve(words * sizeof(uint64_t), &purged_bits_size);
+        BM_ASSERT(purged_bits, "Failed to reserve the purged granule bitmap");
+
+        size_t actualCommit;
+        memory_provider->Commit(purged_bits, purged_bits_size, &actualCommit);
+
+        for (size_t i = 0; i < words; ++i)
+        {
+            purged_bits[i] = 0;
+        }
+    }
+
+    WaitForPreCommit();
+
+    size_t purgedBefore = purged_count;
+    PurgeInternal(root);
+
+    return (purged_count - purgedBefore) * commit_granularity;
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::GetHugePageStats(best_fit_hugepage_stats *stats)
+{
+    stats->hugepage_size = commit_granularity;
+    stats->committed = 0;
+    stats->full = 0;
+    stats->partial = 0;
+    stats->empty = 0;
+    stats->purged = 0;
+    stats->allocated_bytes = 0;
+
+    size_t granuleCount = mem_committed / commit_granularity;
+    size_t granule = 0;
+    size_t granuleFree = 0;
+
+    // Blocks are in address order, so the free bytes of each granule can be summed in one pass.
+    auto classify = [&](size_t index, size_t freeBytes)
+    {
+        if (purged_count && IsPurged(index))
+        {
+            ++stats->purged;
+            return;
+        }
+
+        ++stats->committed;
+        if (freeBytes == commit_granularity) ++stats->empty;
+        else if (freeBytes == 0) ++stats->full;
+        else ++stats->partial;
+    };
+
+    for (block_header *header = first;
+         header != nullptr;
+         header = header->next)
+    {
+        if (!header->GetFree())
+        {
+            stats->allocated_bytes += header->GetSize(this);
+            continue;
+        }
+
+        // The free_block struct stays committed, so it doesn't count as free here.
+        size_t start = (size_t)((uint8_t *)header - (uint8_t *)base) + free_block_overhead;
+        size_t end = (size_t)((uint8_t *)header - (uint8_t *)base) + chunk_size + header->GetSize(this);
+        while (start < end)
+        {
+            size_t index = start / commit_granularity;
+            for (; granule < index; ++granule)
+            {
+                classify(granule, granuleFree);
+                granuleFree = 0;
+            }
+
+            size_t granuleEnd = (index + 1) * commit_granularity;
+            size_t chunkEnd = end < granuleEnd ? end : granuleEnd;
+            granuleFree += chunkEnd - start;
+            start = chunkEnd;
+        }
+    }
+
+    for (; granule < granuleCount; ++granule)
+    {
+        classify(granule, granuleFree);
+        granuleFree = 0;
+    }
+}
+
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::GetStats(best_fit_stats *stats)
+{
+    stats->reserved = mem_reserved;
+    stats->committed = mem_committed;
+    stats->peak_committed = peak_committed;
+    stats->purged = purged_count * commit_granularity;
+    stats->allocated_bytes = allocated_bytes;
+    stats->peak_allocated_bytes = peak_allocated_bytes;
+    stats->header_bytes = block_count * chunk_size;
+    stats->free_bytes = mem_committed - stats->header_bytes - allocated_bytes;
+    stats->allocated_blocks = allocated_blocks;
+    stats->free_blocks = block_count - allocated_blocks;
+
+    // Equal sizes are ordered by address, so the rightmost node is still the largest.
+    free_block *largest = root;
+    while (largest && largest->right)
+    {
+        largest = largest->right;
+    }
+
+    stats->largest_free_block = largest ? largest->header.GetSize(this) : 0;
+    stats->external_fragmentation = stats->free_bytes ? 1.0 - ((double)stats->largest_free_block / (double)stats->free_bytes) : 0.0;
+}
+
+template <typename MI, size_t MA>
+bool best_fit_allocator<MI, MA>::DumpLayout(FILE *out, heap_layout_format format, heap_layout_callsite_fn callsite, void *user)
+{
+    heap_layout_writer writer(out, format);
+    writer.Begin({ (uint64_t)(uintptr_t)base, mem_reserved, mem_committed, chunk_size, commit_granularity, block_count });
+
+    for (block_header *header = first;
+         header != nullptr;
+         header = header->next)
+    {
+        heap_layout_block block = { (uint64_t)(uintptr_t)header, header->GetSize(this), header->GetFree(), nullptr, 0 };
+        if (callsite && !block.free && !callsite(GetAllocationPtr(header), &block.file, &block.line, user))
+        {
+            block.file = nullptr;
+        }
+
+        writer.Write(block);
+    }
+
+    return writer.End();
 }
 
 template <typename MI, size_t MA>
@@ -518,14 +1165,90 @@ void best_fit_allocator<MI, MA>::GetCommitParams(size_t requestedSize, void **pa
     *paramSize = unCommitted;
 }
  
+template <typename MI, size_t MA>
+void best_fit_allocator<MI, MA>::ClearDirty(uint8_t *addr, size_t size)
+{
+    uint8_t *end = addr + size;
+
+    uint8_t *dirtyEnd = (uint8_t *)base + zero_watermark;
+    if (dirtyEnd > end)
+    {
+        dirtyEnd = end;
+    }
+
+    if (addr >= dirtyEnd)
+    {
+        return;
+    }
+
+    if (purged_count == 0)
+    {
+        ClearMemory(addr, (size_t)(dirtyEnd - addr));
+        return;
+    }
+
+    // Purged granules read as zero once EnsureCommitted commits them again, skip them.
+    uint8_t *runStart = addr;
+    while (addr < dirtyEnd)
+    {
+        size_t granule = (size_t)(addr - (uint8_t *)base) / commit_granularity;
+        uint8_t *granuleEnd = (uint8_t *)base + ((granule + 1) * commit_granularity);
+        uint8_t *chunkEnd = granuleEnd < dirtyEnd ? granuleEnd : dirtyEnd;
+
+        if (IsPurged(granule))
+        {
+            if (runStart < addr)
+            {
+                ClearMemory(runStart, (size_t)(addr - runStart));
+            }
+
+            runStart = chunkEnd;
+        }
+
+        addr = chunkEnd;
+    }
+
+    if (runStart < dirtyEnd)
+    {
+        ClearMemory(runStart, (size_t)(dirtyEnd - runStart));
+    }
+}
+
+template <typename MI, size_t MA>
+inline void best_fit_allocator<MI, MA>::RaiseZeroWatermark(uint8_t *end)
+{
+    size_t offset = (size_t)(end - (uint8_t *)base);
+    if (offset > zero_watermark)
+    {
+        zero_watermark = offset;
+    }
+}
+
 template <typename MI, size_t MA>
 void *best_fit_allocator<MI, MA>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
 {
     (void)line;
     (void)file;
+    return Allocate(size, alignment, false);
+}
+
+template <typename MI, size_t MA>
+void *best_fit_allocator<MI, MA>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    return Allocate(size, alignment, true);
+}
+
+template <typename MI, size_t MA>
+void *best_fit_allocator<MI, MA>::Allocate(size_t size, uint32_t alignment, bool zeroed)
+{
+    BM_TIMED_BLOCK("best_fit::Alloc");
     BM_ASSERT(alignment <= MA, "Tried to allocate with an alignment greater than the maximum supported alignment");
     BM_ASSERT(size > 0, "Tried to allocate 0 bytes.");
 
+    size_t requestedSize = size;
+
     // Make sure the requested size is in chunk_size incremements
     // Also make sure the requested size it atleast as large as free_block_overhead
     // If we allocate less than that, then we risk overwriting members from the next block.
@@ -544,16 +1267,13 @@ void *best_fit_allocator<MI, MA>::AllocInternal(size_t size, uint32_t alignment,
         if (last->GetFree())
         {
             free_block *lastFree = (free_block *)last;
-            size_t requiredSize = size - last->GetSize(this);
+            size_t requiredSize = SnapUpToPow2Increment(size - last->GetSize(this), commit_granularity);
 
             // Can't commit more than we have reserved.
             BM_ASSERT((requiredSize + mem_committed) <= mem_reserved, "Tried to commit more memory than reserved");
 
             // Add the new committed pages to the last block.
-            size_t actualCommit;
-            memory_provider->Commit(unCommitted, requiredSize, &actualCommit);
-
-            mem_committed += actualCommit;
+            CommitMore(requiredSize);
             RemoveNode(lastFree);
             AddNode(lastFree);
 
@@ -564,14 +1284,12 @@ void *best_fit_allocator<MI, MA>::AllocInternal(size_t size, uint32_t alignment,
         }
         else
         {
-            size_t requiredSize = size + chunk_size; // One chunk for the block_header struct.
+            size_t requiredSize = SnapUpToPow2Increment(size + chunk_size, commit_granularity); // One chunk for the block_header struct.
 
             // Can't commit more than we have reserved.
             BM_ASSERT((requiredSize + mem_committed) <= mem_reserved, "Tried to commit more memory than reserved");
 
-            size_t actualCommit;
-            memory_provider->Commit(unCommitted, requiredSize, &actualCommit);
-            mem_committed += actualCommit;
+            CommitMore(requiredSize);
 
             free_block *newBlock = (free_block *)unCommitted;
             newBlock->header.SetFree(true);
@@ -579,6 +1297,7 @@ void *best_fit_allocator<MI, MA>::AllocInternal(size_t size, uint32_t alignment,
             newBlock->header.next = nullptr;
             last->next = &newBlock->header;
             last = &newBlock->header;
+            ++block_count;
 
             AddNode(newBlock);
 
@@ -588,6 +1307,25 @@ void *best_fit_allocator<MI, MA>::AllocInternal(size_t size, uint32_t alignment,
 
     void *allocation = GetAllocationPtr(&bestFit->header);
 
+    // Recommit any purged granules under the allocation and the header of the leftover block.
+    uint8_t *touchedEnd = (uint8_t *)allocation + size + free_block_overhead;
+    uint8_t *blockEnd = (uint8_t *)allocation + bestFit->header.GetSize(this);
+    if (touchedEnd > blockEnd)
+    {
+        touchedEnd = blockEnd;
+    }
+
+    // The free_block struct at the start is still in use, so it is cleared once the block is
+    // out of the tree. The rest must be cleared before EnsureCommitted drops the purged bits.
+    size_t structBytes = free_block_overhead - chunk_size;
+    if (zeroed && requestedSize > structBytes)
+    {
+        ClearDirty((uint8_t *)allocation + structBytes, requestedSize - structBytes);
+    }
+
+    EnsureCommitted(bestFit, touchedEnd - (uint8_t *)bestFit);
+    RaiseZeroWatermark(touchedEnd);
+
     // Mark this block as used.
     bestFit->header.SetFree(false);
 
@@ -618,6 +1356,7 @@ void *best_fit_allocator<MI, MA>::AllocInternal(size_t size, uint32_t alignment,
             RemoveNode(bestFit);
             newBlock->header.next = bestFit->header.next;
             AddNode(newBlock);
+            ++block_count;
 
             if (bestFit->header.next) bestFit->header.next->SetPrev((block_header *)newBlock);
         }
@@ -636,12 +1375,26 @@ void *best_fit_allocator<MI, MA>::AllocInternal(size_t size, uint32_t alignment,
         RemoveNode(bestFit);
     }
 
+    allocated_bytes += bestFit->header.GetSize(this);
+    ++allocated_blocks;
+    TrackGranules(&bestFit->header, true);
+    if (allocated_bytes > peak_allocated_bytes)
+    {
+        peak_allocated_bytes = allocated_bytes;
+    }
+
+    if (zeroed)
+    {
+        ClearMemory(allocation, requestedSize < structBytes ? requestedSize : structBytes);
+    }
+
     return allocation;
 }
 
 template <typename MI, size_t MA>
 void *best_fit_allocator<MI, MA>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
 {
+    BM_TIMED_BLOCK("best_fit::ReAlloc");
     (void)line;
     (void)file;
     block_header *header = (block_header *)((uint8_t *)addr - chunk_size);
@@ -667,16 +1420,11 @@ void *best_fit_allocator<MI, MA>::ReAllocInternal(void *addr, size_t size, int l
         if (total < size && current == last)
         {
             // Try to commit more memory.
-            uint8_t *unCommitted = (uint8_t *)base + mem_committed;
-            size_t requiredBytes = size - total;
+            size_t requiredBytes = SnapUpToPow2Increment(size - total, commit_granularity);
 
             if (requiredBytes + mem_committed <= mem_reserved)
             {
-                size_t actualCommit;
-                memory_provider->Commit(unCommitted, requiredBytes, &actualCommit);
-
-                mem_committed += actualCommit;
-                total += actualCommit;
+                total += CommitMore(requiredBytes);
                 RemoveNode((free_block *)current);
                 AddNode((free_block *)current);
             }
@@ -691,12 +1439,26 @@ void *best_fit_allocator<MI, MA>::ReAllocInternal(void *addr, size_t size, int l
                  toRemove = toRemove->next)
             {
                 RemoveNode((free_block *)toRemove);
+                --block_count;
             }
 
+            allocated_bytes -= header->GetSize(this);
+            TrackGranules(header, false);
+
             // calculate the required amount of bytes that we need from this block.
             size_t required = size - (total - (current->GetSize(this) + chunk_size));
             size_t leftover = (current->GetSize(this) + chunk_size) - required;
 
+            uint8_t *touchedEnd = (uint8_t *)current + required + free_block_overhead;
+            uint8_t *blockEnd = (uint8_t *)current + current->GetSize(this) + chunk_size;
+            if (touchedEnd > blockEnd)
+            {
+                touchedEnd = blockEnd;
+            }
+
+            EnsureCommitted(header, touchedEnd - (uint8_t *)header);
+            RaiseZeroWatermark(touchedEnd);
+
             if (leftover >= smallest_valid_free_block)
             {
                 // There is enough leftover memory that we should add a new free node for it,
@@ -716,6 +1478,7 @@ void *best_fit_allocator<MI, MA>::ReAllocInternal(void *addr, size_t size, int l
                 }
 
                 AddNode((free_block *)newBlock);
+                ++block_count;
             }
             else
             {
@@ -729,6 +1492,13 @@ void *best_fit_allocator<MI, MA>::ReAllocInternal(void *addr, size_t size, int l
                 }
             }
 
+            allocated_bytes += header->GetSize(this);
+            TrackGranules(header, true);
+            if (allocated_bytes > peak_allocated_bytes)
+            {
+                peak_allocated_bytes = allocated_bytes;
+            }
+
             break;
         }
 
@@ -742,12 +1512,17 @@ void *best_fit_allocator<MI, MA>::ReAllocInternal(void *addr, size_t size, int l
 template <typename MI, size_t MA>
 void best_fit_allocator<MI, MA>::FreeInternal(void *addr, int line, const char *file)
 {
+    BM_TIMED_BLOCK("best_fit::Free");
     (void)line;
     (void)file;
     block_header *header = (block_header *)((uint8_t *)addr - chunk_size);
     BM_ASSERT(!header->GetFree(), "Trying to free an already free block.");
     header->SetFree(true);
 
+    allocated_bytes -= header->GetSize(this);
+    --allocated_blocks;
+    TrackGranules(header, false);
+
     if (header->GetPrev() && header->GetPrev()->GetFree())
     {
         if (header->next && header->next->GetFree())
@@ -764,6 +1539,7 @@ void best_fit_allocator<MI, MA>::FreeInternal(void *addr, int line, const char *
 
             RemoveNode(nextBlock);
             AddNode(prevBlock);
+            block_count -= 2;
 
             if (nextHeader->next) nextHeader->next->SetPrev(prevHeader);
 
@@ -784,6 +1560,7 @@ void best_fit_allocator<MI, MA>::FreeInternal(void *addr, int line, const char *
             RemoveNode(prevBlock);
             prevHeader->next = header->next;
             AddNode(prevBlock);
+            --block_count;
 
             if (header->next) header->next->SetPrev(prevHeader);
 
@@ -805,6 +1582,7 @@ void best_fit_allocator<MI, MA>::FreeInternal(void *addr, int line, const char *
         header->next = nextHeader->next;
         if (nextHeader->next) nextHeader->next->SetPrev(header);
         AddNode(block);
+        --block_count;
 
         if (header->next == nullptr)
         {
@@ -822,15 +1600,12 @@ void best_fit_allocator<MI, MA>::FreeInternal(void *addr, int line, const char *
 template <typename MI, size_t MA>
 typename best_fit_allocator<MI, MA>::free_block *best_fit_allocator<MI, MA>::FindBestFit(size_t size)
 {
+    BM_TIMED_BLOCK("best_fit::FindBestFit");
+
     free_block *current = root;
     free_block *lastValid = nullptr;
-    for (;;)
+    while (current)
     {
-        if (current == nullptr)
-        {
-            return lastValid;
-        }
-
         if (current->header.GetSize(this) < size)
         {
             current = current->right;
@@ -841,6 +1616,50 @@ typename best_fit_allocator<MI, MA>::free_block *best_fit_allocator<MI, MA>::Fin
             current = current->left;
         }
     }
+
+    if (!granule_used)
+    {
+        return lastValid;
+    }
+
+    // Fill granules that already hold allocations before starting on an empty one. The next
+    // few blocks by size are close enough to the best fit to take instead.
+    free_block *candidate = lastValid;
+    for (uint32_t i = 0; candidate && i < placement_candidates; ++i)
+    {
+        if (InUsedGranule(candidate))
+        {
+            return candidate;
+        }
+
+        candidate = NextBySize(candidate);
+    }
+
+    return lastValid;
+}
+
+template <typename MI, size_t MA>
+typename best_fit_allocator<MI, MA>::free_block *best_fit_allocator<MI, MA>::NextBySize(free_block *node)
+{
+    if (node->right)
+    {
+        node = node->right;
+        while (node->left)
+        {
+            node = node->left;
+        }
+
+        return node;
+    }
+
+    free_block *parent = node->GetParent();
+    while (parent && node == parent->right)
+    {
+        node = parent;
+        parent = parent->GetParent();
+    }
+
+    return parent;
 }
 
 template <typename MI, size_t MA>
@@ -893,6 +1712,8 @@ void best_fit_allocator<MI, MA>::RightRotate(free_block *node)
 template <typename MI, size_t MA>
 void best_fit_allocator<MI, MA>::AddNode(free_block *block)
 {
+    BM_TIMED_BLOCK("best_fit::AddNode");
+
     // Add the node
     block->left = nullptr;
     block->right = nullptr;
@@ -905,10 +1726,15 @@ void best_fit_allocator<MI, MA>::AddNode(free_block *block)
         return;
     }
 
+    // Blocks of equal size are ordered by address, so FindBestFit returns the lowest one
+    // and allocations pack into the bottom of the heap. Which granules are in use is
+    // FindBestFit's call, the tree is only ordered by size and address.
+    size_t blockSize = block->header.GetSize(this);
     free_block *current = root;
     for (;;)
     {
-        if (block->header.GetSize(this) >= current->header.GetSize(this))
+        size_t currentSize = current->header.GetSize(this);
+        if (blockSize > currentSize || (blockSize == currentSize && block > current))
         {
             if (current->right == nullptr)
             {
@@ -1012,6 +1838,8 @@ void best_fit_allocator<MI, MA>::AddNode(free_block *block)
 template <typename MI, size_t MA>
 void best_fit_allocator<MI, MA>::RemoveNode(free_block *block)
 {
+    BM_TIMED_BLOCK("best_fit::RemoveNode");
+
     // Will need these later for rebalancing
     free_block *doubleBlack = nullptr;
     free_block *dbParent = nullptr;
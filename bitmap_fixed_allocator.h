@@ -0,0 +1,392 @@
+#pragma once
+#include "allocator_interface.h"
+#include "clear_memory.h"
+#include "platform.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#pragma warning(push, 0)
+#include <immintrin.h>
+#pragma warning(pop)
+#endif
+
+// Fixed size allocator that tracks free chunks in a per-bucket bitmap instead of
+// an intrusive free list. Freeing never writes to the chunk itself, and chunks are
+// always handed out lowest address first.
+struct bitmap_bucket_header
+{
+    bitmap_bucket_header *m_next;
+    uint8_t *m_firstChunk;
+    uint32_t m_chunkCount;
+    uint32_t m_freeCount;
+
+    // Lowest bitmap word that may still have a set bit.
+    uint32_t m_firstFreeWord;
+    uint32_t m_wordCount;
+
+    // A set bit means the chunk is free.
+    uint64_t *FreeBits()
+    {
+        return (uint64_t *)(this + 1);
+    }
+};
+
+template <typename allocator_interface>
+struct bitmap_fixed_allocator
+{
+    bitmap_fixed_allocator(allocator_interface *memoryProvider, uint32_t chunkCount, size_t chunkSize, uint32_t chunkAlignment);
+    bitmap_fixed_allocator(const bitmap_fixed_allocator &) = delete;
+    bitmap_fixed_allocator() = delete;
+
+    // Sorted by address.
+    bitmap_bucket_header *m_base;
+
+    // Lowest addressed bucket with atleast one free chunk.
+    bitmap_bucket_header *m_current;
+    allocator_interface *m_memoryProvider;
+
+    // Every bucket sorted by address, so Free and Owns find a chunk's bucket with a binary
+    // search. Allocated from the memory provider, grows by doubling.
+    bitmap_bucket_header **m_buckets;
+    uint32_t m_bucketCount;
+    uint32_t m_bucketCapacity;
+
+    size_t m_chunkSize;
+    uint32_t m_chunkCount;
+    uint32_t m_chunkAlignment;
+
+    ~bitmap_fixed_allocator();
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+
+    // Returns buckets that have no live chunks back to the memory provider.
+    void ReleaseEmptyBuckets();
+
+    bool Owns(void *addr);
+
+private:
+    bitmap_bucket_header *NewBucket();
+    bitmap_bucket_header *FindBucket(void *addr);
+    uint32_t FindFreeWord(bitmap_bucket_header *bucket);
+    void InsertBucket(bitmap_bucket_header *bucket);
+    size_t BucketBytes();
+    size_t BitmapOffset();
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+template <typename allocator_interface>
+bitmap_fixed_allocator<allocator_interface>::bitmap_fixed_allocator(
+    allocator_interface *memoryProvider,
+    uint32_t chunkCount,
+    size_t chunkSize,
+    uint32_t chunkAlignment)
+    : m_base(nullptr),
+      m_current(nullptr),
+      m_memoryProvider(memoryProvider),
+      m_buckets(nullptr),
+      m_bucketCount(0),
+      m_bucketCapacity(0),
+      m_chunkCount(chunkCount),
+      m_chunkAlignment(chunkAlignment > alignof(bitmap_bucket_header) ? chunkAlignment : alignof(bitmap_bucket_header))
+{
+    BM_ASSERT(chunkCount > 0, "Buckets must hold atleast one chunk");
+    BM_ASSERT((m_chunkAlignment & (m_chunkAlignment - 1)) == 0, "Chunk alignment must be a power of 2");
+
+    // Every chunk has to be aligned, not just the first.
+    size_t size = chunkSize ? chunkSize : 1;
+    m_chunkSize = (size + m_chunkAlignment - 1) & ~((size_t)m_chunkAlignment - 1);
+
+    InsertBucket(NewBucket());
+    m_current = m_base;
+}
+
+template <typename allocator_interface>
+bitmap_fixed_allocator<allocator_interface>::~bitmap_fixed_allocator()
+{
+    bitmap_bucket_header *bucket = m_base;
+    while (bucket)
+    {
+        bitmap_bucket_header *next = bucket->m_next;
+        m_memoryProvider->FreeInternal(bucket, __LINE__, __FILE__);
+        bucket = next;
+    }
+
+    if (m_buckets)
+    {
+        m_memoryProvider->FreeInternal(m_buckets, __LINE__, __FILE__);
+    }
+}
+
+template <typename allocator_interface>
+size_t bitmap_fixed_allocator<allocator_interface>::BitmapOffset()
+{
+    size_t wordCount = (m_chunkCount + 63) / 64;
+    size_t end = sizeof(bitmap_bucket_header) + (wordCount * sizeof(uint64_t));
+    return (end + m_chunkAlignment - 1) & ~((size_t)m_chunkAlignment - 1);
+}
+
+template <typename allocator_interface>
+size_t bitmap_fixed_allocator<allocator_interface>::BucketBytes()
+{
+    return BitmapOffset() + (m_chunkCount * m_chunkSize);
+}
+
+template <typename allocator_interface>
+bitmap_bucket_header *bitmap_fixed_allocator<allocator_interface>::NewBucket()
+{
+    bitmap_bucket_header *bucket = (bitmap_bucket_header *)m_memoryProvider->AllocInternal(BucketBytes(), m_chunkAlignment, __LINE__, __FILE__);
+    BM_ASSERT(bucket, "Failed to allocate enough memory");
+
+    bucket->m_next = nullptr;
+    bucket->m_firstChunk = (uint8_t *)bucket + BitmapOffset();
+    bucket->m_chunkCount = m_chunkCount;
+    bucket->m_freeCount = m_chunkCount;
+    bucket->m_firstFreeWord = 0;
+    bucket->m_wordCount = (m_chunkCount + 63) / 64;
+
+    uint64_t *bits = bucket->FreeBits();
+    for (uint32_t i = 0; i < bucket->m_wordCount; ++i)
+    {
+        bits[i] = ~0llu;
+    }
+
+    uint32_t tail = m_chunkCount & 63;
+    if (tail)
+    {
+        bits[bucket->m_wordCount - 1] = (1llu << tail) - 1;
+    }
+
+    return bucket;
+}
+
+template <typename allocator_interface>
+void bitmap_fixed_allocator<allocator_interface>::InsertBucket(bitmap_bucket_header *bucket)
+{
+    if (m_bucketCount == m_bucketCapacity)
+    {
+        uint32_t capacity = m_bucketCapacity ? m_bucketCapacity * 2 : 16;
+        bitmap_bucket_header **buckets = (bitmap_bucket_header **)m_memoryProvider->AllocInternal(capacity * sizeof(bitmap_bucket_header *), alignof(bitmap_bucket_header *), __LINE__, __FILE__);
+        BM_ASSERT(buckets, "Failed to allocate enough memory");
+
+        if (m_buckets)
+        {
+            memcpy(buckets, m_buckets, m_bucketCount * sizeof(bitmap_bucket_header *));
+            m_memoryProvider->FreeInternal(m_buckets, __LINE__, __FILE__);
+        }
+
+        m_buckets = buckets;
+        m_bucketCapacity = capacity;
+    }
+
+    // New buckets are rare next to allocations, so keeping the index sorted is cheap enough.
+    uint32_t index = m_bucketCount;
+    while (index > 0 && m_buckets[index - 1] > bucket)
+    {
+        m_buckets[index] = m_buckets[index - 1];
+        --index;
+    }
+
+    m_buckets[index] = bucket;
+    ++m_bucketCount;
+
+    bucket->m_next = index + 1 < m_bucketCount ? m_buckets[index + 1] : nullptr;
+    if (index == 0)
+    {
+        m_base = bucket;
+    }
+    else
+    {
+        m_buckets[index - 1]->m_next = bucket;
+    }
+}
+
+template <typename allocator_interface>
+bitmap_bucket_header *bitmap_fixed_allocator<allocator_interface>::FindBucket(void *addr)
+{
+    // The last bucket that starts at or below addr.
+    uint32_t low = 0;
+    uint32_t high = m_bucketCount;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if ((void *)m_buckets[middle] <= addr)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if (low == 0)
+    {
+        return nullptr;
+    }
+
+    bitmap_bucket_header *bucket = m_buckets[low - 1];
+    uint8_t *byte = (uint8_t *)addr;
+    if (byte >= bucket->m_firstChunk && byte < bucket->m_firstChunk + (m_chunkCount * m_chunkSize))
+    {
+        return bucket;
+    }
+
+    return nullptr;
+}
+
+template <typename allocator_interface>
+bool bitmap_fixed_allocator<allocator_interface>::Owns(void *addr)
+{
+    return FindBucket(addr) != nullptr;
+}
+
+template <typename allocator_interface>
+uint32_t bitmap_fixed_allocator<allocator_interface>::FindFreeWord(bitmap_bucket_header *bucket)
+{
+    uint64_t *bits = bucket->FreeBits();
+    uint32_t i = bucket->m_firstFreeWord;
+
+#if defined(__AVX2__)
+    // Only compiled with -mavx2 or /arch:AVX2. Skips four fully allocated words at a time.
+    for (; i + 4 <= bucket->m_wordCount; i += 4)
+    {
+        __m256i words = _mm256_loadu_si256((const __m256i *)(bits + i));
+        if (!_mm256_testz_si256(words, words))
+        {
+            break;
+        }
+    }
+#endif
+
+    for (; i < bucket->m_wordCount; ++i)
+    {
+        if (bits[i])
+        {
+            break;
+        }
+    }
+
+    BM_ASSERT(i < bucket->m_wordCount, "Bucket free count does not match its bitmap");
+    return i;
+}
+
+template <typename allocator_interface>
+void *bitmap_fixed_allocator<allocator_interface>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)size;
+    (void)line;
+    (void)file;
+    (void)alignment;
+
+    if (m_current == nullptr)
+    {
+        // Every bucket is full, add a new one.
+        bitmap_bucket_header *newBucket = NewBucket();
+        InsertBucket(newBucket);
+        m_current = newBucket;
+    }
+
+    bitmap_bucket_header *bucket = m_current;
+    uint64_t *bits = bucket->FreeBits();
+
+    uint32_t word = FindFreeWord(bucket);
+    uint32_t bit = CTZ64(bits[word]);
+    bits[word] &= bits[word] - 1;
+    bucket->m_firstFreeWord = word;
+
+    if (--bucket->m_freeCount == 0)
+    {
+        // Buckets are sorted, so the next one with a free chunk is the lowest.
+        do
+        {
+            m_current = m_current->m_next;
+        } while (m_current && m_current->m_freeCount == 0);
+    }
+
+    return (void *)(bucket->m_firstChunk + (((size_t)word * 64 + bit) * m_chunkSize));
+}
+
+template <typename allocator_interface>
+void bitmap_fixed_allocator<allocator_interface>::FreeInternal(void *addr, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    bitmap_bucket_header *bucket = FindBucket(addr);
+    BM_ASSERT(bucket, "Tried to free a chunk that was not allocated by this allocator");
+
+    size_t index = ((uint8_t *)addr - bucket->m_firstChunk) / m_chunkSize;
+    uint32_t word = (uint32_t)(index / 64);
+    uint64_t mask = 1llu << (index & 63);
+
+    uint64_t *bits = bucket->FreeBits();
+    BM_ASSERT(!(bits[word] & mask), "Trying to free an already free chunk.");
+    bits[word] |= mask;
+
+    ++bucket->m_freeCount;
+    if (word < bucket->m_firstFreeWord)
+    {
+        bucket->m_firstFreeWord = word;
+    }
+
+    if (m_current == nullptr || bucket < m_current)
+    {
+        m_current = bucket;
+    }
+}
+
+template <typename allocator_interface>
+void *bitmap_fixed_allocator<allocator_interface>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    (void)addr;
+    (void)size;
+    (void)line;
+    (void)file;
+    BM_ASSERT(false, "Unimplemented");
+    return nullptr;
+}
+
+template <typename allocator_interface>
+void *bitmap_fixed_allocator<allocator_interface>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    void *result = AllocInternal(size, alignment, line, file);
+    if (result)
+    {
+        ClearMemory(result, size);
+    }
+
+    return result;
+}
+
+template <typename allocator_interface>
+void bitmap_fixed_allocator<allocator_interface>::ReleaseEmptyBuckets()
+{
+    bitmap_bucket_header **link = &m_base;
+    uint32_t kept = 0;
+    while (*link)
+    {
+        bitmap_bucket_header *bucket = *link;
+        if (bucket->m_freeCount == bucket->m_chunkCount)
+        {
+            *link = bucket->m_next;
+            m_memoryProvider->FreeInternal(bucket, __LINE__, __FILE__);
+        }
+        else
+        {
+            m_buckets[kept++] = bucket;
+            link = &bucket->m_next;
+        }
+    }
+
+    m_bucketCount = kept;
+    m_current = m_base;
+    while (m_current && m_current->m_freeCount == 0)
+    {
+        m_current = m_current->m_next;
+    }
+}
@@ -0,0 +1,420 @@
+#pragma once
+
+#include "memory_interface.h"
+#include "allocator_interface.h"
+#include "clear_memory.h"
+#include "platform.h"
+
+// Binary buddy allocator over a single power of 2 reservation.
+// Allocations are rounded up to a power of 2 multiple of the minimum block size.
+// Blocks carry no header: the order of each allocated block is kept in a side table,
+// and each order has a bitmap of which blocks are free, so the buddy of a block
+// (offset ^ blockSize) can be checked in O(1) when coalescing.
+// Free blocks are linked into per order lists through their first bytes.
+//
+// Memory is committed the first time a block is handed out, and never decommitted.
+//
+// MI = Memory interface type.
+template <typename MI>
+struct buddy_allocator
+{
+    static constexpr uint32_t max_orders = 48;
+
+    buddy_allocator(MI *memoryProvider, size_t minimumReservation, size_t minBlockSize);
+    buddy_allocator(const buddy_allocator &) = delete;
+    buddy_allocator() = delete;
+
+    ~buddy_allocator();
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+
+    size_t GetBlockSize(void *addr);
+    bool Owns(void *addr);
+
+private:
+    struct free_node
+    {
+        free_node *next;
+        free_node *prev;
+    };
+
+    MI *memory_provider;
+
+    uint8_t *base;
+    size_t mem_reserved;
+    size_t page_size;
+
+    size_t min_block_size;
+    uint32_t min_block_shift;
+    uint32_t max_order;
+
+    uint8_t *metadata;
+    size_t metadata_size;
+
+    // Order of each allocated block, indexed by min block.
+    uint8_t *block_orders;
+
+    // A set bit means the block of that order is free and in its list.
+    uint64_t *free_bits[max_orders];
+    free_node *free_lists[max_orders];
+
+    // A set bit means the page has been committed.
+    uint64_t *committed_pages;
+
+    size_t BlockSize(uint32_t order) { return min_block_size << order; }
+    size_t BlockIndex(void *block, uint32_t order);
+    bool IsFree(uint32_t order, size_t index);
+    void SetFree(uint32_t order, size_t index, bool free);
+    void PushFree(uint32_t order, free_node *node);
+    void RemoveFree(uint32_t order, free_node *node);
+    void EnsureCommitted(void *addr, size_t size);
+    void ClearCommitted(void *addr, size_t size);
+    free_node *TakeBlock(size_t size, uint32_t alignment, uint32_t *order);
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+template <typename MI>
+buddy_allocator<MI>::buddy_allocator(MI *memoryProvider, size_t minimumReservation, size_t minBlockSize)
+    : memory_provider(memoryProvider)
+{
+    BM_ASSERT(minBlockSize >= sizeof(free_node), "The minimum block size must fit a free list node");
+    BM_ASSERT(!(minBlockSize & (minBlockSize - 1)), "The minimum block size must be a power of 2");
+
+    min_block_size = minBlockSize;
+    min_block_shift = CTZ64(minBlockSize);
+
+    // Round the arena up to a power of 2 multiple of the minimum block.
+    max_order = 0;
+    while (BlockSize(max_order) < minimumReservation)
+    {
+        ++max_order;
+    }
+
+    BM_ASSERT(max_order < max_orders, "Reservation is too large for the buddy allocator");
+
+    base = (uint8_t *)memory_provider->Reserve(BlockSize(max_order), &mem_reserved);
+    BM_ASSERT(base, "Failed to reserve memory");
+
+    page_size = memory_provider->GetPageSize();
+
+    // Lay out the side tables in their own reservation.
+    size_t minBlocks = (size_t)1 << max_order;
+    size_t pages = (BlockSize(max_order) + page_size - 1) / page_size;
+
+    size_t bitmapWords = 0;
+    for (uint32_t order = 0; order <= max_order; ++order)
+    {
+        bitmapWords += ((minBlocks >> order) + 63) / 64;
+    }
+
+    size_t pageWords = (pages + 63) / 64;
+    size_t requested = ((bitmapWords + pageWords) * sizeof(uint64_t)) + minBlocks;
+
+    metadata = (uint8_t *)memory_provider->Reserve(requested, &metadata_size);
+    BM_ASSERT(metadata, "Failed to reserve buddy allocator metadata");
+
+    size_t actualCommit;
+    memory_provider->Commit(metadata, metadata_size, &actualCommit);
+
+    uint64_t *words = (uint64_t *)metadata;
+    for (size_t i = 0; i < bitmapWords + pageWords; ++i)
+    {
+        words[i] = 0;
+    }
+
+    for (uint32_t order = 0; order <= max_order; ++order)
+    {
+        free_bits[order] = words;
+        free_lists[order] = nullptr;
+        words += ((minBlocks >> order) + 63) / 64;
+    }
+
+    committed_pages = words;
+    block_orders = (uint8_t *)(words + pageWords);
+
+    // The whole arena starts out as one free block.
+    EnsureCommitted(base, sizeof(free_node));
+    PushFree(max_order, (free_node *)base);
+}
+
+template <typename MI>
+buddy_allocator<MI>::~buddy_allocator()
+{
+    memory_provider->DeCommit(base, mem_reserved);
+    memory_provider->Release(base, mem_reserved);
+
+    memory_provider->DeCommit(metadata, metadata_size);
+    memory_provider->Release(metadata, metadata_size);
+}
+
+template <typename MI>
+inline size_t buddy_allocator<MI>::BlockIndex(void *block, uint32_t order)
+{
+    return (size_t)((uint8_t *)block - base) >> (min_block_shift + order);
+}
+
+template <typename MI>
+inline bool buddy_allocator<MI>::IsFree(uint32_t order, size_t index)
+{
+    return (free_bits[order][index / 64] >> (index & 63)) & 1;
+}
+
+template <typename MI>
+inline void buddy_allocator<MI>::SetFree(uint32_t order, size_t index, bool free)
+{
+    uint64_t mask = 1llu << (index & 63);
+    if (free)
+    {
+        free_bits[order][index / 64] |= mask;
+    }
+    else
+    {
+        free_bits[order][index / 64] &= ~mask;
+    }
+}
+
+template <typename MI>
+void buddy_allocator<MI>::PushFree(uint32_t order, free_node *node)
+{
+    node->prev = nullptr;
+    node->next = free_lists[order];
+    if (node->next) node->next->prev = node;
+    free_lists[order] = node;
+
+    SetFree(order, BlockIndex(node, order), true);
+}
+
+template <typename MI>
+void buddy_allocator<MI>::RemoveFree(uint32_t order, free_node *node)
+{
+    if (node->prev)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        free_lists[order] = node->next;
+    }
+
+    if (node->next) node->next->prev = node->prev;
+
+    SetFree(order, BlockIndex(node, order), false);
+}
+
+template <typename MI>
+void buddy_allocator<MI>::EnsureCommitted(void *addr, size_t size)
+{
+    size_t firstPage = (size_t)((uint8_t *)addr - base) / page_size;
+    size_t endPage = ((size_t)((uint8_t *)addr - base) + size + page_size - 1) / page_size;
+
+    // Commit each run of uncommitted pages with a single call.
+    size_t page = firstPage;
+    while (page < endPage)
+    {
+        if ((committed_pages[page / 64] >> (page & 63)) & 1)
+        {
+            ++page;
+            continue;
+        }
+
+        size_t runStart = page;
+        while (page < endPage && !((committed_pages[page / 64] >> (page & 63)) & 1))
+        {
+            committed_pages[page / 64] |= 1llu << (page & 63);
+            ++page;
+        }
+
+        size_t actualCommit;
+        memory_provider->Commit(base + (runStart * page_size), (page - runStart) * page_size, &actualCommit);
+    }
+}
+
+template <typename MI>
+void buddy_allocator<MI>::ClearCommitted(void *addr, size_t size)
+{
+    uint8_t *start = (uint8_t *)addr;
+    uint8_t *end = start + size;
+    size_t page = (size_t)(start - base) / page_size;
+
+    // Pages that aren't committed yet come back zeroed from the memory interface.
+    while (start < end)
+    {
+        uint8_t *pageEnd = base + ((page + 1) * page_size);
+        uint8_t *clearEnd = pageEnd < end ? pageEnd : end;
+        if ((committed_pages[page / 64] >> (page & 63)) & 1)
+        {
+            ClearMemory(start, (size_t)(clearEnd - start));
+        }
+
+        start = clearEnd;
+        ++page;
+    }
+}
+
+template <typename MI>
+typename buddy_allocator<MI>::free_node *buddy_allocator<MI>::TakeBlock(size_t size, uint32_t alignment, uint32_t *order)
+{
+    BM_ASSERT(size > 0, "Tried to allocate 0 bytes.");
+    BM_ASSERT(alignment <= page_size, "Tried to allocate with an alignment greater than the maximum supported alignment");
+
+    // Blocks are aligned to their own size, so a large alignment just needs a large enough block.
+    size_t needed = size > alignment ? size : alignment;
+
+    *order = 0;
+    while (BlockSize(*order) < needed)
+    {
+        if (++*order > max_order)
+        {
+            return nullptr;
+        }
+    }
+
+    uint32_t current = *order;
+    while (free_lists[current] == nullptr)
+    {
+        if (++current > max_order)
+        {
+            return nullptr;
+        }
+    }
+
+    free_node *block = free_lists[current];
+    RemoveFree(current, block);
+
+    // Split down to the requested order, freeing the upper half each time.
+    while (current > *order)
+    {
+        --current;
+        free_node *buddy = (free_node *)((uint8_t *)block + BlockSize(current));
+        EnsureCommitted(buddy, sizeof(free_node));
+        PushFree(current, buddy);
+    }
+
+    block_orders[BlockIndex(block, 0)] = (uint8_t)*order;
+
+    return block;
+}
+
+template <typename MI>
+void *buddy_allocator<MI>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    uint32_t order;
+    free_node *block = TakeBlock(size, alignment, &order);
+    if (block)
+    {
+        EnsureCommitted(block, BlockSize(order));
+    }
+
+    return (void *)block;
+}
+
+template <typename MI>
+void buddy_allocator<MI>::FreeInternal(void *addr, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    BM_ASSERT((uint8_t *)addr >= base && (uint8_t *)addr < base + BlockSize(max_order), "Tried to free memory not owned by this allocator");
+
+    uint8_t *block = (uint8_t *)addr;
+    uint32_t order = block_orders[BlockIndex(block, 0)];
+    BM_ASSERT(!IsFree(order, BlockIndex(block, order)), "Trying to free an already free block.");
+
+    while (order < max_order)
+    {
+        size_t buddyIndex = BlockIndex(block, order) ^ 1;
+        if (!IsFree(order, buddyIndex))
+        {
+            break;
+        }
+
+        uint8_t *buddy = base + (buddyIndex << (min_block_shift + order));
+        RemoveFree(order, (free_node *)buddy);
+
+        if (buddy < block)
+        {
+            block = buddy;
+        }
+
+        ++order;
+    }
+
+    PushFree(order, (free_node *)block);
+}
+
+template <typename MI>
+void *buddy_allocator<MI>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    uint8_t *block = (uint8_t *)addr;
+    size_t index = BlockIndex(block, 0);
+    uint32_t order = block_orders[index];
+
+    if (size <= BlockSize(order))
+    {
+        return addr;
+    }
+
+    // Grow in place by absorbing free buddies to the right. Check the whole chain
+    // before changing anything.
+    uint32_t target = order;
+    while (BlockSize(target) < size)
+    {
+        size_t blockIndex = BlockIndex(block, target);
+        if (target >= max_order || (blockIndex & 1) || !IsFree(target, blockIndex ^ 1))
+        {
+            return nullptr;
+        }
+
+        ++target;
+    }
+
+    for (uint32_t current = order; current < target; ++current)
+    {
+        size_t buddyIndex = BlockIndex(block, current) ^ 1;
+        RemoveFree(current, (free_node *)(base + (buddyIndex << (min_block_shift + current))));
+    }
+
+    block_orders[index] = (uint8_t)target;
+    EnsureCommitted(block, BlockSize(target));
+
+    return addr;
+}
+
+template <typename MI>
+void *buddy_allocator<MI>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    // Clear before committing, so only pages the arena used before are cleared.
+    uint32_t order;
+    free_node *block = TakeBlock(size, alignment, &order);
+    if (block)
+    {
+        ClearCommitted(block, size);
+        EnsureCommitted(block, BlockSize(order));
+    }
+
+    return (void *)block;
+}
+
+template <typename MI>
+bool buddy_allocator<MI>::Owns(void *addr)
+{
+    return (uint8_t *)addr >= base && (uint8_t *)addr < base + BlockSize(max_order);
+}
+
+template <typename MI>
+size_t buddy_allocator<MI>::GetBlockSize(void *addr)
+{
+    return BlockSize(block_orders[BlockIndex(addr, 0)]);
+}
@@ -0,0 +1,383 @@
+#pragma once
+
+#include "platform.h"
+#include "allocator_interface.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Per callsite allocation statistics, keyed by the line and file every ALLOC, CALLOC and
+// REALLOC already carries. Each callsite counts its allocs, frees, reallocs, bytes, live
+// bytes and a log2 histogram of its sizes, so the callsites worth moving to a pool (one
+// size class, many calls) or an arena (many short lived blocks) stand out.
+//
+// Wraps an allocator. Each block gets a 16 byte prefix (more for larger alignments) that
+// remembers its callsite and size, so frees are charged to the callsite that allocated.
+// The table is a fixed size open addressing hash table. Callsites are added with a
+// compare exchange and counted with atomic adds, so it takes no lock. Callsites past
+// MaxCallsites are counted together as one "<other>" callsite. Print reads the counters
+// while they change, so its numbers are only consistent once the program is quiet.
+// Entries are found by the __FILE__ pointer. A file can have a different pointer in each
+// translation unit (headers, no string pooling), so one callsite may take several entries.
+// Print merges them by name.
+// Large (about 340 bytes per callsite), keep it off the stack.
+//
+// A = Allocator type.
+template <typename A, uint32_t MaxCallsites = 1024>
+struct callsite_stats_allocator
+{
+    static_assert(MaxCallsites && !(MaxCallsites & (MaxCallsites - 1)), "MaxCallsites must be a power of 2");
+
+    // Bucket i counts sizes in (2^(i-1), 2^i], the last one everything larger.
+    static constexpr uint32_t size_buckets = 32;
+
+    struct callsite
+    {
+        // Hash of the file pointer and line, 0 while the slot is empty.
+        uint64_t key;
+
+        // Hash of the file name and line, the same for every copy of the name.
+        uint64_t nameKey;
+        const char *file;
+        int line;
+
+        uint64_t allocs;
+        uint64_t frees;
+        uint64_t reallocs;
+        uint64_t bytes;
+        uint64_t liveBytes;
+        uint64_t sizes[size_buckets];
+    };
+
+    callsite_stats_allocator(A *allocator);
+    callsite_stats_allocator(const callsite_stats_allocator &) = delete;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
+
+    // The top callsites by bytes allocated, one per line.
+    void Print(FILE *out, uint32_t top = 32);
+
+    // A heap_layout_callsite_fn for dumping the wrapped allocator, pass the wrapper as user.
+    // Only valid when every allocated block of the wrapped allocator came through it.
+    static bool LayoutCallsite(void *block, const char **file, int *line, void *user);
+
+    A *m_allocator;
+
+    // The last entry is <other>.
+    callsite m_callsites[MaxCallsites + 1];
+
+private:
+    struct prefix
+    {
+        uint64_t size;
+        uint32_t callsite;
+
+        // From the start of the parent's block to the returned address.
+        uint32_t offset;
+    };
+
+    static constexpr uint32_t prefix_size = 16;
+    static_assert(sizeof(prefix) == prefix_size, "The prefix has to keep 16 byte alignment");
+
+    static uint32_t SizeBucket(size_t size);
+    static uint64_t NameKey(int line, const char *file);
+    uint32_t FindCallsite(int line, const char *file);
+    void *Record(void *block, size_t size, uint32_t alignment, int line, const char *file);
+};
+
+template <typename A, uint32_t MaxCallsites>
+callsite_stats_allocator<A, MaxCallsites>::callsite_stats_allocator(A *allocator)
+    : m_allocator(allocator)
+{
+    for (uint32_t i = 0; i <= MaxCallsites; ++i)
+    {
+        callsite *entry = &m_callsites[i];
+        entry->key = 0;
+        entry->nameKey = 0;
+        entry->file = nullptr;
+        entry->line = 0;
+        entry->allocs = 0;
+        entry->frees = 0;
+        entry->reallocs = 0;
+        entry->bytes = 0;
+        entry->liveBytes = 0;
+        for (uint32_t bucket = 0; bucket < size_buckets; ++bucket)
+        {
+            entry->sizes[bucket] = 0;
+        }
+    }
+
+    m_callsites[MaxCallsites].key = 1;
+    m_callsites[MaxCallsites].file = "<other>";
+}
+
+template <typename A, uint32_t MaxCallsites>
+inline uint32_t callsite_stats_allocator<A, MaxCallsites>::SizeBucket(size_t size)
+{
+    if (size <= 1)
+    {
+        return 0;
+    }
+
+    uint32_t bucket = 64 - CLZ64((uint64_t)size - 1);
+    return bucket < size_buckets ? bucket : size_buckets - 1;
+}
+
+template <typename A, uint32_t MaxCallsites>
+inline uint64_t callsite_stats_allocator<A, MaxCallsites>::NameKey(int line, const char *file)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (const char *c = file; *c; ++c)
+    {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001B3ull;
+    }
+
+    return hash ^ ((uint64_t)(uint32_t)line * 0x9E3779B97F4A7C15ull);
+}
+
+template <typename A, uint32_t MaxCallsites>
+uint32_t callsite_stats_allocator<A, MaxCallsites>::FindCallsite(int line, const char *file)
+{
+    // __FILE__ is the same pointer at every use in a translation unit, so hash the pointer.
+    // The name is only hashed once, when a new entry is added.
+    uint64_t key = (((uint64_t)(uintptr_t)file ^ ((uint64_t)(uint32_t)line << 40)) * 0x9E3779B97F4A7C15ull) | 1;
+
+    uint32_t mask = MaxCallsites - 1;
+    uint32_t slot = (uint32_t)(key >> 32) & mask;
+    for (uint32_t probe = 0; probe < MaxCallsites; ++probe, slot = (slot + 1) & mask)
+    {
+        callsite *entry = &m_callsites[slot];
+        uint64_t current = entry->key;
+        if (current == key)
+        {
+            return slot;
+        }
+
+        if (current == 0)
+        {
+            current = ICE64(&entry->key, key, 0);
+            if (current == 0)
+            {
+                // Readers may see the key a moment before the name. Print skips those.
+                entry->nameKey = NameKey(line, file);
+                entry->line = line;
+                entry->file = file;
+                return slot;
+            }
+
+            if (current == key)
+            {
+                return slot;
+            }
+        }
+    }
+
+    return MaxCallsites;
+}
+
+template <typename A, uint32_t MaxCallsites>
+void *callsite_stats_allocator<A, MaxCallsites>::Record(void *block, size_t size, uint32_t alignment, int line, const char *file)
+{
+    if (!block)
+    {
+        return nullptr;
+    }
+
+    uint32_t offset = alignment > prefix_size ? alignment : prefix_size;
+    uint32_t index = FindCallsite(line, file);
+
+    prefix *header = (prefix *)((uint8_t *)block + offset - prefix_size);
+    header->size = size;
+    header->callsite = index;
+    header->offset = offset;
+
+    // Keep a copy at the start of the block, where LayoutCallsite looks.
+    if (offset > prefix_size)
+    {
+        *(prefix *)block = *header;
+    }
+
+    callsite *entry = &m_callsites[index];
+    ATOMIC_ADD64(&entry->allocs, 1);
+    ATOMIC_ADD64(&entry->bytes, size);
+    ATOMIC_ADD64(&entry->liveBytes, size);
+    ATOMIC_ADD64(&entry->sizes[SizeBucket(size)], 1);
+
+    return (uint8_t *)block + offset;
+}
+
+template <typename A, uint32_t MaxCallsites>
+void *callsite_stats_allocator<A, MaxCallsites>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    uint32_t offset = alignment > prefix_size ? alignment : prefix_size;
+    void *block = m_allocator->AllocInternal(size + offset, alignment, line, file);
+    return Record(block, size, alignment, line, file);
+}
+
+template <typename A, uint32_t MaxCallsites>
+void *callsite_stats_allocator<A, MaxCallsites>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    uint32_t offset = alignment > prefix_size ? alignment : prefix_size;
+    void *block = m_allocator->CAllocInternal(size + offset, alignment, line, file);
+    return Record(block, size, alignment, line, file);
+}
+
+template <typename A, uint32_t MaxCallsites>
+void callsite_stats_allocator<A, MaxCallsites>::FreeInternal(void *addr, int line, const char *file)
+{
+    prefix *header = (prefix *)((uint8_t *)addr - prefix_size);
+
+    callsite *entry = &m_callsites[header->callsite];
+    ATOMIC_ADD64(&entry->frees, 1);
+    ATOMIC_ADD64(&entry->liveBytes, (uint64_t)0 - header->size);
+
+    m_allocator->FreeInternal((uint8_t *)addr - header->offset, line, file);
+}
+
+template <typename A, uint32_t MaxCallsites>
+void *callsite_stats_allocator<A, MaxCallsites>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    prefix *header = (prefix *)((uint8_t *)addr - prefix_size);
+    void *block = (uint8_t *)addr - header->offset;
+
+    if (!m_allocator->ReAllocInternal(block, size + header->offset, line, file))
+    {
+        return nullptr;
+    }
+
+    // Charged to the callsite that allocated the block, growth counts as bytes allocated.
+    callsite *entry = &m_callsites[header->callsite];
+    ATOMIC_ADD64(&entry->reallocs, 1);
+    ATOMIC_ADD64(&entry->liveBytes, (uint64_t)size - header->size);
+    if (size > header->size)
+    {
+        ATOMIC_ADD64(&entry->bytes, size - header->size);
+    }
+
+    header->size = size;
+    return addr;
+}
+
+template <typename A, uint32_t MaxCallsites>
+bool callsite_stats_allocator<A, MaxCallsites>::Owns(void *addr)
+{
+    return m_allocator->Owns(addr);
+}
+
+template <typename A, uint32_t MaxCallsites>
+bool callsite_stats_allocator<A, MaxCallsites>::LayoutCallsite(void *block, const char **file, int *line, void *user)
+{
+    callsite_stats_allocator *self = (callsite_stats_allocator *)user;
+    uint32_t index = ((prefix *)block)->callsite;
+    if (index > MaxCallsites || !self->m_callsites[index].file)
+    {
+        return false;
+    }
+
+    *file = self->m_callsites[index].file;
+    *line = self->m_callsites[index].line;
+    return true;
+}
+
+template <typename A, uint32_t MaxCallsites>
+void callsite_stats_allocator<A, MaxCallsites>::Print(FILE *out, uint32_t top)
+{
+    // Entries with the same name are one callsite seen through different __FILE__ pointers.
+    callsite *merged = new callsite[MaxCallsites + 1];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i <= MaxCallsites; ++i)
+    {
+        const callsite &entry = m_callsites[i];
+        if (!entry.file || !entry.allocs)
+        {
+            continue;
+        }
+
+        uint32_t target = 0;
+        while (target < count &&
+               !(merged[target].nameKey == entry.nameKey && merged[target].line == entry.line && strcmp(merged[target].file, entry.file) == 0))
+        {
+            ++target;
+        }
+
+        if (target == count)
+        {
+            merged[count++] = entry;
+            continue;
+        }
+
+        callsite *sum = &merged[target];
+        sum->allocs += entry.allocs;
+        sum->frees += entry.frees;
+        sum->reallocs += entry.reallocs;
+        sum->bytes += entry.bytes;
+        sum->liveBytes += entry.liveBytes;
+        for (uint32_t bucket = 0; bucket < size_buckets; ++bucket)
+        {
+            sum->sizes[bucket] += entry.sizes[bucket];
+        }
+    }
+
+    // Indices of the busiest callsites, by bytes allocated.
+    uint32_t *order = new uint32_t[count ? count : 1];
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        order[i] = i;
+    }
+
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        uint32_t index = order[i];
+        uint32_t j = i;
+        while (j > 0 && merged[order[j - 1]].bytes < merged[index].bytes)
+        {
+            order[j] = order[j - 1];
+            --j;
+        }
+
+        order[j] = index;
+    }
+
+    fprintf(out, "%-40s %10s %10s %14s %14s %10s %12s %5s\n", "callsite", "allocs", "frees", "bytes", "live bytes", "mean", "size class", "share");
+    for (uint32_t i = 0; i < count && i < top; ++i)
+    {
+        const callsite &entry = merged[order[i]];
+
+        uint32_t topBucket = 0;
+        for (uint32_t bucket = 1; bucket < size_buckets; ++bucket)
+        {
+            if (entry.sizes[bucket] > entry.sizes[topBucket])
+            {
+                topBucket = bucket;
+            }
+        }
+
+        // Callsites that mostly allocate one size class are pool candidates.
+        char sizeClass[32];
+        if (topBucket == size_buckets - 1)
+        {
+            snprintf(sizeClass, sizeof(sizeClass), ">%llu", (unsigned long long)1 << (size_buckets - 2));
+        }
+        else
+        {
+            snprintf(sizeClass, sizeof(sizeClass), "<=%llu", (unsigned long long)1 << topBucket);
+        }
+
+        char name[512];
+        snprintf(name, sizeof(name), "%s:%d", entry.file, entry.line);
+        fprintf(out, "%-40s %10llu %10llu %14llu %14lld %10llu %12s %4.0f%%\n",
+                name,
+                (unsigned long long)entry.allocs,
+                (unsigned long long)entry.frees,
+                (unsigned long long)entry.bytes,
+                (long long)entry.liveBytes,
+                (unsigned long long)(entry.bytes / entry.allocs),
+                sizeClass,
+                100.0 * (double)entry.sizes[topBucket] / (double)entry.allocs);
+    }
+
+    delete[] order;
+    delete[] merged;
+}
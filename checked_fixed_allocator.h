@@ -1,5 +1,6 @@
 #pragma once
 #include "fixed_size_allocator.h"
+#include "clear_memory.h"
 
 struct alloc_block
 {
@@ -116,3 +117,15 @@ void *checked_fixed_allocator<allocator_interface>::ReAllocInternal(void *addr,
     BM_ASSERT(false, "Unimplemented");
     return nullptr;
 }
+
+template <typename allocator_interface>
+void *checked_fixed_allocator<allocator_interface>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    void *result = AllocInternal(size, alignment, line, file);
+    if (result)
+    {
+        ClearMemory(result, size);
+    }
+
+    return result;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Clears are this large before they bypass the cache with streaming stores. Memory being
+// cleared for a large allocation usually isn't read again soon, and streaming it keeps the
+// rest of the cache intact.
+#if !defined(BM_CLEAR_STREAMING_THRESHOLD)
+#define BM_CLEAR_STREAMING_THRESHOLD (256 * 1024)
+#endif
+
+// Zeroes size bytes at addr with the widest stores available.
+static inline void ClearMemory(void *addr, size_t size)
+{
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#if defined(__AVX2__)
+    using vector = __m256i;
+#define BM_CLEAR_STORE(dest, value) _mm256_store_si256(dest, value)
+#define BM_CLEAR_STREAM(dest, value) _mm256_stream_si256(dest, value)
+    const vector zero = _mm256_setzero_si256();
+#else
+    using vector = __m128i;
+#define BM_CLEAR_STORE(dest, value) _mm_store_si128(dest, value)
+#define BM_CLEAR_STREAM(dest, value) _mm_stream_si128(dest, value)
+    const vector zero = _mm_setzero_si128();
+#endif
+
+    if (size < 4 * sizeof(vector))
+    {
+        memset(addr, 0, size);
+        return;
+    }
+
+    // Unaligned head and tail, aligned stores in between.
+    uint8_t *current = (uint8_t *)addr;
+    uint8_t *end = current + size;
+    uint8_t *alignedStart = (uint8_t *)(((size_t)current + sizeof(vector) - 1) & ~(sizeof(vector) - 1));
+    uint8_t *alignedEnd = (uint8_t *)((size_t)end & ~(sizeof(vector) - 1));
+
+    memset(current, 0, (size_t)(alignedStart - current));
+    memset(alignedEnd, 0, (size_t)(end - alignedEnd));
+
+    vector *dest = (vector *)alignedStart;
+    vector *destEnd = (vector *)alignedEnd;
+
+    if (size >= BM_CLEAR_STREAMING_THRESHOLD)
+    {
+        for (; dest < destEnd; ++dest)
+        {
+            BM_CLEAR_STREAM(dest, zero);
+        }
+
+        _mm_sfence();
+    }
+    else
+    {
+        for (; dest < destEnd; ++dest)
+        {
+            BM_CLEAR_STORE(dest, zero);
+        }
+    }
+
+#undef BM_CLEAR_STORE
+#undef BM_CLEAR_STREAM
+#else
+    memset(addr, 0, size);
+#endif
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "memory_interface.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory interface that counts the bytes reserved and committed through it, and the peak
+// committed, so the footprint of an allocator can be measured without asking the OS.
+// Counts what the allocator asks for: committing a range twice counts it twice.
+// Not thread safe.
+//
+// MI = Memory interface the calls are forwarded to.
+template <typename MI>
+struct counting_memory_interface
+{
+    counting_memory_interface(MI *memory);
+
+    MI *m_memory;
+
+    size_t m_reserved;
+    size_t m_committed;
+    size_t m_peakCommitted;
+
+    DECLARE_MEMORY_INTERFACE_METHODS();
+};
+
+template <typename MI>
+counting_memory_interface<MI>::counting_memory_interface(MI *memory)
+    : m_memory(memory),
+      m_reserved(0),
+      m_committed(0),
+      m_peakCommitted(0)
+{
+}
+
+template <typename MI>
+void counting_memory_interface<MI>::Commit(void *addr, size_t size, size_t *actual)
+{
+    m_memory->Commit(addr, size, actual);
+
+    m_committed += *actual;
+    if (m_committed > m_peakCommitted)
+    {
+        m_peakCommitted = m_committed;
+    }
+}
+
+template <typename MI>
+void *counting_memory_interface<MI>::Reserve(size_t size, size_t *actual)
+{
+    void *result = m_memory->Reserve(size, actual);
+    if (result)
+    {
+        m_reserved += *actual;
+    }
+
+    return result;
+}
+
+template <typename MI>
+void *counting_memory_interface<MI>::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    void *result = m_memory->Reserve(size, alignment, actual);
+    if (result)
+    {
+        m_reserved += *actual;
+    }
+
+    return result;
+}
+
+template <typename MI>
+void counting_memory_interface<MI>::DeCommit(void *addr, size_t size)
+{
+    m_memory->DeCommit(addr, size);
+
+    size_t pageSize = m_memory->GetPageSize();
+    size_t decommitted = (size + pageSize - 1) & ~(pageSize - 1);
+    m_committed -= decommitted < m_committed ? decommitted : m_committed;
+}
+
+template <typename MI>
+void counting_memory_interface<MI>::Release(void *addr, size_t size)
+{
+    m_memory->Release(addr, size);
+    m_reserved -= size < m_reserved ? size : m_reserved;
+}
+
+template <typename MI>
+size_t counting_memory_interface<MI>::GetPageSize()
+{
+    return m_memory->GetPageSize();
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include "memory_interface.h"
+#include "allocator_interface.h"
+#include "clear_memory.h"
+
+// Two stacks sharing one reservation. The bottom stack grows up from the start of the
+// reservation, the top stack grows down from the end, and each has its own markers.
+// Long lived data goes on one end and scratch data on the other, so interleaving
+// their lifetimes never fragments either.
+//
+// double_stack_bottom and double_stack_top expose one end each through the allocator
+// interface, so either end can be stacked under allocator_mem_interface.
+//
+// MI = Memory interface type.
+template <typename MI>
+struct double_stack_allocator
+{
+    double_stack_allocator(MI *memoryProvider, size_t minimumReservation);
+    double_stack_allocator(const double_stack_allocator &) = delete;
+    double_stack_allocator() = delete;
+
+    ~double_stack_allocator();
+
+    void *AllocBottom(size_t size, uint32_t alignment);
+    void *AllocTop(size_t size, uint32_t alignment);
+
+    // Zeroed allocations. Only the parts either stack has reached before are cleared.
+    void *CAllocBottom(size_t size, uint32_t alignment);
+    void *CAllocTop(size_t size, uint32_t alignment);
+
+    // Only the most recent allocation on each end is given back or resized.
+    void FreeBottom(void *addr);
+    void FreeTop(void *addr);
+    void *ReAllocBottom(void *addr, size_t size);
+    void *ReAllocTop(void *addr, size_t size);
+
+    size_t GetBottomMarker();
+    size_t GetTopMarker();
+    void FreeToBottomMarker(size_t marker);
+    void FreeToTopMarker(size_t marker);
+    void Reset();
+
+    size_t GetFreeSpace();
+
+private:
+    MI *memory_provider;
+
+    uint8_t *base;
+    size_t mem_reserved;
+    size_t page_size;
+
+    // Both ends are offsets from base. The bottom stack is [0, bottom) and
+    // the top stack is [top, mem_reserved).
+    size_t bottom;
+    size_t top;
+
+    // Committed bytes from the start and from the end of the reservation.
+    size_t bottom_committed;
+    size_t top_committed;
+
+    // Most recent allocation on each end.
+    size_t bottom_last;
+    size_t top_last;
+    size_t top_last_end;
+
+    // Furthest each stack has ever reached. Nothing in [bottom_high, top_low) has been
+    // written since it was committed.
+    size_t bottom_high;
+    size_t top_low;
+
+    void CommitBottom(size_t end);
+    void ClearDirty(uint8_t *addr, size_t size, size_t bottomHigh, size_t topLow);
+};
+
+template <typename MI>
+struct double_stack_bottom
+{
+    double_stack_bottom(double_stack_allocator<MI> *stack) : m_stack(stack) {}
+
+    double_stack_allocator<MI> *m_stack;
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+};
+
+template <typename MI>
+struct double_stack_top
+{
+    double_stack_top(double_stack_allocator<MI> *stack) : m_stack(stack) {}
+
+    double_stack_allocator<MI> *m_stack;
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+template <typename MI>
+double_stack_allocator<MI>::double_stack_allocator(MI *memoryProvider, size_t minimumReservation)
+    : memory_provider(memoryProvider),
+      bottom(0),
+      bottom_committed(0),
+      top_committed(0),
+      bottom_last(0),
+      bottom_high(0)
+{
+    base = (uint8_t *)memory_provider->Reserve(minimumReservation, &mem_reserved);
+    BM_ASSERT(base, "Failed to reserve memory");
+
+    page_size = memory_provider->GetPageSize();
+    top = mem_reserved;
+    top_last = mem_reserved;
+    top_last_end = mem_reserved;
+    top_low = mem_reserved;
+}
+
+template <typename MI>
+double_stack_allocator<MI>::~double_stack_allocator()
+{
+    if (bottom_committed + top_committed >= mem_reserved)
+    {
+        // The two committed ranges meet or overlap.
+        memory_provider->DeCommit(base, mem_reserved);
+    }
+    else
+    {
+        if (bottom_committed) memory_provider->DeCommit(base, bottom_committed);
+        if (top_committed) memory_provider->DeCommit(base + mem_reserved - top_committed, top_committed);
+    }
+
+    memory_provider->Release(base, mem_reserved);
+}
+
+template <typename MI>
+void double_stack_allocator<MI>::CommitBottom(size_t end)
+{
+    if (end <= bottom_committed)
+    {
+        return;
+    }
+
+    // Pages the top stack committed may hold its allocations, so don't commit them again.
+    size_t topCommitted = mem_reserved - top_committed;
+    size_t commitEnd = end < topCommitted ? end : topCommitted;
+    if (commitEnd > bottom_committed)
+    {
+        size_t actualCommit;
+        memory_provider->Commit(base + bottom_committed, commitEnd - bottom_committed, &actualCommit);
+        bottom_committed += actualCommit;
+    }
+
+    if (end > bottom_committed)
+    {
+        bottom_committed = end;
+    }
+}
+
+template <typename MI>
+void *double_stack_allocator<MI>::AllocBottom(size_t size, uint32_t alignment)
+{
+    BM_ASSERT(size > 0, "Tried to allocate 0 bytes.");
+    BM_ASSERT(alignment && !(alignment & (alignment - 1)), "Alignment must be a power of 2");
+
+    // Align the address rather than the offset, base is only page aligned.
+    uintptr_t bottomAddr = (uintptr_t)base + bottom;
+    size_t start = (size_t)(((bottomAddr + alignment - 1) & ~((uintptr_t)alignment - 1)) - (uintptr_t)base);
+    size_t end = start + size;
+
+    if (end > top || end < start)
+    {
+        BM_ASSERT(false, "The bottom stack ran into the top stack");
+        return nullptr;
+    }
+
+    CommitBottom(end);
+
+    bottom_last = start;
+    bottom = end;
+
+    if (end > bottom_high)
+    {
+        bottom_high = end;
+    }
+
+    return base + start;
+}
+
+template <typename MI>
+void *double_stack_allocator<MI>::AllocTop(size_t size, uint32_t alignment)
+{
+    BM_ASSERT(size > 0, "Tried to allocate 0 bytes.");
+    BM_ASSERT(alignment && !(alignment & (alignment - 1)), "Alignment must be a power of 2");
+
+    if (size > top)
+    {
+        BM_ASSERT(false, "The top stack ran into the bottom stack");
+        return nullptr;
+    }
+
+    uintptr_t startAddr = ((uintptr_t)base + top - size) & ~((uintptr_t)alignment - 1);
+    if (startAddr < (uintptr_t)base + bottom)
+    {
+        BM_ASSERT(false, "The top stack ran into the bottom stack");
+        return nullptr;
+    }
+
+    size_t start = (size_t)(startAddr - (uintptr_t)base);
+    size_t committedStart = mem_reserved - top_committed;
+    if (start < committedStart)
+    {
+        // Commits have to start on a page boundary, so commit down to the page holding start,
+        // but not into pages the bottom stack committed.
+        size_t commitStart = start & ~(page_size - 1);
+        size_t low = commitStart > bottom_committed ? commitStart : bottom_committed;
+        if (low < committedStart)
+        {
+            size_t actualCommit;
+            memory_provider->Commit(base + low, committedStart - low, &actualCommit);
+        }
+
+        top_committed = mem_reserved - commitStart;
+    }
+
+    top_last = start;
+    top_last_end = top;
+    top = start;
+
+    if (start < top_low)
+    {
+        top_low = start;
+    }
+
+    return base + start;
+}
+
+template <typename MI>
+void double_stack_allocator<MI>::ClearDirty(uint8_t *addr, size_t size, size_t bottomHigh, size_t topLow)
+{
+    size_t start = (size_t)(addr - base);
+    size_t end = start + size;
+
+    // Either stack may have used this range before, so check both ends.
+    size_t low = end < bottomHigh ? end : bottomHigh;
+    if (low > start)
+    {
+        ClearMemory(addr, low - start);
+        start = low;
+    }
+
+    size_t high = start > topLow ? start : topLow;
+    if (end > high)
+    {
+        ClearMemory(base + high, end - high);
+    }
+}
+
+template <typename MI>
+void *double_stack_allocator<MI>::CAllocBottom(size_t size, uint32_t alignment)
+{
+    size_t bottomHigh = bottom_high;
+    size_t topLow = top_low;
+
+    uint8_t *result = (uint8_t *)AllocBottom(size, alignment);
+    if (result)
+    {
+        ClearDirty(result, size, bottomHigh, topLow);
+    }
+
+    return result;
+}
+
+template <typename MI>
+void *double_stack_allocator<MI>::CAllocTop(size_t size, uint32_t alignment)
+{
+    size_t bottomHigh = bottom_high;
+    size_t topLow = top_low;
+
+    uint8_t *result = (uint8_t *)AllocTop(size, alignment);
+    if (result)
+    {
+        ClearDirty(result, size, bottomHigh, topLow);
+    }
+
+    return result;
+}
+
+template <typename MI>
+void double_stack_allocator<MI>::FreeBottom(void *addr)
+{
+    if ((uint8_t *)addr == base + bottom_last)
+    {
+        bottom = bottom_last;
+    }
+}
+
+template <typename MI>
+void double_stack_allocator<MI>::FreeTop(void *addr)
+{
+    if ((uint8_t *)addr == base + top_last && top == top_last)
+    {
+        top = top_last_end;
+        top_last = top_last_end;
+    }
+}
+
+template <typename MI>
+void *double_stack_allocator<MI>::ReAllocBottom(void *addr, size_t size)
+{
+    if ((uint8_t *)addr != base + bottom_last || bottom == bottom_last)
+    {
+        return nullptr;
+    }
+
+    size_t end = bottom_last + size;
+    if (end > top)
+    {
+        return nullptr;
+    }
+
+    CommitBottom(end);
+
+    bottom = end;
+
+    if (end > bottom_high)
+    {
+        bottom_high = end;
+    }
+
+    return addr;
+}
+
+template <typename MI>
+void *double_stack_allocator<MI>::ReAllocTop(void *addr, size_t size)
+{
+    // The top stack grows down, so an allocation can only be resized within its own space.
+    if ((uint8_t *)addr != base + top_last || top != top_last || size > top_last_end - top_last)
+    {
+        return nullptr;
+    }
+
+    return addr;
+}
+
+template <typename MI>
+size_t double_stack_allocator<MI>::GetBottomMarker()
+{
+    return bottom;
+}
+
+template <typename MI>
+size_t double_stack_allocator<MI>::GetTopMarker()
+{
+    return top;
+}
+
+template <typename MI>
+void double_stack_allocator<MI>::FreeToBottomMarker(size_t marker)
+{
+    BM_ASSERT(marker <= bottom, "Marker is above the bottom stack");
+    bottom = marker;
+    bottom_last = marker;
+}
+
+template <typename MI>
+void double_stack_allocator<MI>::FreeToTopMarker(size_t marker)
+{
+    BM_ASSERT(marker >= top && marker <= mem_reserved, "Marker is below the top stack");
+    top = marker;
+    top_last = marker;
+    top_last_end = marker;
+}
+
+template <typename MI>
+void double_stack_allocator<MI>::Reset()
+{
+    FreeToBottomMarker(0);
+    FreeToTopMarker(mem_reserved);
+}
+
+template <typename MI>
+size_t double_stack_allocator<MI>::GetFreeSpace()
+{
+    return top - bottom;
+}
+
+template <typename MI>
+void *double_stack_bottom<MI>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    return m_stack->AllocBottom(size, alignment);
+}
+
+template <typename MI>
+void double_stack_bottom<MI>::FreeInternal(void *addr, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    m_stack->FreeBottom(addr);
+}
+
+template <typename MI>
+void *double_stack_bottom<MI>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    return m_stack->ReAllocBottom(addr, size);
+}
+
+template <typename MI>
+void *double_stack_top<MI>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    return m_stack->AllocTop(size, alignment);
+}
+
+template <typename MI>
+void double_stack_top<MI>::FreeInternal(void *addr, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    m_stack->FreeTop(addr);
+}
+
+template <typename MI>
+void *double_stack_top<MI>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    return m_stack->ReAllocTop(addr, size);
+}
+
+template <typename MI>
+void *double_stack_bottom<MI>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    return m_stack->CAllocBottom(size, alignment);
+}
+
+template <typename MI>
+void *double_stack_top<MI>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    return m_stack->CAllocTop(size, alignment);
+}
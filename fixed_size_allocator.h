@@ -1,5 +1,6 @@
 #pragma once
 #include "allocator_interface.h"
+#include "clear_memory.h"
 #include <stdint.h>
 
 struct free_chunk
@@ -11,12 +12,34 @@ struct bucket_header
 {
     bucket_header *m_next;
     uint32_t m_chunkCount;
+
+    // Cache color of this bucket, the first chunk starts this many bytes after the header.
+    uint32_t m_colorOffset;
+};
+
+#ifndef BM_CACHE_LINE_SIZE
+#define BM_CACHE_LINE_SIZE 64
+#endif
+
+// Number of distinct starting offsets buckets are staggered across when coloring is enabled.
+#ifndef BM_FIXED_SIZE_COLOR_COUNT
+#define BM_FIXED_SIZE_COLOR_COUNT 8
+#endif
+
+enum fixed_size_allocator_flags : uint32_t
+{
+    // Stagger the first chunk of each bucket by a cache line so buckets don't all map
+    // to the same cache sets.
+    FixedSizeColorBuckets = 1 << 0,
+
+    // Pad and align every chunk to a cache line so no two chunks share one.
+    FixedSizeCacheLinePadding = 1 << 1,
 };
 
 template <typename allocator_interface>
 struct fixed_size_allocator
 {
-	fixed_size_allocator(allocator_interface *memoryProvider, uint32_t chunkCount, size_t chunkSize, uint32_t chunkAlignment);
+	fixed_size_allocator(allocator_interface *memoryProvider, uint32_t chunkCount, size_t chunkSize, uint32_t chunkAlignment, uint32_t flags = 0);
 	fixed_size_allocator(const fixed_size_allocator &) = delete;
 	fixed_size_allocator() = delete;
 
@@ -28,10 +51,19 @@ struct fixed_size_allocator
     uint32_t m_chunkCount;
     uint32_t m_chunkAlignment;
 
+    // Bucket header size rounded up to the chunk alignment.
+    uint32_t m_headerSize;
+    uint32_t m_colorStride;
+    uint32_t m_colorCount;
+    uint32_t m_nextColor;
+
 	~fixed_size_allocator();
 
 	DECLARE_ALLOCATOR_INTERFACE_METHODS();
 
+    // Walks the bucket list.
+    bool Owns(void *addr);
+
 private:
     bucket_header *NewBucket();
     free_chunk *InitChunkRange(void *start, uint32_t chunkCount);
@@ -51,12 +83,33 @@ fixed_size_allocator<allocator_interface>::fixed_size_allocator(
 	allocator_interface *memoryProvider,
 	uint32_t chunkCount,
 	size_t chunkSize,
-	uint32_t chunkAlignment)
+	uint32_t chunkAlignment,
+	uint32_t flags)
     : m_memoryProvider(memoryProvider),
       m_chunkSize(chunkSize > sizeof(free_chunk) ? chunkSize : sizeof(free_chunk)),
       m_chunkCount(chunkCount),
-      m_chunkAlignment(chunkAlignment > alignof(bucket_header) ? chunkAlignment : alignof(bucket_header))
+      m_chunkAlignment(chunkAlignment > alignof(bucket_header) ? chunkAlignment : alignof(bucket_header)),
+      m_colorCount(1),
+      m_nextColor(0)
 {
+    if (flags & FixedSizeCacheLinePadding)
+    {
+        if (m_chunkAlignment < BM_CACHE_LINE_SIZE)
+        {
+            m_chunkAlignment = BM_CACHE_LINE_SIZE;
+        }
+
+        m_chunkSize = (m_chunkSize + m_chunkAlignment - 1) & ~((size_t)m_chunkAlignment - 1);
+    }
+
+    if (flags & FixedSizeColorBuckets)
+    {
+        m_colorCount = BM_FIXED_SIZE_COLOR_COUNT;
+    }
+
+    m_headerSize = (sizeof(bucket_header) + m_chunkAlignment - 1) & ~(m_chunkAlignment - 1);
+    m_colorStride = m_chunkAlignment > BM_CACHE_LINE_SIZE ? m_chunkAlignment : BM_CACHE_LINE_SIZE;
+
 	m_base = NewBucket();
     m_nextFree = (free_chunk *)FirstChunk(m_base);
 }
@@ -70,11 +123,15 @@ fixed_size_allocator<allocator_interface>::~fixed_size_allocator()
 template <typename allocator_interface>
 bucket_header *fixed_size_allocator<allocator_interface>::NewBucket()
 {
-    size_t requiredBytes = sizeof(bucket_header) + ((m_chunkCount) * m_chunkSize);
+    uint32_t colorOffset = m_nextColor * m_colorStride;
+    m_nextColor = (m_nextColor + 1) % m_colorCount;
+
+    size_t requiredBytes = m_headerSize + colorOffset + ((m_chunkCount) * m_chunkSize);
     bucket_header *bucket = (bucket_header *)m_memoryProvider->AllocInternal(requiredBytes, m_chunkAlignment, __LINE__, __FILE__);
     BM_ASSERT(bucket, "Failed to allocate enough memory");
     bucket->m_next = nullptr;
     bucket->m_chunkCount = m_chunkCount;
+    bucket->m_colorOffset = colorOffset;
 
     InitChunkRange(FirstChunk(bucket), m_chunkCount);
 
@@ -105,7 +162,7 @@ free_chunk *fixed_size_allocator<allocator_interface>::InitChunkRange(void *star
 template <typename allocator_interface>
 void *fixed_size_allocator<allocator_interface>::FirstChunk(bucket_header *bucket)
 {
-    return (void *)(bucket + 1);
+    return (void *)((uint8_t *)bucket + m_headerSize + bucket->m_colorOffset);
 }
 
 template <typename allocator_interface>
@@ -119,7 +176,7 @@ template <typename allocator_interface>
 free_chunk *fixed_size_allocator<allocator_interface>::TryReallocBucket(bucket_header *header)
 {
     uint32_t newChunkCount = header->m_chunkCount + m_chunkCount;
-    if (m_memoryProvider->ReAllocInternal(header, sizeof(bucket_header) + (newChunkCount * m_chunkSize), __LINE__, __FILE__) == nullptr)
+    if (m_memoryProvider->ReAllocInternal(header, m_headerSize + header->m_colorOffset + (newChunkCount * m_chunkSize), __LINE__, __FILE__) == nullptr)
     {
         return nullptr;
     }
@@ -141,6 +198,21 @@ void fixed_size_allocator<allocator_interface>::FreeBucketRecursive(bucket_heade
     m_memoryProvider->FreeInternal(header, __LINE__, __FILE__);
 }
 
+template <typename allocator_interface>
+bool fixed_size_allocator<allocator_interface>::Owns(void *addr)
+{
+    for (bucket_header *bucket = m_base; bucket != nullptr; bucket = bucket->m_next)
+    {
+        uint8_t *first = (uint8_t *)FirstChunk(bucket);
+        if ((uint8_t *)addr >= first && (uint8_t *)addr < first + (bucket->m_chunkCount * m_chunkSize))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 template <typename allocator_interface>
 void *fixed_size_allocator<allocator_interface>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
 {
@@ -198,3 +270,15 @@ void *fixed_size_allocator<allocator_interface>::ReAllocInternal(void *addr, siz
     BM_ASSERT(false, "Unimplemented");
 	return nullptr;
 }
+
+template <typename allocator_interface>
+void *fixed_size_allocator<allocator_interface>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    void *result = AllocInternal(size, alignment, line, file);
+    if (result)
+    {
+        ClearMemory(result, size);
+    }
+
+    return result;
+}
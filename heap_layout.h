@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Heap layout dumps: every block of a heap in address order, with its size, whether it is
+// free and optionally the callsite that allocated it. tools/heap_layout_report reads them.
+// The writer goes through a fixed buffer, so dumping never allocates and works on a heap
+// that is out of memory.
+//
+// Binary layout: "BMHL", a uint32_t version, then LEB128 varints: base address, reserved
+// bytes, committed bytes, header bytes in front of each block, commit granularity and block
+// count. Each block follows as a varint of size << 1 | free, then a callsite id. Id 0 is no
+// callsite. An id not seen before is followed by the line, and the length and bytes of the
+// file name. Blocks are contiguous, each one starts where the previous one ended.
+//
+// CSV layout: a "# heap layout" line with the same fields, then "address,size,free,callsite".
+
+enum heap_layout_format : uint32_t
+{
+    HeapLayoutBinary,
+    HeapLayoutCsv,
+};
+
+// Looks up the callsite of an allocated block. Returns false when it isn't known.
+typedef bool (*heap_layout_callsite_fn)(void *block, const char **file, int *line, void *user);
+
+struct heap_layout_header
+{
+    uint64_t base;
+    uint64_t reserved;
+    uint64_t committed;
+    uint64_t headerSize;
+    uint64_t granularity;
+    uint64_t blockCount;
+};
+
+struct heap_layout_block
+{
+    // Where the block's header starts.
+    uint64_t addr;
+
+    // Excludes the block's header.
+    uint64_t size;
+    bool free;
+    const char *file;
+    int line;
+};
+
+static const char heap_layout_magic[4] = { 'B', 'M', 'H', 'L' };
+static const uint32_t heap_layout_version = 1;
+
+struct heap_layout_writer
+{
+    heap_layout_writer(FILE *file, heap_layout_format format);
+    heap_layout_writer(const heap_layout_writer &) = delete;
+
+    void Begin(const heap_layout_header &header);
+    void Write(const heap_layout_block &block);
+
+    // Returns false if anything failed to write.
+    bool End();
+
+    struct written_callsite
+    {
+        const char *file;
+        int line;
+        uint32_t id;
+    };
+
+    FILE *m_file;
+    heap_layout_format m_format;
+    bool m_failed;
+    size_t m_used;
+    uint32_t m_nextCallsite;
+
+    // Callsites already written, direct mapped. A miss writes the name again under a new id.
+    written_callsite m_callsites[256];
+    uint8_t m_buffer[4096];
+
+private:
+    void Flush();
+    void Reserve(size_t bytes);
+    void PutVarint(uint64_t value);
+};
+
+inline heap_layout_writer::heap_layout_writer(FILE *file, heap_layout_format format)
+    : m_file(file),
+      m_format(format),
+      m_failed(false),
+      m_used(0),
+      m_nextCallsite(1)
+{
+    memset(m_callsites, 0, sizeof(m_callsites));
+}
+
+inline void heap_layout_writer::Flush()
+{
+    if (m_used && fwrite(m_buffer, 1, m_used, m_file) != m_used)
+    {
+        m_failed = true;
+    }
+
+    m_used = 0;
+}
+
+inline void heap_layout_writer::Reserve(size_t bytes)
+{
+    if (m_used + bytes > sizeof(m_buffer))
+    {
+        Flush();
+    }
+}
+
+inline void heap_layout_writer::PutVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        m_buffer[m_used++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    m_buffer[m_used++] = (uint8_t)value;
+}
+
+inline void heap_layout_writer::Begin(const heap_layout_header &header)
+{
+    if (m_format == HeapLayoutCsv)
+    {
+        m_used = (size_t)snprintf((char *)m_buffer, sizeof(m_buffer),
+                                  "# heap layout base 0x%llx reserved %llu committed %llu header %llu granularity %llu blocks %llu\n"
+                                  "address,size,free,callsite\n",
+                                  (unsigned long long)header.base,
+                                  (unsigned long long)header.reserved,
+                                  (unsigned long long)header.committed,
+                                  (unsigned long long)header.headerSize,
+                                  (unsigned long long)header.granularity,
+                                  (unsigned long long)header.blockCount);
+        return;
+    }
+
+    memcpy(m_buffer, heap_layout_magic, sizeof(heap_layout_magic));
+    memcpy(m_buffer + sizeof(heap_layout_magic), &heap_layout_version, sizeof(heap_layout_version));
+    m_used = sizeof(heap_layout_magic) + sizeof(heap_layout_version);
+
+    PutVarint(header.base);
+    PutVarint(header.reserved);
+    PutVarint(header.committed);
+    PutVarint(header.headerSize);
+    PutVarint(header.granularity);
+    PutVarint(header.blockCount);
+}
+
+inline void heap_layout_writer::Write(const heap_layout_block &block)
+{
+    // Longer file names are cut short.
+    static const int max_file = 1024;
+    Reserve(max_file + 128);
+
+    if (m_format == HeapLayoutCsv)
+    {
+        int written;
+        if (block.file)
+        {
+            written = snprintf((char *)m_buffer + m_used, sizeof(m_buffer) - m_used, "0x%llx,%llu,%d,%.*s:%d\n",
+                               (unsigned long long)block.addr, (unsigned long long)block.size, block.free ? 1 : 0, max_file, block.file, block.line);
+        }
+        else
+        {
+            written = snprintf((char *)m_buffer + m_used, sizeof(m_buffer) - m_used, "0x%llx,%llu,%d,\n",
+                               (unsigned long long)block.addr, (unsigned long long)block.size, block.free ? 1 : 0);
+        }
+
+        m_used += (size_t)written;
+        return;
+    }
+
+    PutVarint((block.size << 1) | (block.free ? 1 : 0));
+    if (!block.file)
+    {
+        PutVarint(0);
+        return;
+    }
+
+    uint32_t slot = (uint32_t)((((uintptr_t)block.file >> 3) ^ (uint32_t)block.line) * 0x9E3779B1u) >> 24;
+    written_callsite *entry = &m_callsites[slot];
+    if (entry->file == block.file && entry->line == block.line)
+    {
+        PutVarint(entry->id);
+        return;
+    }
+
+    entry->file = block.file;
+    entry->line = block.line;
+    entry->id = m_nextCallsite++;
+
+    size_t length = strlen(block.file);
+    if (length > (size_t)max_file)
+    {
+        length = max_file;
+    }
+
+    PutVarint(entry->id);
+    PutVarint((uint64_t)(uint32_t)block.line);
+    PutVarint(length);
+    memcpy(m_buffer + m_used, block.file, length);
+    m_used += length;
+}
+
+inline bool heap_layout_writer::End()
+{
+    Flush();
+    if (fflush(m_file) != 0)
+    {
+        m_failed = true;
+    }
+
+    return !m_failed;
+}
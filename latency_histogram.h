@@ -0,0 +1,305 @@
+#pragma once
+
+#include "platform.h"
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if !defined(_WIN32)
+#include <x86intrin.h>
+#endif
+#define BM_LATENCY_RDTSC 1
+#endif
+
+// Log-linear histogram of latencies in ticks, laid out like HdrHistogram: every power of 2
+// is split into 16 linear buckets, so a value is known to within 1/16th of itself.
+// Values from 0 to 15 are exact, values past 2^40 ticks land in the last bucket.
+struct latency_histogram
+{
+    static constexpr uint32_t sub_bucket_bits = 4;
+    static constexpr uint32_t value_bits = 40;
+    static constexpr uint32_t bucket_count = (value_bits - sub_bucket_bits + 1) << sub_bucket_bits;
+
+    uint64_t m_counts[bucket_count];
+    uint64_t m_count;
+    uint64_t m_total;
+    uint64_t m_min;
+    uint64_t m_max;
+
+    void Reset();
+    void Record(uint64_t ticks);
+    void Merge(const latency_histogram &other);
+
+    // Highest value in the bucket holding the given percentile (0 to 100), capped at the max.
+    uint64_t Percentile(double percentile) const;
+    double Mean() const;
+
+    static uint32_t BucketIndex(uint64_t ticks);
+    static uint64_t BucketHighest(uint32_t index);
+};
+
+enum latency_op : uint32_t
+{
+    LatencyAlloc,
+    LatencyFree,
+    LatencyReAlloc,
+    LatencyCommit,
+    LatencyDeCommit,
+    latency_op_count
+};
+
+static const char *const latency_op_names[latency_op_count] = { "alloc", "free", "realloc", "commit", "decommit" };
+
+// One set of histograms per thread, so recording takes no lock and shares no cache lines.
+// Threads past the first MaxThreads - 1 share the last set under a spin lock.
+// Merge may run while other threads record, it then sees a close but not exact snapshot.
+// Large (about 24KB per thread), so keep it off the stack.
+template <uint32_t MaxThreads = 16>
+struct latency_recorder
+{
+    static_assert(MaxThreads > 0, "MaxThreads must be atleast 1");
+
+    latency_recorder();
+
+    void Record(latency_op op, uint64_t ticks);
+
+    // Sums every thread's histogram for op into result.
+    void Merge(latency_op op, latency_histogram *result);
+
+    // Not thread safe.
+    void Reset();
+
+    struct alignas(64) thread_histograms
+    {
+        latency_histogram histograms[latency_op_count];
+    };
+
+    thread_histograms m_threads[MaxThreads];
+    uint32_t m_sharedLock;
+};
+
+static inline uint64_t LatencyNow()
+{
+#if defined(BM_LATENCY_RDTSC)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Measured once, against the steady clock.
+inline double LatencyTicksPerNanosecond()
+{
+#if defined(BM_LATENCY_RDTSC)
+    static const double ticksPerNanosecond = []() {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        uint64_t beginTicks = __rdtsc();
+
+        std::chrono::steady_clock::time_point end;
+        do
+        {
+            end = std::chrono::steady_clock::now();
+        } while (end - begin < std::chrono::milliseconds(10));
+
+        uint64_t ticks = __rdtsc() - beginTicks;
+        return (double)ticks / (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    }();
+
+    return ticksPerNanosecond;
+#else
+    return 1.0;
+#endif
+}
+
+// Small dense index for the calling thread, shared by every recorder.
+inline uint32_t LatencyThreadIndex()
+{
+    static uint32_t nextIndex = 0;
+    static thread_local uint32_t index = UINT32_MAX;
+
+    if (index == UINT32_MAX)
+    {
+        uint32_t current;
+        do
+        {
+            current = nextIndex;
+        } while (ICE(&nextIndex, current + 1, current) != current);
+
+        index = current;
+    }
+
+    return index;
+}
+
+inline uint32_t latency_histogram::BucketIndex(uint64_t ticks)
+{
+    const uint64_t subBucketCount = (uint64_t)1 << sub_bucket_bits;
+    if (ticks < subBucketCount)
+    {
+        return (uint32_t)ticks;
+    }
+
+    if (ticks >> value_bits)
+    {
+        return bucket_count - 1;
+    }
+
+    uint32_t magnitude = 63 - CLZ64(ticks);
+    uint32_t shift = magnitude - sub_bucket_bits;
+    return ((shift + 1) << sub_bucket_bits) + (uint32_t)((ticks >> shift) - subBucketCount);
+}
+
+inline uint64_t latency_histogram::BucketHighest(uint32_t index)
+{
+    const uint32_t subBucketCount = 1u << sub_bucket_bits;
+    if (index < subBucketCount)
+    {
+        return index;
+    }
+
+    uint32_t shift = (index >> sub_bucket_bits) - 1;
+    uint64_t lowest = (uint64_t)(subBucketCount + (index & (subBucketCount - 1))) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+inline void latency_histogram::Reset()
+{
+    for (uint32_t i = 0; i < bucket_count; ++i)
+    {
+        m_counts[i] = 0;
+    }
+
+    m_count = 0;
+    m_total = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+}
+
+inline void latency_histogram::Record(uint64_t ticks)
+{
+    ++m_counts[BucketIndex(ticks)];
+    ++m_count;
+    m_total += ticks;
+
+    if (ticks < m_min) m_min = ticks;
+    if (ticks > m_max) m_max = ticks;
+}
+
+inline void latency_histogram::Merge(const latency_histogram &other)
+{
+    for (uint32_t i = 0; i < bucket_count; ++i)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+
+    m_count += other.m_count;
+    m_total += other.m_total;
+
+    if (other.m_min < m_min) m_min = other.m_min;
+    if (other.m_max > m_max) m_max = other.m_max;
+}
+
+inline uint64_t latency_histogram::Percentile(double percentile) const
+{
+    if (!m_count)
+    {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)((percentile / 100.0) * (double)m_count + 0.5);
+    if (target < 1) target = 1;
+    if (target > m_count) target = m_count;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < bucket_count; ++i)
+    {
+        seen += m_counts[i];
+        if (seen >= target)
+        {
+            uint64_t highest = BucketHighest(i);
+            return highest < m_max ? highest : m_max;
+        }
+    }
+
+    return m_max;
+}
+
+inline double latency_histogram::Mean() const
+{
+    return m_count ? (double)m_total / (double)m_count : 0.0;
+}
+
+template <uint32_t MaxThreads>
+latency_recorder<MaxThreads>::latency_recorder()
+    : m_sharedLock(0)
+{
+    Reset();
+}
+
+template <uint32_t MaxThreads>
+inline void latency_recorder<MaxThreads>::Record(latency_op op, uint64_t ticks)
+{
+    uint32_t index = LatencyThreadIndex();
+    if (index < MaxThreads - 1)
+    {
+        m_threads[index].histograms[op].Record(ticks);
+        return;
+    }
+
+    while (ICE(&m_sharedLock, 1, 0) != 0);
+    m_threads[MaxThreads - 1].histograms[op].Record(ticks);
+    STORE_RELEASE(&m_sharedLock, 0u);
+}
+
+template <uint32_t MaxThreads>
+void latency_recorder<MaxThreads>::Merge(latency_op op, latency_histogram *result)
+{
+    result->Reset();
+    for (uint32_t i = 0; i < MaxThreads; ++i)
+    {
+        result->Merge(m_threads[i].histograms[op]);
+    }
+}
+
+template <uint32_t MaxThreads>
+void latency_recorder<MaxThreads>::Reset()
+{
+    for (uint32_t i = 0; i < MaxThreads; ++i)
+    {
+        for (uint32_t op = 0; op < latency_op_count; ++op)
+        {
+            m_threads[i].histograms[op].Reset();
+        }
+    }
+}
+
+// One line per op that was recorded, in nanoseconds.
+template <uint32_t MaxThreads>
+void PrintLatencyReport(latency_recorder<MaxThreads> *recorder, FILE *out)
+{
+    double ticksPerNanosecond = LatencyTicksPerNanosecond();
+
+    fprintf(out, "%-10s %12s %10s %10s %10s %10s %12s\n", "op", "count", "mean ns", "p50", "p99", "p99.9", "max");
+
+    latency_histogram *merged = new latency_histogram;
+    for (uint32_t op = 0; op < latency_op_count; ++op)
+    {
+        recorder->Merge((latency_op)op, merged);
+        if (!merged->m_count)
+        {
+            continue;
+        }
+
+        fprintf(out, "%-10s %12llu %10.0f %10.0f %10.0f %10.0f %12.0f\n",
+                latency_op_names[op],
+                (unsigned long long)merged->m_count,
+                merged->Mean() / ticksPerNanosecond,
+                (double)merged->Percentile(50.0) / ticksPerNanosecond,
+                (double)merged->Percentile(99.0) / ticksPerNanosecond,
+                (double)merged->Percentile(99.9) / ticksPerNanosecond,
+                (double)merged->m_max / ticksPerNanosecond);
+    }
+
+    delete merged;
+}
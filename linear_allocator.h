@@ -0,0 +1,201 @@
+#pragma once
+
+#include "memory_interface.h"
+#include "allocator_interface.h"
+#include "clear_memory.h"
+
+// Bump allocator over a single reservation. Pages are committed as the top grows.
+// Individual frees are ignored (except for the most recent allocation), memory is
+// released all at once with FreeToMarker or Reset.
+//
+// MI = Memory interface type.
+template <typename MI>
+struct linear_allocator
+{
+    linear_allocator(MI *memoryProvider, size_t minimumReservation);
+    linear_allocator(const linear_allocator &) = delete;
+    linear_allocator() = delete;
+
+    ~linear_allocator();
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+
+    // Offset of the current top, everything allocated after this call can be
+    // released by passing the result to FreeToMarker.
+    size_t GetMarker();
+    void FreeToMarker(size_t marker);
+    void Reset();
+
+    bool Owns(void *addr);
+
+private:
+    MI *memory_provider;
+
+    uint8_t *base;
+    size_t mem_reserved;
+    size_t mem_committed;
+
+    size_t top;
+
+    // Start of the most recent allocation, it can be grown or freed in place.
+    size_t last;
+
+    // Highest top so far. Nothing above it has been written since it was committed,
+    // so CALLOC only has to clear below it.
+    size_t zero_watermark;
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+template <typename MI>
+linear_allocator<MI>::linear_allocator(MI *memoryProvider, size_t minimumReservation)
+    : memory_provider(memoryProvider),
+      mem_committed(0),
+      top(0),
+      last(0),
+      zero_watermark(0)
+{
+    base = (uint8_t *)memory_provider->Reserve(minimumReservation, &mem_reserved);
+    BM_ASSERT(base, "Failed to reserve memory");
+}
+
+template <typename MI>
+linear_allocator<MI>::~linear_allocator()
+{
+    if (mem_committed)
+    {
+        memory_provider->DeCommit(base, mem_committed);
+    }
+
+    memory_provider->Release(base, mem_reserved);
+}
+
+template <typename MI>
+size_t linear_allocator<MI>::GetMarker()
+{
+    return top;
+}
+
+template <typename MI>
+void linear_allocator<MI>::FreeToMarker(size_t marker)
+{
+    BM_ASSERT(marker <= top, "Marker is above the current top");
+    top = marker;
+    last = marker;
+}
+
+template <typename MI>
+void linear_allocator<MI>::Reset()
+{
+    top = 0;
+    last = 0;
+}
+
+template <typename MI>
+bool linear_allocator<MI>::Owns(void *addr)
+{
+    return (uint8_t *)addr >= base && (uint8_t *)addr < base + mem_reserved;
+}
+
+template <typename MI>
+void *linear_allocator<MI>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+    BM_ASSERT(size > 0, "Tried to allocate 0 bytes.");
+    BM_ASSERT(alignment && !(alignment & (alignment - 1)), "Alignment must be a power of 2");
+
+    // Align the address rather than the offset, base is only page aligned.
+    uintptr_t topAddr = (uintptr_t)base + top;
+    size_t start = (size_t)(((topAddr + alignment - 1) & ~((uintptr_t)alignment - 1)) - (uintptr_t)base);
+    size_t end = start + size;
+
+    if (end > mem_committed)
+    {
+        if (end > mem_reserved)
+        {
+            BM_ASSERT(false, "Tried to commit more memory than reserved");
+            return nullptr;
+        }
+
+        size_t actualCommit;
+        memory_provider->Commit(base + mem_committed, end - mem_committed, &actualCommit);
+        mem_committed += actualCommit;
+    }
+
+    last = start;
+    top = end;
+
+    if (end > zero_watermark)
+    {
+        zero_watermark = end;
+    }
+
+    return base + start;
+}
+
+template <typename MI>
+void linear_allocator<MI>::FreeInternal(void *addr, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    // Only the most recent allocation can be given back.
+    if ((uint8_t *)addr == base + last)
+    {
+        top = last;
+    }
+}
+
+template <typename MI>
+void *linear_allocator<MI>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    if ((uint8_t *)addr != base + last || top == last)
+    {
+        // Only the most recent allocation can grow in place.
+        return nullptr;
+    }
+
+    size_t end = last + size;
+    if (end > mem_committed)
+    {
+        if (end > mem_reserved)
+        {
+            return nullptr;
+        }
+
+        size_t actualCommit;
+        memory_provider->Commit(base + mem_committed, end - mem_committed, &actualCommit);
+        mem_committed += actualCommit;
+    }
+
+    top = end;
+
+    if (end > zero_watermark)
+    {
+        zero_watermark = end;
+    }
+
+    return addr;
+}
+
+template <typename MI>
+void *linear_allocator<MI>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    size_t dirtyEnd = zero_watermark;
+
+    uint8_t *result = (uint8_t *)AllocInternal(size, alignment, line, file);
+    if (result && base + dirtyEnd > result)
+    {
+        size_t dirty = (size_t)(base + dirtyEnd - result);
+        ClearMemory(result, dirty < size ? dirty : size);
+    }
+
+    return result;
+}
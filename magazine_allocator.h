@@ -0,0 +1,326 @@
+#pragma once
+
+#include "platform.h"
+#include "allocator_interface.h"
+#include "clear_memory.h"
+#include <stdint.h>
+
+// Magazine caching layer (Bonwick & Adams) for a shared fixed size allocator.
+// Each thread owns a magazine_cache holding a loaded and a previous magazine.
+// Full and empty magazines are exchanged through the shared magazine_depot, so the
+// depot lock (which also guards the slab) is only taken once every M operations.
+//
+// T  = Slab allocator type. Accessed only while the depot lock is held.
+// MP = Allocator the magazines themselves are allocated from.
+
+struct magazine
+{
+    magazine *m_next;
+    uint32_t m_rounds;
+
+    void **Rounds()
+    {
+        return (void **)(this + 1);
+    }
+};
+
+template <typename T, typename MP>
+struct magazine_depot
+{
+    magazine_depot(T *slab, MP *magazineProvider, uint32_t initialMagazineSize, uint32_t maxMagazineSize);
+    magazine_depot(const magazine_depot &) = delete;
+    magazine_depot() = delete;
+
+    ~magazine_depot();
+
+    T *m_slab;
+    MP *m_magazineProvider;
+
+    magazine *m_full;
+    magazine *m_empty;
+
+    uint32_t m_lock;
+
+    // Current magazine size (M). Grows when the depot lock is contended and shrinks back
+    // towards the initial size when it isn't. Only read and written with the lock held.
+    uint32_t m_magazineSize;
+    uint32_t m_minMagazineSize;
+    uint32_t m_maxMagazineSize;
+
+    uint32_t m_acquisitions;
+    uint32_t m_contended;
+
+    void Lock();
+    void Unlock();
+
+    // Must be called with the lock held.
+    magazine *NewMagazine();
+    void FreeRounds(magazine *mag);
+
+private:
+    void AdaptMagazineSize();
+};
+
+template <typename T, typename MP>
+struct magazine_cache
+{
+    magazine_cache(magazine_depot<T, MP> *depot);
+    magazine_cache(const magazine_cache &) = delete;
+    magazine_cache() = delete;
+
+    ~magazine_cache();
+
+    magazine_depot<T, MP> *m_depot;
+    magazine *m_loaded;
+    magazine *m_previous;
+
+    // The depot's magazine size as of the last time this cache held the depot lock.
+    uint32_t m_magazineSize;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+
+private:
+    void Swap();
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+// Number of depot lock acquisitions between magazine size adjustments.
+#define BM_MAGAZINE_ADAPT_INTERVAL 256
+
+template <typename T, typename MP>
+magazine_depot<T, MP>::magazine_depot(T *slab, MP *magazineProvider, uint32_t initialMagazineSize, uint32_t maxMagazineSize)
+    : m_slab(slab),
+      m_magazineProvider(magazineProvider),
+      m_full(nullptr),
+      m_empty(nullptr),
+      m_lock(0),
+      m_magazineSize(initialMagazineSize),
+      m_minMagazineSize(initialMagazineSize),
+      m_maxMagazineSize(maxMagazineSize),
+      m_acquisitions(0),
+      m_contended(0)
+{
+    BM_ASSERT(initialMagazineSize > 0, "Magazines must hold atleast one round");
+    BM_ASSERT(initialMagazineSize <= maxMagazineSize, "Initial magazine size is larger than the maximum");
+}
+
+template <typename T, typename MP>
+magazine_depot<T, MP>::~magazine_depot()
+{
+    magazine *lists[] = { m_full, m_empty };
+    for (magazine *mag : lists)
+    {
+        while (mag)
+        {
+            magazine *next = mag->m_next;
+            FreeRounds(mag);
+            m_magazineProvider->FreeInternal(mag, __LINE__, __FILE__);
+            mag = next;
+        }
+    }
+}
+
+template <typename T, typename MP>
+inline void magazine_depot<T, MP>::Lock()
+{
+    if (ICE(&m_lock, 1, 0) != 0)
+    {
+        while (ICE(&m_lock, 1, 0) != 0);
+        ++m_contended;
+    }
+
+    if (++m_acquisitions == BM_MAGAZINE_ADAPT_INTERVAL)
+    {
+        AdaptMagazineSize();
+    }
+}
+
+template <typename T, typename MP>
+inline void magazine_depot<T, MP>::Unlock()
+{
+    STORE_RELEASE(&m_lock, 0u);
+}
+
+template <typename T, typename MP>
+void magazine_depot<T, MP>::AdaptMagazineSize()
+{
+    // Grow M when more than 1/8th of the recent acquisitions had to spin, shrink it when
+    // fewer than 1/64th did, so idle caches don't hold on to rounds. Magazines are always
+    // allocated at the maximum size, so existing ones stay valid. A magazine holding more
+    // rounds than a shrunk M is traded in full at the next free.
+    if (m_contended > (BM_MAGAZINE_ADAPT_INTERVAL / 8) && m_magazineSize < m_maxMagazineSize)
+    {
+        uint32_t grown = m_magazineSize * 2;
+        m_magazineSize = grown < m_maxMagazineSize ? grown : m_maxMagazineSize;
+    }
+    else if (m_contended < (BM_MAGAZINE_ADAPT_INTERVAL / 64) && m_magazineSize > m_minMagazineSize)
+    {
+        uint32_t shrunk = m_magazineSize / 2;
+        m_magazineSize = shrunk > m_minMagazineSize ? shrunk : m_minMagazineSize;
+    }
+
+    m_acquisitions = 0;
+    m_contended = 0;
+}
+
+template <typename T, typename MP>
+magazine *magazine_depot<T, MP>::NewMagazine()
+{
+    if (m_empty)
+    {
+        magazine *mag = m_empty;
+        m_empty = mag->m_next;
+        return mag;
+    }
+
+    size_t bytes = sizeof(magazine) + (m_maxMagazineSize * sizeof(void *));
+    magazine *mag = (magazine *)m_magazineProvider->AllocInternal(bytes, alignof(magazine), __LINE__, __FILE__);
+    BM_ASSERT(mag, "Failed to allocate a magazine");
+
+    mag->m_next = nullptr;
+    mag->m_rounds = 0;
+    return mag;
+}
+
+template <typename T, typename MP>
+void magazine_depot<T, MP>::FreeRounds(magazine *mag)
+{
+    void **rounds = mag->Rounds();
+    for (uint32_t i = 0; i < mag->m_rounds; ++i)
+    {
+        m_slab->FreeInternal(rounds[i], __LINE__, __FILE__);
+    }
+
+    mag->m_rounds = 0;
+}
+
+template <typename T, typename MP>
+magazine_cache<T, MP>::magazine_cache(magazine_depot<T, MP> *depot)
+    : m_depot(depot)
+{
+    m_depot->Lock();
+    m_loaded = m_depot->NewMagazine();
+    m_previous = m_depot->NewMagazine();
+    m_magazineSize = m_depot->m_magazineSize;
+    m_depot->Unlock();
+}
+
+template <typename T, typename MP>
+magazine_cache<T, MP>::~magazine_cache()
+{
+    m_depot->Lock();
+    m_depot->FreeRounds(m_loaded);
+    m_depot->FreeRounds(m_previous);
+
+    m_loaded->m_next = m_depot->m_empty;
+    m_previous->m_next = m_loaded;
+    m_depot->m_empty = m_previous;
+    m_depot->Unlock();
+}
+
+template <typename T, typename MP>
+inline void magazine_cache<T, MP>::Swap()
+{
+    magazine *temp = m_loaded;
+    m_loaded = m_previous;
+    m_previous = temp;
+}
+
+template <typename T, typename MP>
+void *magazine_cache<T, MP>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    if (m_loaded->m_rounds > 0)
+    {
+        return m_loaded->Rounds()[--m_loaded->m_rounds];
+    }
+
+    if (m_previous->m_rounds > 0)
+    {
+        Swap();
+        return m_loaded->Rounds()[--m_loaded->m_rounds];
+    }
+
+    // Both magazines are empty. Trade the previous one for a full one from the depot.
+    m_depot->Lock();
+    m_magazineSize = m_depot->m_magazineSize;
+    if (m_depot->m_full)
+    {
+        magazine *full = m_depot->m_full;
+        m_depot->m_full = full->m_next;
+
+        m_previous->m_next = m_depot->m_empty;
+        m_depot->m_empty = m_previous;
+        m_depot->Unlock();
+
+        m_previous = m_loaded;
+        m_loaded = full;
+        return m_loaded->Rounds()[--m_loaded->m_rounds];
+    }
+
+    // Depot is out of full magazines, go to the slab.
+    void *result = m_depot->m_slab->AllocInternal(size, alignment, line, file);
+    m_depot->Unlock();
+
+    return result;
+}
+
+template <typename T, typename MP>
+void magazine_cache<T, MP>::FreeInternal(void *addr, int line, const char *file)
+{
+    (void)line;
+    (void)file;
+
+    if (m_loaded->m_rounds < m_magazineSize)
+    {
+        m_loaded->Rounds()[m_loaded->m_rounds++] = addr;
+        return;
+    }
+
+    if (m_previous->m_rounds < m_magazineSize)
+    {
+        Swap();
+        m_loaded->Rounds()[m_loaded->m_rounds++] = addr;
+        return;
+    }
+
+    // Both magazines are full. Trade the previous one for an empty one.
+    m_depot->Lock();
+    m_magazineSize = m_depot->m_magazineSize;
+    magazine *empty = m_depot->NewMagazine();
+
+    m_previous->m_next = m_depot->m_full;
+    m_depot->m_full = m_previous;
+    m_depot->Unlock();
+
+    m_previous = m_loaded;
+    m_loaded = empty;
+    m_loaded->Rounds()[m_loaded->m_rounds++] = addr;
+}
+
+template <typename T, typename MP>
+void *magazine_cache<T, MP>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    (void)addr;
+    (void)size;
+    (void)line;
+    (void)file;
+    BM_ASSERT(false, "Unimplemented");
+    return nullptr;
+}
+
+template <typename T, typename MP>
+void *magazine_cache<T, MP>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    // Rounds come back dirty from other threads, so there is nothing to track.
+    void *result = AllocInternal(size, alignment, line, file);
+    if (result)
+    {
+        ClearMemory(result, size);
+    }
+
+    return result;
+}
@@ -3,20 +3,42 @@
 #pragma warning(push, 0)
 #include "allocator_interface.h"
 
+// System heap behind the allocator interface, as a baseline and a parent for pools.
+//
+// Like the other allocators, ReAlloc only resizes in place: it returns addr when the block
+// already has room for size and nullptr otherwise, and never moves the block. Pools keep
+// pointers into their buckets. Win32 can't ask an _aligned_malloc block how big it is
+// without knowing its alignment, so there it always returns nullptr.
 struct mallocator
 {
     DECLARE_ALLOCATOR_INTERFACE_METHODS();
 };
 
 #ifdef BM_MALLOCATOR_IMPLEMENTATION
+#include "clear_memory.h"
+#include <stddef.h>
 #include <stdlib.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 void *
 mallocator::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
 {
     (void)file;
     (void)line;
+#if defined(_WIN32)
     return _aligned_malloc(size, alignment);
+#else
+    // posix_memalign wants at least pointer alignment.
+    void *result;
+    if (posix_memalign(&result, alignment > sizeof(void *) ? alignment : sizeof(void *), size) != 0)
+    {
+        return nullptr;
+    }
+
+    return result;
+#endif
 }
 
 void
@@ -24,7 +46,11 @@ mallocator::FreeInternal(void *addr, int line, const char *file)
 {
     (void)file;
     (void)line;
+#if defined(_WIN32)
     _aligned_free(addr);
+#else
+    free(addr);
+#endif
 }
 
 void *
@@ -32,7 +58,33 @@ mallocator::ReAllocInternal(void *addr, size_t size, int line, const char *file)
 {
     (void)file;
     (void)line;
-    return realloc(addr, size);
+#if defined(__GLIBC__)
+    return size <= malloc_usable_size(addr) ? addr : nullptr;
+#else
+    (void)addr;
+    (void)size;
+    return nullptr;
+#endif
+}
+
+void *
+mallocator::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+#if !defined(_WIN32)
+    // calloc knows when the memory is fresh from the OS and skips the clear.
+    if (alignment <= alignof(max_align_t))
+    {
+        return calloc(1, size);
+    }
+#endif
+
+    void *result = AllocInternal(size, alignment, line, file);
+    if (result)
+    {
+        ClearMemory(result, size);
+    }
+
+    return result;
 }
 #endif
 #pragma warning(pop)
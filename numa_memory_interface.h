@@ -0,0 +1,317 @@
+#pragma once
+
+#include "memory_interface.h"
+#include "allocator_interface.h"
+#include "allocator_spinlock.h"
+#include <stdint.h>
+
+// Memory interface that binds every reservation it makes to one NUMA node, so an allocator
+// built on it gets node local memory no matter which thread touches a page first.
+// Binding is done with mbind on Linux. On hosts with a single node, on kernels without
+// NUMA support and on other platforms the reservation is left unbound.
+//
+// MI = Memory interface the reservations are made through.
+template <typename MI>
+struct numa_memory_interface
+{
+    numa_memory_interface(MI *memory, uint32_t node);
+
+    MI *m_memory;
+    uint32_t m_node;
+
+    // False when reservations are left to the default policy.
+    bool m_bound;
+
+    DECLARE_MEMORY_INTERFACE_METHODS();
+
+private:
+    void Bind(void *addr, size_t size);
+};
+
+// Serves each thread from the heap of the node it is running on. Frees and reallocs are
+// routed with Owns, so the heaps may be freed into from any node. Each heap is used by
+// every thread on its node, so it has to be thread safe (allocator_spin_lock).
+// Routing asks the allocator inside an allocator_spin_lock directly, without taking the
+// lock, so its Owns must only check a reservation that is fixed at construction, as
+// best_fit_allocator, buddy_allocator and linear_allocator do.
+//
+// A = Allocator type, usually one built on a numa_memory_interface.
+template <typename A, uint32_t MaxNodes = 8>
+struct numa_heap_set
+{
+    // heaps[i] serves node i. Nodes past nodeCount share heaps[node % nodeCount].
+    numa_heap_set(A **heaps, uint32_t nodeCount);
+
+    A *m_heaps[MaxNodes];
+    uint32_t m_nodeCount;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
+
+private:
+    A *LocalHeap();
+    A *FindOwner(void *addr);
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+// How many allocations a thread makes before it checks which node it is on again.
+#if !defined(BM_NUMA_NODE_REFRESH_INTERVAL)
+#define BM_NUMA_NODE_REFRESH_INTERVAL 1024
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#if !defined(MPOL_PREFERRED)
+#define MPOL_PREFERRED 1
+#define MPOL_BIND 2
+#endif
+
+#if !defined(MPOL_F_MEMS_ALLOWED)
+#define MPOL_F_MEMS_ALLOWED (1 << 2)
+#endif
+
+static inline uint32_t NumaNodeCount()
+{
+    // The highest node this process may allocate from bounds the node numbers in use.
+    unsigned long mask[16] = {};
+    int mode;
+    if (syscall(SYS_get_mempolicy, &mode, mask, sizeof(mask) * 8, nullptr, MPOL_F_MEMS_ALLOWED) != 0)
+    {
+        return 1;
+    }
+
+    uint32_t count = 1;
+    for (uint32_t node = 0; node < sizeof(mask) * 8; ++node)
+    {
+        if ((mask[node / (sizeof(unsigned long) * 8)] >> (node % (sizeof(unsigned long) * 8))) & 1)
+        {
+            count = node + 1;
+        }
+    }
+
+    return count;
+}
+
+static inline uint32_t NumaCurrentNode()
+{
+    unsigned cpu;
+    unsigned node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    {
+        return 0;
+    }
+
+    return node;
+}
+
+#elif defined(_WIN32)
+#include <windows.h>
+
+static inline uint32_t NumaNodeCount()
+{
+    ULONG highest;
+    return GetNumaHighestNodeNumber(&highest) ? (uint32_t)highest + 1 : 1;
+}
+
+static inline uint32_t NumaCurrentNode()
+{
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+
+    USHORT node;
+    return GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+}
+
+#else
+
+static inline uint32_t NumaNodeCount()
+{
+    return 1;
+}
+
+static inline uint32_t NumaCurrentNode()
+{
+    return 0;
+}
+
+#endif
+
+template <typename MI>
+numa_memory_interface<MI>::numa_memory_interface(MI *memory, uint32_t node)
+    : m_memory(memory),
+      m_node(node)
+{
+    // Nothing to choose between with a single node.
+    m_bound = NumaNodeCount() > 1;
+}
+
+template <typename MI>
+void numa_memory_interface<MI>::Bind(void *addr, size_t size)
+{
+#if defined(__linux__)
+    if (!m_bound)
+    {
+        return;
+    }
+
+    unsigned long mask[16] = {};
+    BM_ASSERT(m_node < sizeof(mask) * 8, "NUMA node is out of range");
+    mask[m_node / (sizeof(unsigned long) * 8)] = 1ul << (m_node % (sizeof(unsigned long) * 8));
+
+    // Preferred rather than bound, so running out of memory on the node falls back to
+    // the others instead of failing the commit.
+    if (syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0) != 0)
+    {
+        // No NUMA support in the kernel, or the node isn't allowed. Stop trying.
+        m_bound = false;
+    }
+#else
+    (void)addr;
+    (void)size;
+#endif
+}
+
+template <typename MI>
+void numa_memory_interface<MI>::Commit(void *addr, size_t size, size_t *actual)
+{
+    m_memory->Commit(addr, size, actual);
+}
+
+template <typename MI>
+void *numa_memory_interface<MI>::Reserve(size_t size, size_t *actual)
+{
+    void *result = m_memory->Reserve(size, actual);
+    if (result)
+    {
+        Bind(result, *actual);
+    }
+
+    return result;
+}
+
+template <typename MI>
+void *numa_memory_interface<MI>::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    void *result = m_memory->Reserve(size, alignment, actual);
+    if (result)
+    {
+        Bind(result, *actual);
+    }
+
+    return result;
+}
+
+template <typename MI>
+void numa_memory_interface<MI>::DeCommit(void *addr, size_t size)
+{
+    m_memory->DeCommit(addr, size);
+}
+
+template <typename MI>
+void numa_memory_interface<MI>::Release(void *addr, size_t size)
+{
+    m_memory->Release(addr, size);
+}
+
+template <typename MI>
+size_t numa_memory_interface<MI>::GetPageSize()
+{
+    return m_memory->GetPageSize();
+}
+
+template <typename A, uint32_t MaxNodes>
+numa_heap_set<A, MaxNodes>::numa_heap_set(A **heaps, uint32_t nodeCount)
+    : m_nodeCount(nodeCount)
+{
+    BM_ASSERT(nodeCount > 0 && nodeCount <= MaxNodes, "Node count is out of range");
+
+    for (uint32_t i = 0; i < nodeCount; ++i)
+    {
+        m_heaps[i] = heaps[i];
+    }
+}
+
+template <typename A, uint32_t MaxNodes>
+A *numa_heap_set<A, MaxNodes>::LocalHeap()
+{
+    // Asking the kernel for the node on every allocation is too slow, and node pinned
+    // threads never move anyway.
+    static thread_local uint32_t node = 0;
+    static thread_local uint32_t untilRefresh = 0;
+
+    if (untilRefresh-- == 0)
+    {
+        node = NumaCurrentNode();
+        untilRefresh = BM_NUMA_NODE_REFRESH_INTERVAL;
+    }
+
+    return m_heaps[node % m_nodeCount];
+}
+
+template <typename A>
+static inline bool NumaHeapOwns(A *heap, void *addr)
+{
+    return heap->Owns(addr);
+}
+
+template <typename A>
+static inline bool NumaHeapOwns(allocator_spin_lock<A> *heap, void *addr)
+{
+    // Every free goes through here, taking each heap's lock just to compare addresses
+    // would serialize frees across all nodes.
+    return heap->m_allocator->Owns(addr);
+}
+
+template <typename A, uint32_t MaxNodes>
+A *numa_heap_set<A, MaxNodes>::FindOwner(void *addr)
+{
+    for (uint32_t i = 0; i < m_nodeCount; ++i)
+    {
+        if (NumaHeapOwns(m_heaps[i], addr))
+        {
+            return m_heaps[i];
+        }
+    }
+
+    return nullptr;
+}
+
+template <typename A, uint32_t MaxNodes>
+void *numa_heap_set<A, MaxNodes>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    return LocalHeap()->AllocInternal(size, alignment, line, file);
+}
+
+template <typename A, uint32_t MaxNodes>
+void numa_heap_set<A, MaxNodes>::FreeInternal(void *addr, int line, const char *file)
+{
+    A *owner = FindOwner(addr);
+    BM_ASSERT(owner, "Tried to free memory that no node heap owns");
+    owner->FreeInternal(addr, line, file);
+}
+
+template <typename A, uint32_t MaxNodes>
+void *numa_heap_set<A, MaxNodes>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    A *owner = FindOwner(addr);
+    BM_ASSERT(owner, "Tried to realloc memory that no node heap owns");
+    return owner->ReAllocInternal(addr, size, line, file);
+}
+
+template <typename A, uint32_t MaxNodes>
+void *numa_heap_set<A, MaxNodes>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    return LocalHeap()->CAllocInternal(size, alignment, line, file);
+}
+
+template <typename A, uint32_t MaxNodes>
+bool numa_heap_set<A, MaxNodes>::Owns(void *addr)
+{
+    return FindOwner(addr) != nullptr;
+}
@@ -0,0 +1,251 @@
+#pragma once
+#include "fixed_size_allocator.h"
+
+#include <new>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+
+// Typed pool on top of fixed_size_allocator.
+// Objects stay where they were created, so T* stays valid until Destroy. Every live object
+// has an entry in a dense array of pointers used for iteration. With Handles, each object
+// also gets a slot in a slot map, which gives it a generation checked 32 bit handle.
+//
+// Each chunk is laid out as [pool_prefix][padding to alignof(T)][T].
+
+struct object_handle
+{
+    uint32_t value;
+};
+
+static const object_handle InvalidObjectHandle = { 0 };
+
+template <typename T, typename allocator_interface, bool Handles = false>
+struct object_pool
+{
+    static constexpr uint32_t index_bits = 22;
+    static constexpr uint32_t generation_bits = 32 - index_bits;
+    static constexpr uint32_t max_objects = 1u << index_bits;
+
+    object_pool(allocator_interface *memoryProvider, uint32_t chunksPerBucket);
+    object_pool(const object_pool &) = delete;
+    object_pool() = delete;
+
+    // Destroys any objects that are still alive.
+    ~object_pool();
+
+    template <typename... Args>
+    T *Create(Args &&...args);
+    void Destroy(T *object);
+
+    // Only with Handles.
+    object_handle GetHandle(T *object);
+
+    // Returns nullptr if the handle's object has been destroyed.
+    T *Get(object_handle handle);
+    void Destroy(object_handle handle);
+
+    uint32_t Count() { return m_count; }
+
+    // Live objects. The pointers are dense, the objects are where the chunk allocator put
+    // them, which is mostly in creation order. Destroying an object moves the last pointer
+    // into its place.
+    T **begin() { return m_dense; }
+    T **end() { return m_dense + m_count; }
+
+private:
+    struct pool_prefix
+    {
+        uint32_t denseIndex;
+
+        // Index into m_slots, only with Handles.
+        uint32_t slot;
+    };
+
+    struct pool_slot
+    {
+        T *object;
+
+        // Next free slot while the slot is unused.
+        uint32_t nextFree;
+        uint32_t generation;
+    };
+
+    static constexpr uint32_t no_slot = ~0u;
+    static constexpr size_t prefix_size = (sizeof(pool_prefix) + alignof(T) - 1) & ~(alignof(T) - 1);
+
+    // Free chunks hold the fixed_size_allocator's free list link.
+    static constexpr size_t link_alignment = alignof(free_chunk) > alignof(pool_prefix) ? alignof(free_chunk) : alignof(pool_prefix);
+    static constexpr uint32_t chunk_alignment = alignof(T) > link_alignment ? alignof(T) : link_alignment;
+    static constexpr size_t chunk_size = (prefix_size + sizeof(T) + chunk_alignment - 1) & ~((size_t)chunk_alignment - 1);
+
+    allocator_interface *m_memoryProvider;
+    fixed_size_allocator<allocator_interface> m_chunks;
+
+    pool_slot *m_slots;
+    uint32_t m_slotCount;
+    uint32_t m_slotCapacity;
+    uint32_t m_freeSlot;
+
+    T **m_dense;
+    uint32_t m_count;
+    uint32_t m_denseCapacity;
+
+    pool_prefix *PrefixOf(T *object);
+    void *GrowArray(void *array, size_t elementSize, uint32_t count, uint32_t *capacity);
+};
+
+template <typename T, typename allocator_interface, bool Handles>
+object_pool<T, allocator_interface, Handles>::object_pool(allocator_interface *memoryProvider, uint32_t chunksPerBucket)
+    : m_memoryProvider(memoryProvider),
+      m_chunks(memoryProvider, chunksPerBucket, chunk_size, chunk_alignment),
+      m_slots(nullptr),
+      m_slotCount(0),
+      m_slotCapacity(0),
+      m_freeSlot(no_slot),
+      m_dense(nullptr),
+      m_count(0),
+      m_denseCapacity(0)
+{
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+object_pool<T, allocator_interface, Handles>::~object_pool()
+{
+    while (m_count)
+    {
+        Destroy(m_dense[m_count - 1]);
+    }
+
+    if (m_slots) m_memoryProvider->FreeInternal(m_slots, __LINE__, __FILE__);
+    if (m_dense) m_memoryProvider->FreeInternal(m_dense, __LINE__, __FILE__);
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+inline typename object_pool<T, allocator_interface, Handles>::pool_prefix *object_pool<T, allocator_interface, Handles>::PrefixOf(T *object)
+{
+    return (pool_prefix *)((uint8_t *)object - prefix_size);
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+void *object_pool<T, allocator_interface, Handles>::GrowArray(void *array, size_t elementSize, uint32_t count, uint32_t *capacity)
+{
+    uint32_t newCapacity = *capacity ? *capacity * 2 : 64;
+    void *newArray = m_memoryProvider->AllocInternal(newCapacity * elementSize, alignof(void *), __LINE__, __FILE__);
+    BM_ASSERT(newArray, "Failed to grow object pool array");
+
+    if (array)
+    {
+        memcpy(newArray, array, count * elementSize);
+        m_memoryProvider->FreeInternal(array, __LINE__, __FILE__);
+    }
+
+    *capacity = newCapacity;
+    return newArray;
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+template <typename... Args>
+T *object_pool<T, allocator_interface, Handles>::Create(Args &&...args)
+{
+    if (m_count == m_denseCapacity)
+    {
+        m_dense = (T **)GrowArray(m_dense, sizeof(T *), m_count, &m_denseCapacity);
+    }
+
+    uint8_t *chunk = (uint8_t *)m_chunks.ALLOC(chunk_size, chunk_alignment);
+    T *object = new (chunk + prefix_size) T(std::forward<Args>(args)...);
+
+    pool_prefix *prefix = PrefixOf(object);
+    prefix->denseIndex = m_count;
+    prefix->slot = no_slot;
+    m_dense[m_count++] = object;
+
+    if (Handles)
+    {
+        uint32_t slotIndex;
+        if (m_freeSlot != no_slot)
+        {
+            slotIndex = m_freeSlot;
+            m_freeSlot = m_slots[slotIndex].nextFree;
+        }
+        else
+        {
+            BM_ASSERT(m_slotCount < max_objects, "Object pool is out of handle indices");
+            if (m_slotCount == m_slotCapacity)
+            {
+                m_slots = (pool_slot *)GrowArray(m_slots, sizeof(pool_slot), m_slotCount, &m_slotCapacity);
+            }
+
+            slotIndex = m_slotCount++;
+
+            // Generation 0 is never used, so a zeroed handle is never valid.
+            m_slots[slotIndex].generation = 1;
+        }
+
+        m_slots[slotIndex].object = object;
+        prefix->slot = slotIndex;
+    }
+
+    return object;
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+void object_pool<T, allocator_interface, Handles>::Destroy(T *object)
+{
+    pool_prefix *prefix = PrefixOf(object);
+    BM_ASSERT(prefix->denseIndex < m_count && m_dense[prefix->denseIndex] == object, "Trying to destroy an object that is not in this pool");
+
+    // Keep the live array dense by moving the last object into the hole.
+    T *moved = m_dense[--m_count];
+    m_dense[prefix->denseIndex] = moved;
+    PrefixOf(moved)->denseIndex = prefix->denseIndex;
+
+    if (Handles)
+    {
+        pool_slot *slot = &m_slots[prefix->slot];
+        uint32_t generation = (slot->generation + 1) & ((1u << generation_bits) - 1);
+        slot->generation = generation ? generation : 1;
+        slot->object = nullptr;
+        slot->nextFree = m_freeSlot;
+        m_freeSlot = prefix->slot;
+    }
+
+    object->~T();
+    m_chunks.FREE(prefix);
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+object_handle object_pool<T, allocator_interface, Handles>::GetHandle(T *object)
+{
+    static_assert(Handles, "Handles are only kept by object_pool<T, A, true>");
+
+    uint32_t slotIndex = PrefixOf(object)->slot;
+    object_handle handle;
+    handle.value = (m_slots[slotIndex].generation << index_bits) | slotIndex;
+    return handle;
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+T *object_pool<T, allocator_interface, Handles>::Get(object_handle handle)
+{
+    static_assert(Handles, "Handles are only kept by object_pool<T, A, true>");
+
+    uint32_t slotIndex = handle.value & (max_objects - 1);
+    uint32_t generation = handle.value >> index_bits;
+
+    if (slotIndex >= m_slotCount || m_slots[slotIndex].generation != generation)
+    {
+        return nullptr;
+    }
+
+    return m_slots[slotIndex].object;
+}
+
+template <typename T, typename allocator_interface, bool Handles>
+void object_pool<T, allocator_interface, Handles>::Destroy(object_handle handle)
+{
+    T *object = Get(handle);
+    BM_ASSERT(object, "Trying to destroy an object through a stale handle");
+    Destroy(object);
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include "memory_interface.h"
+#include "platform.h"
+#include <stdint.h>
+
+// Radix tree from address to the allocator that owns it, at a granularity of 1 << Shift
+// bytes. Lookups take three dependent loads and no locks. Interior nodes are installed
+// with a compare exchange and never freed while the map is alive, so readers never see
+// a node disappear.
+//
+// Reservations are registered through page_map_memory_interface, which sits between an
+// allocator and its memory interface. FREE on the map then dispatches to whichever
+// allocator owns the pointer, without any per allocation header.
+
+struct page_map_owner
+{
+    void *allocator;
+    void (*free)(void *allocator, void *addr, int line, const char *file);
+
+    // Optional. When null, GetUsableSize reports the size class.
+    size_t (*usableSize)(void *allocator, void *addr);
+
+    // Object size for fixed size allocators, 0 for variable sized ones.
+    uint32_t sizeClass;
+};
+
+template <typename A>
+static void PageMapFreeThunk(void *allocator, void *addr, int line, const char *file)
+{
+    ((A *)allocator)->FreeInternal(addr, line, file);
+}
+
+template <typename A>
+page_map_owner MakePageMapOwner(A *allocator, uint32_t sizeClass, size_t (*usableSize)(void *allocator, void *addr) = nullptr)
+{
+    page_map_owner owner;
+    owner.allocator = allocator;
+    owner.free = &PageMapFreeThunk<A>;
+    owner.usableSize = usableSize;
+    owner.sizeClass = sizeClass;
+    return owner;
+}
+
+// MI    = Memory interface the tree nodes are allocated from.
+// Shift = log2 of the mapping granularity. Registered ranges must not share a granule,
+//         so it can't be larger than the alignment of the reservations. Registering a
+//         range costs a pointer per granule. Reserving with an alignment of 1 << Shift
+//         allows a coarser map.
+template <typename MI, uint32_t Shift = 12>
+struct page_map
+{
+    static constexpr uint32_t address_bits = 48;
+    static constexpr uint32_t key_bits = address_bits - Shift;
+    static constexpr uint32_t node_bits = (key_bits + 2) / 3;
+    static constexpr uint32_t root_bits = key_bits - (2 * node_bits);
+
+    page_map(MI *memoryProvider);
+    page_map(const page_map &) = delete;
+    page_map() = delete;
+
+    ~page_map();
+
+    void Register(void *base, size_t size, page_map_owner *owner);
+    void Unregister(void *base, size_t size);
+
+    // Returns nullptr for addresses no allocator has registered.
+    page_map_owner *Lookup(void *addr);
+
+    void FreeInternal(void *addr, int line, const char *file);
+    size_t GetUsableSize(void *addr);
+
+private:
+    struct node
+    {
+        void *children[(size_t)1 << node_bits];
+    };
+
+    MI *memory_provider;
+    node *root[(size_t)1 << root_bits];
+
+    node *GetOrCreate(void **slot);
+    page_map_owner **GetLeafSlot(size_t key);
+
+    // Like GetLeafSlot, but returns nullptr instead of creating missing nodes.
+    page_map_owner **FindLeafSlot(size_t key);
+};
+
+// Registers every reservation made through it with a page_map.
+template <typename MI, typename PM>
+struct page_map_memory_interface
+{
+    page_map_memory_interface(MI *memory, PM *pageMap, page_map_owner *owner);
+
+    MI *m_memory;
+    PM *m_pageMap;
+    page_map_owner *m_owner;
+
+    DECLARE_MEMORY_INTERFACE_METHODS();
+};
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+#define PAGE_MAP_FREE(map, addr) (map)->FreeInternal(addr, __LINE__, __FILE__)
+
+template <typename MI, uint32_t Shift>
+page_map<MI, Shift>::page_map(MI *memoryProvider)
+    : memory_provider(memoryProvider)
+{
+    for (size_t i = 0; i < ((size_t)1 << root_bits); ++i)
+    {
+        root[i] = nullptr;
+    }
+}
+
+template <typename MI, uint32_t Shift>
+page_map<MI, Shift>::~page_map()
+{
+    for (size_t i = 0; i < ((size_t)1 << root_bits); ++i)
+    {
+        node *mid = root[i];
+        if (!mid)
+        {
+            continue;
+        }
+
+        for (size_t j = 0; j < ((size_t)1 << node_bits); ++j)
+        {
+            if (mid->children[j])
+            {
+                memory_provider->DeCommit(mid->children[j], sizeof(node));
+                memory_provider->Release(mid->children[j], sizeof(node));
+            }
+        }
+
+        memory_provider->DeCommit(mid, sizeof(node));
+        memory_provider->Release(mid, sizeof(node));
+    }
+}
+
+template <typename MI, uint32_t Shift>
+typename page_map<MI, Shift>::node *page_map<MI, Shift>::GetOrCreate(void **slot)
+{
+    node *existing = (node *)*(void *volatile *)slot;
+    if (existing)
+    {
+        return existing;
+    }
+
+    // Freshly committed pages read as zero, so the new node starts out empty.
+    size_t reserved;
+    node *created = (node *)memory_provider->Reserve(sizeof(node), &reserved);
+    BM_ASSERT(created, "Failed to reserve a page map node");
+
+    size_t committed;
+    memory_provider->Commit(created, sizeof(node), &committed);
+
+    existing = (node *)ICEP(slot, (void *)created, (void *)nullptr);
+    if (existing)
+    {
+        // Another thread installed the node first.
+        memory_provider->DeCommit(created, sizeof(node));
+        memory_provider->Release(created, reserved);
+        return existing;
+    }
+
+    return created;
+}
+
+template <typename MI, uint32_t Shift>
+page_map_owner **page_map<MI, Shift>::GetLeafSlot(size_t key)
+{
+    size_t rootIndex = key >> (2 * node_bits);
+    size_t midIndex = (key >> node_bits) & (((size_t)1 << node_bits) - 1);
+    size_t leafIndex = key & (((size_t)1 << node_bits) - 1);
+
+    node *mid = GetOrCreate((void **)&root[rootIndex]);
+    node *leaf = GetOrCreate(&mid->children[midIndex]);
+    return (page_map_owner **)&leaf->children[leafIndex];
+}
+
+template <typename MI, uint32_t Shift>
+page_map_owner **page_map<MI, Shift>::FindLeafSlot(size_t key)
+{
+    node *mid = *(node *volatile *)&root[key >> (2 * node_bits)];
+    if (!mid)
+    {
+        return nullptr;
+    }
+
+    node *leaf = *(node *volatile *)&mid->children[(key >> node_bits) & (((size_t)1 << node_bits) - 1)];
+    if (!leaf)
+    {
+        return nullptr;
+    }
+
+    return (page_map_owner **)&leaf->children[key & (((size_t)1 << node_bits) - 1)];
+}
+
+template <typename MI, uint32_t Shift>
+void page_map<MI, Shift>::Register(void *base, size_t size, page_map_owner *owner)
+{
+    size_t first = (size_t)base >> Shift;
+    size_t last = ((size_t)base + size - 1) >> Shift;
+    BM_ASSERT(last < ((size_t)1 << key_bits), "Address is outside of the range covered by the page map");
+
+    for (size_t key = first; key <= last; ++key)
+    {
+        *GetLeafSlot(key) = owner;
+    }
+}
+
+template <typename MI, uint32_t Shift>
+void page_map<MI, Shift>::Unregister(void *base, size_t size)
+{
+    size_t first = (size_t)base >> Shift;
+    size_t last = ((size_t)base + size - 1) >> Shift;
+
+    for (size_t key = first; key <= last; ++key)
+    {
+        page_map_owner **slot = FindLeafSlot(key);
+        if (slot)
+        {
+            *slot = nullptr;
+        }
+    }
+}
+
+template <typename MI, uint32_t Shift>
+page_map_owner *page_map<MI, Shift>::Lookup(void *addr)
+{
+    size_t key = (size_t)addr >> Shift;
+    if (key >= ((size_t)1 << key_bits))
+    {
+        return nullptr;
+    }
+
+    page_map_owner **slot = FindLeafSlot(key);
+    if (!slot)
+    {
+        return nullptr;
+    }
+
+    return *(page_map_owner *volatile *)slot;
+}
+
+template <typename MI, uint32_t Shift>
+void page_map<MI, Shift>::FreeInternal(void *addr, int line, const char *file)
+{
+    page_map_owner *owner = Lookup(addr);
+    BM_ASSERT(owner, "Tried to free memory that no registered allocator owns");
+    owner->free(owner->allocator, addr, line, file);
+}
+
+template <typename MI, uint32_t Shift>
+size_t page_map<MI, Shift>::GetUsableSize(void *addr)
+{
+    page_map_owner *owner = Lookup(addr);
+    BM_ASSERT(owner, "Tried to query memory that no registered allocator owns");
+
+    if (owner->usableSize)
+    {
+        return owner->usableSize(owner->allocator, addr);
+    }
+
+    return owner->sizeClass;
+}
+
+template <typename MI, typename PM>
+page_map_memory_interface<MI, PM>::page_map_memory_interface(MI *memory, PM *pageMap, page_map_owner *owner)
+    : m_memory(memory),
+      m_pageMap(pageMap),
+      m_owner(owner)
+{
+}
+
+template <typename MI, typename PM>
+void page_map_memory_interface<MI, PM>::Commit(void *addr, size_t size, size_t *actual)
+{
+    m_memory->Commit(addr, size, actual);
+}
+
+template <typename MI, typename PM>
+void *page_map_memory_interface<MI, PM>::Reserve(size_t size, size_t *actual)
+{
+    void *result = m_memory->Reserve(size, actual);
+    if (result)
+    {
+        m_pageMap->Register(result, *actual, m_owner);
+    }
+
+    return result;
+}
+
+template <typename MI, typename PM>
+void *page_map_memory_interface<MI, PM>::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    void *result = m_memory->Reserve(size, alignment, actual);
+    if (result)
+    {
+        m_pageMap->Register(result, *actual, m_owner);
+    }
+
+    return result;
+}
+
+template <typename MI, typename PM>
+void page_map_memory_interface<MI, PM>::DeCommit(void *addr, size_t size)
+{
+    m_memory->DeCommit(addr, size);
+}
+
+template <typename MI, typename PM>
+void page_map_memory_interface<MI, PM>::Release(void *addr, size_t size)
+{
+    m_pageMap->Unregister(addr, size);
+    m_memory->Release(addr, size);
+}
+
+template <typename MI, typename PM>
+size_t page_map_memory_interface<MI, PM>::GetPageSize()
+{
+    return m_memory->GetPageSize();
+}
@@ -1,17 +1,71 @@
-
 #pragma once
+#include <stdint.h>
 
 #ifdef _WIN32
 #pragma warning(push, 0)
 #include <windows.h>
+#include <intrin.h>
 #pragma warning(pop)
 #define ICE(dest, exc, comp) (InterlockedCompareExchange(dest, exc, comp))
-#endif
+#define ICEP(dest, exc, comp) (InterlockedCompareExchangePointer((PVOID volatile *)(dest), exc, comp))
+#define ICE64(dest, exc, comp) ((uint64_t)InterlockedCompareExchange64((LONG64 volatile *)(dest), (LONG64)(exc), (LONG64)(comp)))
+#define ATOMIC_ADD64(dest, value) ((void)InterlockedExchangeAdd64((LONG64 volatile *)(dest), (LONG64)(value)))
+#define STORE_RELEASE(dest, value) ((void)InterlockedExchange(dest, value))
+// MSVC compiles volatile reads as acquire loads (/volatile:ms, the default on x86 and x64).
+#define LOAD_ACQUIRE(src) (*(const volatile decltype(+*(src)) *)(src))
+
+static inline uint32_t CountTrailingZeros64(uint64_t value)
+{
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (uint32_t)index;
+}
+
+static inline uint32_t CountLeadingZeros64(uint64_t value)
+{
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return 63 - (uint32_t)index;
+}
 
-#ifdef __clang__
-#define ICE(dest, exc, comp) (__sync_val_compare_and_swap(dest, exc, comp))
+#define CTZ64(value) CountTrailingZeros64(value)
+#define CLZ64(value) CountLeadingZeros64(value)
+#elif defined(__clang__) || defined(__GNUC__)
+// Same argument order as the Interlocked functions: the value is exchanged when *dest == comp.
+#define ICE(dest, exc, comp) (__sync_val_compare_and_swap(dest, comp, exc))
+#define ICEP(dest, exc, comp) (__sync_val_compare_and_swap(dest, comp, exc))
+#define ICE64(dest, exc, comp) (__sync_val_compare_and_swap(dest, comp, exc))
+#define ATOMIC_ADD64(dest, value) ((void)__atomic_fetch_add(dest, value, __ATOMIC_RELAXED))
+#define STORE_RELEASE(dest, value) (__atomic_store_n(dest, value, __ATOMIC_RELEASE))
+#define LOAD_ACQUIRE(src) (__atomic_load_n(src, __ATOMIC_ACQUIRE))
+#define CTZ64(value) ((uint32_t)__builtin_ctzll(value))
+#define CLZ64(value) ((uint32_t)__builtin_clzll(value))
 #endif
 
 #ifndef ICE
 #error "Platform does not define the InterlockedCompareExchange macro (ICE)."
 #endif
+
+#ifndef ICE64
+#error "Platform does not define the 64 bit InterlockedCompareExchange macro (ICE64)."
+#endif
+
+#ifndef ATOMIC_ADD64
+#error "Platform does not define the 64 bit atomic add macro (ATOMIC_ADD64)."
+#endif
+
+#ifndef STORE_RELEASE
+#error "Platform does not define the release store macro (STORE_RELEASE)."
+#endif
+
+#ifndef LOAD_ACQUIRE
+#error "Platform does not define the acquire load macro (LOAD_ACQUIRE)."
+#endif
+
+#ifndef CTZ64
+#error "Platform does not define the count trailing zeros macro (CTZ64)."
+#endif
+
+#ifndef CLZ64
+#error "Platform does not define the count leading zeros macro (CLZ64)."
+#endif
@@ -0,0 +1,145 @@
+#ifndef POSIX_MEMORY_INTERFACE_H
+#define POSIX_MEMORY_INTERFACE_H
+#include "memory_interface.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum posix_memory_interface_flags : uint32_t
+{
+    // Ask for transparent hugepages (MADV_HUGEPAGE) on every reservation.
+    // Reserve with a hugepage alignment so whole hugepages can be used.
+    PosixMemoryHugePages = 1 << 0,
+
+    // Fault committed pages in during Commit, so first touch doesn't take page faults.
+    PosixMemoryPopulate = 1 << 1,
+};
+
+struct posix_virtual_memory_interface
+{
+    posix_virtual_memory_interface(const posix_virtual_memory_interface &) = delete;
+    posix_virtual_memory_interface(uint32_t flags = 0);
+
+    size_t page_size;
+    uint32_t flags;
+
+    DECLARE_MEMORY_INTERFACE_METHODS();
+};
+
+#endif
+
+#if defined(BM_POSIX_MEMORY_INTERFACE_IMPLEMENTATION)
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if !defined(MADV_POPULATE_WRITE)
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#if !defined(BM_ASSERT)
+#include <assert.h>
+#define BM_ASSERT(val, msg) assert(val)
+#endif
+
+posix_virtual_memory_interface::posix_virtual_memory_interface(uint32_t flags)
+    : flags(flags)
+{
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void posix_virtual_memory_interface::Commit(void *addr, size_t size, size_t *actual_commit)
+{
+    *actual_commit = size + ((~(size & (page_size - 1)) + 1) & (page_size - 1));
+
+    int result = mprotect(addr, *actual_commit, PROT_READ | PROT_WRITE);
+    BM_ASSERT(result == 0, "Failed to commit memory");
+    (void)result;
+
+    if ((flags & PosixMemoryPopulate) && madvise(addr, *actual_commit, MADV_POPULATE_WRITE) != 0)
+    {
+        // Kernels before 5.14 don't know MADV_POPULATE_WRITE. Touch every page instead,
+        // with an atomic write that leaves the contents alone in case the range is in use.
+        for (size_t offset = 0; offset < *actual_commit; offset += page_size)
+        {
+            __atomic_fetch_or((uint32_t *)((uint8_t *)addr + offset), 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void *posix_virtual_memory_interface::Reserve(size_t size, size_t *actual)
+{
+    // reserve atleast as many pages we need to satisfy to_reserve bytes.
+    *actual = size + ((~(size & (page_size - 1)) + 1) & (page_size - 1));
+
+    void *page_base = mmap(nullptr, *actual, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    BM_ASSERT(page_base != MAP_FAILED, "Failed to reserve memory");
+    if (page_base == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+#if defined(MADV_HUGEPAGE)
+    // Only a hint. The kernel may not have transparent hugepages enabled.
+    if (flags & PosixMemoryHugePages) madvise(page_base, *actual, MADV_HUGEPAGE);
+#endif
+
+    return page_base;
+}
+
+void *posix_virtual_memory_interface::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    BM_ASSERT(alignment && !(alignment & (alignment - 1)), "Alignment must be a power of 2");
+    if (alignment <= page_size)
+    {
+        return Reserve(size, actual);
+    }
+
+    *actual = size + ((~(size & (page_size - 1)) + 1) & (page_size - 1));
+
+    // Over reserve, then unmap the unaligned head and the tail.
+    size_t padded = *actual + alignment - page_size;
+    uint8_t *probe = (uint8_t *)mmap(nullptr, padded, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    BM_ASSERT(probe != MAP_FAILED, "Failed to reserve memory");
+    if (probe == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    uint8_t *page_base = (uint8_t *)(((size_t)probe + alignment - 1) & ~(alignment - 1));
+    size_t head = (size_t)(page_base - probe);
+    size_t tail = padded - head - *actual;
+
+    if (head) munmap(probe, head);
+    if (tail) munmap(page_base + *actual, tail);
+
+#if defined(MADV_HUGEPAGE)
+    if (flags & PosixMemoryHugePages) madvise(page_base, *actual, MADV_HUGEPAGE);
+#endif
+
+    return page_base;
+}
+
+void posix_virtual_memory_interface::DeCommit(void *addr, size_t size)
+{
+    // Drop the pages so they read back as zero and stop counting against RSS.
+    int result = madvise(addr, size, MADV_DONTNEED);
+    result |= mprotect(addr, size, PROT_NONE);
+    BM_ASSERT(result == 0, "Failed to de-commit memory");
+    (void)result;
+}
+
+void posix_virtual_memory_interface::Release(void *addr, size_t size)
+{
+    int result = munmap(addr, size);
+    BM_ASSERT(result == 0, "Failed to release memory");
+    (void)result;
+}
+
+size_t posix_virtual_memory_interface::GetPageSize()
+{
+    return page_size;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "allocator_spinlock.h"
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Background thread that keeps headroom bytes past the committed end of an allocator
+// committed and faulted in, so the threads allocating from it never take the page faults
+// of growing the heap. The allocator's lock is only held to pick the next range and to
+// publish it, never while committing.
+//
+// T = Allocator type with BeginPreCommit, PreCommit and EndPreCommit (best_fit_allocator).
+template <typename T>
+struct precommitter
+{
+    // Checks the headroom every intervalMicroseconds. With 0 no thread is started and the
+    // headroom is only topped up by RunOnce.
+    precommitter(allocator_spin_lock<T> *allocator, size_t headroom, uint32_t intervalMicroseconds = 1000);
+    precommitter(const precommitter &) = delete;
+    precommitter() = delete;
+
+    ~precommitter();
+
+    // Tops the headroom up once on the calling thread. Returns false if it was already full.
+    // Only for a precommitter without a thread.
+    bool RunOnce();
+
+    allocator_spin_lock<T> *m_allocator;
+    size_t m_headroom;
+    uint32_t m_intervalMicroseconds;
+
+    std::atomic<bool> m_stop;
+    std::thread m_thread;
+
+private:
+    void Run();
+};
+
+template <typename T>
+precommitter<T>::precommitter(allocator_spin_lock<T> *allocator, size_t headroom, uint32_t intervalMicroseconds)
+    : m_allocator(allocator),
+      m_headroom(headroom),
+      m_intervalMicroseconds(intervalMicroseconds),
+      m_stop(false)
+{
+    if (m_intervalMicroseconds)
+    {
+        m_thread = std::thread(&precommitter<T>::Run, this);
+    }
+}
+
+template <typename T>
+precommitter<T>::~precommitter()
+{
+    m_stop.store(true);
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+template <typename T>
+bool precommitter<T>::RunOnce()
+{
+    best_fit_precommit work;
+
+    m_allocator->Lock();
+    bool started = m_allocator->m_allocator->BeginPreCommit(m_headroom, &work);
+    m_allocator->Unlock();
+
+    if (!started)
+    {
+        return false;
+    }
+
+    m_allocator->m_allocator->PreCommit(&work);
+
+    m_allocator->Lock();
+    m_allocator->m_allocator->EndPreCommit(&work);
+    m_allocator->Unlock();
+
+    return true;
+}
+
+template <typename T>
+void precommitter<T>::Run()
+{
+    while (!m_stop.load())
+    {
+        // Keep going while the allocator is eating into the headroom.
+        if (!RunOnce())
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(m_intervalMicroseconds));
+        }
+    }
+}
@@ -0,0 +1,434 @@
+#pragma once
+
+#include "platform.h"
+#include "allocator_interface.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(_WIN32)
+#pragma warning(push, 0)
+#include <windows.h>
+#pragma warning(pop)
+#elif defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define BM_SAMPLING_BACKTRACE 1
+#endif
+
+// Sampling heap profiler. Wraps an allocator and records the call stack of about one
+// allocation every SampleRate bytes, then tracks the sampled block until it is freed.
+// WriteHeapProfile dumps the live samples in the gperftools heap profile format, which
+// pprof reads and scales back up by the sample rate:
+//
+//     pprof --text ./program heap.prof
+//
+// Sampling is geometric like tcmalloc's: each thread counts down an exponentially
+// distributed number of bytes, so large blocks are always sampled and small ones in
+// proportion to their size. An unsampled alloc costs a thread local subtraction. An
+// unsampled free costs one load from a filter that is only non zero near sampled blocks.
+// Sampled calls take a lock and walk the stack, but are rare enough not to matter.
+// In place reallocs update the size of a sampled block, the growth itself isn't sampled.
+//
+// The countdown is per thread and shared by every sampling_allocator of the same A.
+// Holds MaxSamples live samples, later ones are dropped and counted. Large, keep it off
+// the stack.
+//
+// A = Allocator type.
+template <typename A, uint32_t MaxSamples = 4096>
+struct sampling_allocator
+{
+    static_assert(MaxSamples && !(MaxSamples & (MaxSamples - 1)), "MaxSamples must be a power of 2");
+
+    static constexpr uint32_t max_depth = 32;
+
+    // sampleRate is the mean number of bytes between samples.
+    sampling_allocator(A *allocator, size_t sampleRate = 512 * 1024);
+    sampling_allocator(const sampling_allocator &) = delete;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
+
+    // Returns false if the file can't be written.
+    bool WriteHeapProfile(const char *path);
+
+    struct sample
+    {
+        void *addr;
+        size_t size;
+        uint32_t depth;
+        void *stack[max_depth];
+    };
+
+    A *m_allocator;
+    size_t m_sampleRate;
+
+    uint32_t m_lock;
+    uint32_t m_sampleCount;
+    uint64_t m_droppedSamples;
+
+    // Open addressing on the block address, kept at most half full.
+    sample m_samples[MaxSamples * 2];
+
+    // How many live samples hash to each entry. Zero means the block isn't sampled.
+    // Small enough to stay in cache. An entry that reaches 255 stays there. The 8 bit
+    // entries are packed four to a word, so Free and ReAlloc can read them without the lock.
+    uint32_t m_filter[MaxSamples];
+
+private:
+    static size_t &BytesUntilSample();
+    size_t NextSampleDistance();
+    bool Countdown(size_t size);
+
+    void AddSample(void *addr, size_t size);
+    bool RemoveSample(void *addr);
+    sample *FindSample(void *addr);
+
+    static uint32_t SlotHash(void *addr) { return (uint32_t)(((uint64_t)addr * 0x9E3779B97F4A7C15ull) >> 40); }
+    uint32_t FilterIndex(void *addr) { return ((uint32_t)((uint64_t)addr >> 4) ^ SlotHash(addr)) & (MaxSamples * 4 - 1); }
+    uint32_t FilterCount(void *addr);
+    void AdjustFilter(void *addr, bool add);
+
+    void Lock() { while (ICE(&m_lock, 1, 0) != 0); }
+    void Unlock() { STORE_RELEASE(&m_lock, 0u); }
+};
+
+template <typename A, uint32_t MaxSamples>
+sampling_allocator<A, MaxSamples>::sampling_allocator(A *allocator, size_t sampleRate)
+    : m_allocator(allocator),
+      m_sampleRate(sampleRate ? sampleRate : 1),
+      m_lock(0),
+      m_sampleCount(0),
+      m_droppedSamples(0)
+{
+    for (uint32_t i = 0; i < MaxSamples * 2; ++i)
+    {
+        m_samples[i].addr = nullptr;
+    }
+
+    for (uint32_t i = 0; i < MaxSamples; ++i)
+    {
+        m_filter[i] = 0;
+    }
+}
+
+template <typename A, uint32_t MaxSamples>
+inline uint32_t sampling_allocator<A, MaxSamples>::FilterCount(void *addr)
+{
+    uint32_t index = FilterIndex(addr);
+    return (LOAD_ACQUIRE(&m_filter[index / 4]) >> ((index & 3) * 8)) & 0xFF;
+}
+
+template <typename A, uint32_t MaxSamples>
+void sampling_allocator<A, MaxSamples>::AdjustFilter(void *addr, bool add)
+{
+    // Only called with the lock held, so nothing else writes the word.
+    uint32_t index = FilterIndex(addr);
+    uint32_t shift = (index & 3) * 8;
+    uint32_t word = m_filter[index / 4];
+    uint32_t count = (word >> shift) & 0xFF;
+    if (count == UINT8_MAX)
+    {
+        return;
+    }
+
+    count = add ? count + 1 : count - 1;
+    STORE_RELEASE(&m_filter[index / 4], (word & ~(0xFFu << shift)) | (count << shift));
+}
+
+template <typename A, uint32_t MaxSamples>
+size_t &sampling_allocator<A, MaxSamples>::BytesUntilSample()
+{
+    // 0 until the thread's first alloc draws its first distance.
+    static thread_local size_t bytesUntilSample = 0;
+    return bytesUntilSample;
+}
+
+template <typename A, uint32_t MaxSamples>
+size_t sampling_allocator<A, MaxSamples>::NextSampleDistance()
+{
+    // xorshift64, seeded from the address of the thread local so threads differ.
+    static thread_local uint64_t state = 0;
+    if (!state)
+    {
+        state = ((uint64_t)&state * 0x9E3779B97F4A7C15ull) | 1;
+    }
+
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    // Uniform in (0, 1], then exponential with a mean of the sample rate.
+    double uniform = (double)((state >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (size_t)(-log(uniform) * (double)m_sampleRate) + 1;
+}
+
+template <typename A, uint32_t MaxSamples>
+inline bool sampling_allocator<A, MaxSamples>::Countdown(size_t size)
+{
+    size_t &bytesUntilSample = BytesUntilSample();
+    if (bytesUntilSample > size)
+    {
+        bytesUntilSample -= size;
+        return false;
+    }
+
+    if (bytesUntilSample == 0)
+    {
+        bytesUntilSample = NextSampleDistance();
+        return Countdown(size);
+    }
+
+    bytesUntilSample = NextSampleDistance();
+    return true;
+}
+
+template <typename A, uint32_t MaxSamples>
+typename sampling_allocator<A, MaxSamples>::sample *sampling_allocator<A, MaxSamples>::FindSample(void *addr)
+{
+    uint32_t mask = MaxSamples * 2 - 1;
+    for (uint32_t slot = SlotHash(addr) & mask;; slot = (slot + 1) & mask)
+    {
+        if (m_samples[slot].addr == addr)
+        {
+            return &m_samples[slot];
+        }
+
+        if (!m_samples[slot].addr)
+        {
+            return nullptr;
+        }
+    }
+}
+
+template <typename A, uint32_t MaxSamples>
+void sampling_allocator<A, MaxSamples>::AddSample(void *addr, size_t size)
+{
+    // Walk the stack before taking the lock. It starts inside the profiler, frames aren't
+    // skipped because inlining changes how many there are.
+    void *stack[max_depth];
+    uint32_t depth = 0;
+#if defined(_WIN32)
+    depth = CaptureStackBackTrace(0, max_depth, stack, nullptr);
+#elif defined(BM_SAMPLING_BACKTRACE)
+    int captured = backtrace(stack, max_depth);
+    depth = captured > 0 ? (uint32_t)captured : 0;
+#endif
+
+    Lock();
+
+    if (m_sampleCount == MaxSamples)
+    {
+        ++m_droppedSamples;
+        Unlock();
+        return;
+    }
+
+    uint32_t mask = MaxSamples * 2 - 1;
+    uint32_t slot = SlotHash(addr) & mask;
+    while (m_samples[slot].addr)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    sample *entry = &m_samples[slot];
+    entry->addr = addr;
+    entry->size = size;
+    entry->depth = depth;
+    for (uint32_t i = 0; i < depth; ++i)
+    {
+        entry->stack[i] = stack[i];
+    }
+
+    ++m_sampleCount;
+    AdjustFilter(addr, true);
+
+    Unlock();
+}
+
+template <typename A, uint32_t MaxSamples>
+bool sampling_allocator<A, MaxSamples>::RemoveSample(void *addr)
+{
+    Lock();
+
+    sample *entry = FindSample(addr);
+    if (!entry)
+    {
+        Unlock();
+        return false;
+    }
+
+    --m_sampleCount;
+    AdjustFilter(addr, false);
+
+    // Shift the rest of the probe run back over the hole, so lookups never need tombstones.
+    uint32_t mask = MaxSamples * 2 - 1;
+    uint32_t hole = (uint32_t)(entry - m_samples);
+    for (uint32_t slot = (hole + 1) & mask; m_samples[slot].addr; slot = (slot + 1) & mask)
+    {
+        uint32_t home = SlotHash(m_samples[slot].addr) & mask;
+
+        // Move it if its home isn't cyclically within (hole, slot].
+        bool homeInRange = hole <= slot ? (home > hole && home <= slot) : (home > hole || home <= slot);
+        if (!homeInRange)
+        {
+            m_samples[hole] = m_samples[slot];
+            hole = slot;
+        }
+    }
+
+    m_samples[hole].addr = nullptr;
+
+    Unlock();
+    return true;
+}
+
+template <typename A, uint32_t MaxSamples>
+void *sampling_allocator<A, MaxSamples>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    void *result = m_allocator->AllocInternal(size, alignment, line, file);
+    if (Countdown(size) && result)
+    {
+        AddSample(result, size);
+    }
+
+    return result;
+}
+
+template <typename A, uint32_t MaxSamples>
+void *sampling_allocator<A, MaxSamples>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    void *result = m_allocator->CAllocInternal(size, alignment, line, file);
+    if (Countdown(size) && result)
+    {
+        AddSample(result, size);
+    }
+
+    return result;
+}
+
+template <typename A, uint32_t MaxSamples>
+void sampling_allocator<A, MaxSamples>::FreeInternal(void *addr, int line, const char *file)
+{
+    // The sample has to go before the block does, another thread may get the address next.
+    if (FilterCount(addr))
+    {
+        RemoveSample(addr);
+    }
+
+    m_allocator->FreeInternal(addr, line, file);
+}
+
+template <typename A, uint32_t MaxSamples>
+void *sampling_allocator<A, MaxSamples>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    void *result = m_allocator->ReAllocInternal(addr, size, line, file);
+    if (result && FilterCount(addr))
+    {
+        Lock();
+        sample *entry = FindSample(addr);
+        if (entry)
+        {
+            entry->size = size;
+        }
+        Unlock();
+    }
+
+    return result;
+}
+
+template <typename A, uint32_t MaxSamples>
+bool sampling_allocator<A, MaxSamples>::Owns(void *addr)
+{
+    return m_allocator->Owns(addr);
+}
+
+template <typename A, uint32_t MaxSamples>
+bool sampling_allocator<A, MaxSamples>::WriteHeapProfile(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (!out)
+    {
+        return false;
+    }
+
+    // Copy the live samples out, so the lock isn't held while writing.
+    sample *samples = new sample[MaxSamples];
+    uint32_t count = 0;
+
+    Lock();
+    for (uint32_t i = 0; i < MaxSamples * 2; ++i)
+    {
+        if (m_samples[i].addr)
+        {
+            samples[count++] = m_samples[i];
+        }
+    }
+    Unlock();
+
+    // Group samples with the same stack: each group is written once, by its first sample.
+    bool *written = new bool[count ? count : 1];
+    uint64_t totalBytes = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        written[i] = false;
+        totalBytes += samples[i].size;
+    }
+
+    fprintf(out, "heap profile: %6u: %8llu [%6u: %8llu] @ heap_v2/%zu\n",
+            count, (unsigned long long)totalBytes, count, (unsigned long long)totalBytes, m_sampleRate);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (written[i])
+        {
+            continue;
+        }
+
+        uint32_t objects = 0;
+        uint64_t bytes = 0;
+        for (uint32_t j = i; j < count; ++j)
+        {
+            bool same = !written[j] && samples[j].depth == samples[i].depth;
+            for (uint32_t frame = 0; same && frame < samples[i].depth; ++frame)
+            {
+                same = samples[j].stack[frame] == samples[i].stack[frame];
+            }
+
+            if (same)
+            {
+                written[j] = true;
+                ++objects;
+                bytes += samples[j].size;
+            }
+        }
+
+        fprintf(out, "%6u: %8llu [%6u: %8llu] @", objects, (unsigned long long)bytes, objects, (unsigned long long)bytes);
+        for (uint32_t frame = 0; frame < samples[i].depth; ++frame)
+        {
+            fprintf(out, " 0x%llx", (unsigned long long)(uintptr_t)samples[i].stack[frame]);
+        }
+        fprintf(out, "\n");
+    }
+
+    delete[] written;
+    delete[] samples;
+
+#if defined(__linux__)
+    // pprof symbolizes the stacks with the mappings.
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps)
+    {
+        char buffer[4096];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+        {
+            fwrite(buffer, 1, read, out);
+        }
+
+        fclose(maps);
+    }
+#endif
+
+    return fclose(out) == 0;
+}
@@ -20,6 +20,14 @@ void *dummy_interface::Reserve(size_t size, size_t *actual)
     return nullptr;
 }
 
+void *dummy_interface::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    (void)size;
+    (void)alignment;
+    (void)actual;
+    return nullptr;
+}
+
 void dummy_interface::DeCommit(void *addr, size_t size)
 {
     (void)addr;
@@ -13,6 +13,7 @@
 #include <unordered_map>
 #include <map>
 #include <unordered_set>
+#include <thread>
 #pragma warning(pop)
 
 #define CORRUPTION_DETECTION_ENABLED 1
@@ -92,6 +93,11 @@ void MyAssert(bool value, const char *message, int line, const char *file)
 #define USE_STL
 #define BM_ASSERT(val, msg) MyAssert((bool)(val), msg, __LINE__, __FILE__)
 
+// Before the allocators, so their BM_TIMED_BLOCK hooks are compiled in.
+#define BM_TIMED_BLOCK_IMPLEMENTATION
+#include "timed_block.h"
+#undef BM_TIMED_BLOCK_IMPLEMENTATION
+
 #define BM_WIN32_MEMORY_INTERFACE_IMPLEMENTATION
 #include "win32_memory_interface.h"
 #undef BM_WIN32_MEMORY_INTERFACE_IMPLEMENTATION
@@ -105,6 +111,10 @@ void MyAssert(bool value, const char *message, int line, const char *file)
 #include "checked_fixed_allocator.h"
 #undef BM_CHECKED_FIXED_ALLOCATOR_IMPLEMENTATION
 
+#include "bitmap_fixed_allocator.h"
+#include "magazine_allocator.h"
+#include "object_pool.h"
+
 #define BM_MALLOCATOR_IMPLEMENTATION
 #include "mallocator.h"
 #undef BM_MALLOCATOR_IMPLEMENTATION
@@ -115,6 +125,16 @@ void MyAssert(bool value, const char *message, int line, const char *file)
 
 #include "allocator_spinlock.h"
 #include "allocator_mem_interface.h"
+#include "linear_allocator.h"
+#include "double_stack_allocator.h"
+#include "buddy_allocator.h"
+#include "allocator_combinators.h"
+#include "page_map.h"
+#include "numa_memory_interface.h"
+#include "precommitter.h"
+#include "timed_allocator.h"
+#include "sampling_allocator.h"
+#include "callsite_stats.h"
 
 void CheckForLeaks(alloc_block *block)
 {
@@ -170,6 +190,31 @@ static void MemoryInterfaceTests(mem_interface *mem)
     printf("SUCCESS\n");
 }
 
+template <typename mem_interface>
+static void AlignedReserveTests(mem_interface *mem)
+{
+    printf("AlignedReserveTests: ");
+
+    size_t alignments[] = { 4096, Megabytes(2), Megabytes(4) };
+    for (size_t alignment : alignments)
+    {
+        size_t actualReserve;
+        void *basePage = mem->Reserve(Megabytes(3), alignment, &actualReserve);
+        BM_ASSERT(basePage, "Failed to reserve aligned memory");
+        BM_ASSERT(((size_t)basePage & (alignment - 1)) == 0, "Reservation is not aligned");
+        BM_ASSERT(actualReserve >= Megabytes(3), "Reservation is too small");
+
+        size_t actualCommit;
+        mem->Commit(basePage, actualReserve, &actualCommit);
+        memset(basePage, 0xBB, actualReserve);
+
+        mem->DeCommit(basePage, actualReserve);
+        mem->Release(basePage, actualReserve);
+    }
+
+    printf("SUCCESS\n");
+}
+
 template <typename allocator_interface>
 static void FixedAllocatorTests(allocator_interface *parentAllocator)
 {
@@ -201,6 +246,1065 @@ static void FixedAllocatorTests(allocator_interface *parentAllocator)
     printf("SUCCESS\n");
 }
 
+template <typename allocator_interface>
+static void BitmapFixedAllocatorTests(allocator_interface *parentAllocator)
+{
+    printf("BitmapFixedAllocatorTests: ");
+
+    uint32_t numChunks = 1000;
+    bitmap_fixed_allocator<allocator_interface> allocator(parentAllocator, numChunks, 24, 8);
+
+    size_t numAllocations = numChunks * 10;
+
+    std::vector<void *> entries;
+    for (size_t i = 0; i < numAllocations; ++i)
+    {
+        entries.push_back(allocator.ALLOC(24, 8));
+    }
+
+    void *lowestFreed = entries[0];
+    for (size_t i = 0; i < numAllocations; i += 2)
+    {
+        allocator.FREE(entries[i]);
+        if (entries[i] < lowestFreed)
+        {
+            lowestFreed = entries[i];
+        }
+    }
+
+    // The lowest free chunk is always handed out first.
+    void *lowest = allocator.ALLOC(24, 8);
+    BM_ASSERT(lowest == lowestFreed, "Bitmap allocator did not return the lowest free chunk");
+    allocator.FREE(lowest);
+
+    for (size_t i = 1; i < numAllocations; i += 2)
+    {
+        allocator.FREE(entries[i]);
+    }
+
+    allocator.ReleaseEmptyBuckets();
+
+    printf("SUCCESS\n");
+}
+
+template <typename allocator_interface>
+static void MagazineAllocatorTests(allocator_interface *parentAllocator)
+{
+    printf("MagazineAllocatorTests: ");
+
+    using slab_t = fixed_size_allocator<allocator_interface>;
+    slab_t slab(parentAllocator, 1000, 32, 8);
+    magazine_depot<slab_t, allocator_interface> depot(&slab, parentAllocator, 8, 64);
+
+    {
+        magazine_cache<slab_t, allocator_interface> cache(&depot);
+
+        std::vector<void *> entries;
+        for (int round = 0; round < 10; ++round)
+        {
+            for (int i = 0; i < 500; ++i)
+            {
+                void *ptr = cache.ALLOC(32, 8);
+                memset(ptr, 0xFA, 32);
+                entries.push_back(ptr);
+            }
+
+            for (void *ptr : entries)
+            {
+                cache.FREE(ptr);
+            }
+
+            entries.clear();
+        }
+    }
+
+    // Threads share the depot and free each other's chunks.
+    {
+        const int threadCount = 4;
+        std::vector<void *> handoff[threadCount];
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; ++t)
+        {
+            threads.emplace_back([&depot, &handoff, t]()
+            {
+                magazine_cache<slab_t, allocator_interface> cache(&depot);
+
+                std::vector<void *> entries;
+                for (int round = 0; round < 200; ++round)
+                {
+                    for (int i = 0; i < 300; ++i)
+                    {
+                        void *ptr = cache.ALLOC(32, 8);
+                        memset(ptr, t, 32);
+                        entries.push_back(ptr);
+                    }
+
+                    for (void *ptr : entries)
+                    {
+                        BM_ASSERT(*(uint8_t *)ptr == (uint8_t)t, "Chunk was handed to two threads");
+                        cache.FREE(ptr);
+                    }
+
+                    entries.clear();
+                }
+
+                for (int i = 0; i < 100; ++i)
+                {
+                    handoff[t].push_back(cache.ALLOC(32, 8));
+                }
+            });
+        }
+
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        magazine_cache<slab_t, allocator_interface> cache(&depot);
+        for (int t = 0; t < threadCount; ++t)
+        {
+            for (void *ptr : handoff[t])
+            {
+                cache.FREE(ptr);
+            }
+        }
+    }
+
+    // M grows under contention and shrinks back once the lock is quiet.
+    depot.Lock();
+    depot.m_contended = BM_MAGAZINE_ADAPT_INTERVAL;
+    depot.m_acquisitions = BM_MAGAZINE_ADAPT_INTERVAL - 1;
+    uint32_t before = depot.m_magazineSize;
+    depot.Unlock();
+
+    depot.Lock();
+    BM_ASSERT(depot.m_magazineSize == (before * 2 < 64 ? before * 2 : 64), "Magazine size did not grow under contention");
+    depot.Unlock();
+
+    for (int i = 0; i < BM_MAGAZINE_ADAPT_INTERVAL * 8; ++i)
+    {
+        depot.Lock();
+        depot.Unlock();
+    }
+
+    BM_ASSERT(depot.m_magazineSize == 8, "Magazine size did not shrink back");
+
+    printf("SUCCESS\n");
+}
+
+template <typename allocator_interface>
+static void ObjectPoolTests(allocator_interface *parentAllocator)
+{
+    printf("ObjectPoolTests: ");
+
+    struct entity
+    {
+        entity(int id, float x) : id(id), x(x) {}
+        int id;
+        float x;
+    };
+
+    object_pool<entity, allocator_interface, true> pool(parentAllocator, 256);
+
+    std::vector<object_handle> handles;
+    for (int i = 0; i < 2000; ++i)
+    {
+        handles.push_back(pool.GetHandle(pool.Create(i, (float)i)));
+    }
+
+    for (int i = 0; i < 2000; i += 3)
+    {
+        pool.Destroy(handles[i]);
+    }
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        entity *e = pool.Get(handles[i]);
+        BM_ASSERT((i % 3 == 0) == (e == nullptr), "Object pool handle did not match object lifetime");
+        BM_ASSERT(!e || e->id == i, "Object pool handle resolved to the wrong object");
+    }
+
+    uint32_t live = 0;
+    for (entity *e : pool)
+    {
+        BM_ASSERT(e->id % 3 != 0, "Destroyed object found while iterating the pool");
+        ++live;
+    }
+
+    BM_ASSERT(live == pool.Count(), "Object pool iteration skipped live objects");
+
+    // Reusing a slot must invalidate old handles to it.
+    pool.Create(-1, 0.0f);
+    BM_ASSERT(pool.Get(handles[0]) == nullptr, "Stale object pool handle resolved after slot reuse");
+
+    // Chunks must fit the chunk allocator's free list link even when T is smaller.
+    struct small_pair
+    {
+        int a, b;
+    };
+
+    object_pool<small_pair, allocator_interface> pairs(parentAllocator, 64);
+    std::vector<small_pair *> created;
+    for (int i = 0; i < 500; ++i)
+    {
+        small_pair *pair = pairs.Create(small_pair{ i, -i });
+        BM_ASSERT(((uintptr_t)pair % alignof(small_pair)) == 0, "Object pool returned a misaligned object");
+        created.push_back(pair);
+    }
+
+    for (int i = 0; i < 500; i += 2)
+    {
+        pairs.Destroy(created[i]);
+    }
+
+    for (int i = 1; i < 500; i += 2)
+    {
+        BM_ASSERT(created[i]->a == i && created[i]->b == -i, "Object pool free list overwrote a live object");
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void LinearAllocatorTests(mem_interface *mem)
+{
+    printf("LinearAllocatorTests: ");
+
+    linear_allocator<mem_interface> allocator(mem, Megabytes(64));
+
+    for (int frame = 0; frame < 100; ++frame)
+    {
+        size_t frameMarker = allocator.GetMarker();
+
+        for (int i = 0; i < 1000; ++i)
+        {
+            size_t size = (rand() % Kilobytes(4)) + 1;
+            uint32_t alignment = 1u << (rand() % 7);
+            void *ptr = allocator.ALLOC(size, alignment);
+            BM_ASSERT(GetAlignment(ptr) >= alignment, "Linear allocation is not aligned");
+            memset(ptr, 0xFA, size);
+        }
+
+        // Only the latest allocation can grow in place.
+        void *latest = allocator.ALLOC(64, 16);
+        BM_ASSERT(allocator.REALLOC(latest, Kilobytes(64)) == latest, "Latest linear allocation did not grow in place");
+        memset(latest, 0xFA, Kilobytes(64));
+
+        allocator.FreeToMarker(frameMarker);
+        BM_ASSERT(allocator.GetMarker() == frameMarker, "FreeToMarker did not restore the marker");
+    }
+
+    // The reservation is only page aligned, larger alignments must still hold.
+    allocator.ALLOC(1, 1);
+    void *wide = allocator.ALLOC(16, Kilobytes(64));
+    BM_ASSERT(GetAlignment(wide) >= Kilobytes(64), "Linear allocation above page alignment is not aligned");
+
+    allocator.Reset();
+    BM_ASSERT(allocator.GetMarker() == 0, "Reset did not empty the allocator");
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void BestFitResetTests(mem_interface *mem)
+{
+    printf("BestFitResetTests: ");
+
+    best_fit_allocator<mem_interface> allocator(mem, Gigabytes(1));
+
+    for (int job = 0; job < 20; ++job)
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            size_t size = (rand() % Kilobytes(64)) + 1;
+            void *ptr = allocator.ALLOC(size, 16);
+            memset(ptr, 0xFA, size);
+        }
+
+        // Alternate between keeping everything committed and trimming back to 1MB.
+        allocator.Reset(job % 2 ? Megabytes(1) : SIZE_MAX);
+        allocator.DetectCorruption();
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void BestFitPurgeTests(mem_interface *mem)
+{
+    printf("BestFitPurgeTests: ");
+
+    // Commit and purge in 2MB hugepage sized granules.
+    best_fit_allocator<mem_interface> allocator(mem, Gigabytes(1), Megabytes(2));
+
+    std::vector<void *> entries;
+    for (int i = 0; i < 4000; ++i)
+    {
+        size_t size = (rand() % Kilobytes(40)) + 1;
+        void *ptr = allocator.ALLOC(size, 16);
+        memset(ptr, 0xFA, size);
+        entries.push_back(ptr);
+    }
+
+    // Free a large run in the middle so whole hugepages become empty.
+    for (size_t i = 1000; i < 3000; ++i)
+    {
+        allocator.FREE(entries[i]);
+    }
+
+    best_fit_hugepage_stats stats;
+    allocator.GetHugePageStats(&stats);
+    BM_ASSERT(stats.empty > 0, "Expected empty hugepages");
+
+    BM_ASSERT(allocator.Purge() == stats.empty * Megabytes(2), "Purge did not decommit every empty hugepage");
+    allocator.GetHugePageStats(&stats);
+    BM_ASSERT(stats.empty == 0 && stats.purged > 0, "Purge left empty hugepages committed");
+
+    // Allocations that land on purged hugepages must commit them again.
+    for (size_t i = 1000; i < 3000; ++i)
+    {
+        size_t size = (rand() % Kilobytes(40)) + 1;
+        entries[i] = allocator.ALLOC(size, 16);
+        memset(entries[i], 0xFB, size);
+    }
+
+    allocator.DetectCorruption();
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void BestFitPlacementTests(mem_interface *mem)
+{
+    printf("BestFitPlacementTests: ");
+
+    best_fit_allocator<mem_interface> allocator(mem, Gigabytes(1), Megabytes(2));
+
+    // Fill the first hugepage exactly, so every later block starts on a hugepage boundary.
+    allocator.ALLOC(Kilobytes(64), 16);
+    allocator.ALLOC(Megabytes(2) - Kilobytes(64) - 32, 16);
+
+    // The second hugepage is emptied below, the third keeps a small allocation and a long
+    // free tail behind it.
+    void *emptied = allocator.ALLOC(Megabytes(2) - 16, 16);
+    uint8_t *partial = (uint8_t *)allocator.ALLOC(Kilobytes(64), 16);
+    allocator.FREE(allocator.ALLOC(Megabytes(2), 16));
+    allocator.FREE(emptied);
+
+    // The free block in the empty hugepage is the tighter fit, the partial hugepage still wins.
+    uint8_t *ptr = (uint8_t *)allocator.ALLOC(Kilobytes(128), 16);
+    BM_ASSERT(ptr > partial && ptr < partial + Megabytes(2), "Allocation went to an empty hugepage before the partial one was full");
+
+    best_fit_hugepage_stats stats;
+    allocator.GetHugePageStats(&stats);
+    BM_ASSERT(stats.empty >= 1, "The emptied hugepage was used");
+
+    allocator.DetectCorruption();
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void BestFitStatsTests(mem_interface *mem)
+{
+    printf("BestFitStatsTests: ");
+
+    best_fit_allocator<mem_interface> allocator(mem, Gigabytes(1));
+
+    std::vector<void *> entries;
+    for (int i = 0; i < 1000; ++i)
+    {
+        entries.push_back(allocator.ALLOC(Kilobytes(1), 16));
+    }
+
+    best_fit_stats stats;
+    allocator.GetStats(&stats);
+    // Blocks can be a little larger than asked for when a leftover is too small to split off.
+    BM_ASSERT(stats.allocated_blocks == 1000 && stats.allocated_bytes >= 1000 * Kilobytes(1), "Allocated totals are wrong");
+    BM_ASSERT(stats.allocated_bytes + stats.free_bytes + stats.header_bytes == stats.committed, "Committed memory is not fully accounted for");
+
+    size_t peak = stats.allocated_bytes;
+
+    // Free every other block, none of them can coalesce.
+    for (size_t i = 0; i < entries.size(); i += 2)
+    {
+        allocator.FREE(entries[i]);
+    }
+
+    allocator.GetStats(&stats);
+    BM_ASSERT(stats.allocated_blocks == 500 && stats.free_blocks >= 500, "Free blocks were not counted");
+    BM_ASSERT(stats.peak_allocated_bytes == peak, "Peak was not kept");
+    BM_ASSERT(stats.external_fragmentation > 0.5, "Scattered free blocks should read as fragmented");
+    allocator.DetectCorruption();
+
+    for (size_t i = 1; i < entries.size(); i += 2)
+    {
+        allocator.FREE(entries[i]);
+    }
+
+    allocator.GetStats(&stats);
+    BM_ASSERT(stats.allocated_blocks == 0 && stats.free_blocks == 1, "Freed blocks did not coalesce");
+    BM_ASSERT(stats.largest_free_block == stats.free_bytes && stats.external_fragmentation == 0.0, "A single free block is not fragmented");
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void PreCommitterTests(mem_interface *mem)
+{
+    printf("PreCommitterTests: ");
+
+    using heap_t = best_fit_allocator<mem_interface>;
+
+    {
+        heap_t heap(mem, Gigabytes(1));
+        allocator_spin_lock<heap_t> allocator(&heap);
+
+        // Without a thread, the headroom is only topped up by RunOnce.
+        precommitter<heap_t> manual(&allocator, Megabytes(16), 0);
+        BM_ASSERT(manual.RunOnce(), "Headroom was already full");
+        BM_ASSERT(!manual.RunOnce(), "Headroom was not filled");
+
+        void *ptr = allocator.ALLOC(Megabytes(8), 16);
+        memset(ptr, 0xFA, Megabytes(8));
+        BM_ASSERT(manual.RunOnce(), "Growing into the headroom did not leave room to top up");
+
+        heap.DetectCorruption();
+    }
+
+    {
+        heap_t heap(mem, Gigabytes(1));
+        allocator_spin_lock<heap_t> allocator(&heap);
+
+        // Resets decommit memory the background thread may be faulting in at the same time.
+        precommitter<heap_t> background(&allocator, Megabytes(64), 10);
+
+        for (int job = 0; job < 50; ++job)
+        {
+            for (int i = 0; i < 200; ++i)
+            {
+                size_t size = (rand() % Kilobytes(256)) + 1;
+                void *ptr = allocator.ALLOC(size, 16);
+                memset(ptr, 0xFA, size);
+            }
+
+            allocator.Lock();
+            heap.DetectCorruption();
+            heap.Reset(job % 2 ? Megabytes(1) : SIZE_MAX);
+            allocator.Unlock();
+
+            if (job % 10 == 0)
+            {
+                allocator.Lock();
+                heap.Purge();
+                allocator.Unlock();
+            }
+        }
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void NumaHeapSetTests(mem_interface *mem)
+{
+    printf("NumaHeapSetTests: ");
+
+    using node_mem_t = numa_memory_interface<mem_interface>;
+    using heap_t = allocator_spin_lock<best_fit_allocator<node_mem_t>>;
+
+    uint32_t nodeCount = NumaNodeCount() < 2 ? 2 : (NumaNodeCount() > 8 ? 8 : NumaNodeCount());
+    std::vector<node_mem_t *> nodeMemory;
+    std::vector<best_fit_allocator<node_mem_t> *> heaps;
+    std::vector<heap_t *> lockedHeaps;
+    for (uint32_t node = 0; node < nodeCount; ++node)
+    {
+        nodeMemory.push_back(new node_mem_t(mem, node));
+        heaps.push_back(new best_fit_allocator<node_mem_t>(nodeMemory.back(), Megabytes(256)));
+        lockedHeaps.push_back(new heap_t(heaps.back()));
+    }
+
+    numa_heap_set<heap_t> allocator(lockedHeaps.data(), nodeCount);
+
+    std::vector<void *> entries;
+    for (int i = 0; i < 5000; ++i)
+    {
+        size_t size = (rand() % Kilobytes(4)) + 1;
+        void *ptr = allocator.ALLOC(size, 16);
+        BM_ASSERT(allocator.Owns(ptr), "Allocation is not owned by any node heap");
+        memset(ptr, 0xFA, size);
+        entries.push_back(ptr);
+    }
+
+    for (void *ptr : entries)
+    {
+        allocator.FREE(ptr);
+    }
+
+    for (uint32_t node = 0; node < nodeCount; ++node)
+    {
+        heaps[node]->DetectCorruption();
+        delete lockedHeaps[node];
+        delete heaps[node];
+        delete nodeMemory[node];
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void DoubleStackAllocatorTests(mem_interface *mem)
+{
+    printf("DoubleStackAllocatorTests: ");
+
+    double_stack_allocator<mem_interface> stack(mem, Megabytes(64));
+    double_stack_bottom<mem_interface> persistent(&stack);
+    double_stack_top<mem_interface> scratch(&stack);
+
+    std::vector<uint8_t *> kept;
+    for (int level = 0; level < 50; ++level)
+    {
+        size_t scratchMarker = stack.GetTopMarker();
+
+        for (int i = 0; i < 100; ++i)
+        {
+            uint8_t *temp = (uint8_t *)scratch.ALLOC(Kilobytes(4), 16);
+            memset(temp, 0xCD, Kilobytes(4));
+
+            if (i % 10 == 0)
+            {
+                uint8_t *data = (uint8_t *)persistent.ALLOC(256, 16);
+                memset(data, 0xFA, 256);
+                kept.push_back(data);
+            }
+        }
+
+        stack.FreeToTopMarker(scratchMarker);
+    }
+
+    for (uint8_t *data : kept)
+    {
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            BM_ASSERT(data[byte] == 0xFA, "Persistent allocation was overwritten by scratch allocations");
+        }
+    }
+
+    stack.Reset();
+    BM_ASSERT(stack.GetFreeSpace() >= Megabytes(64), "Reset did not empty both stacks");
+
+    {
+        // Reserving from a parent allocator gives a base that is only 16 byte aligned.
+        using parent_t = best_fit_allocator<mem_interface>;
+        parent_t parent(mem, Megabytes(16));
+        void *offset = parent.ALLOC(24, 16);
+
+        allocator_mem_interface<parent_t> parentMem(&parent, 16);
+        double_stack_allocator<allocator_mem_interface<parent_t>> offsetStack(&parentMem, Megabytes(1));
+        double_stack_bottom<allocator_mem_interface<parent_t>> low(&offsetStack);
+        double_stack_top<allocator_mem_interface<parent_t>> high(&offsetStack);
+
+        for (size_t alignment = 32; alignment <= Kilobytes(64); alignment *= 2)
+        {
+            low.ALLOC(1, 1);
+            high.ALLOC(1, 1);
+
+            void *bottomPtr = low.ALLOC(16, (uint32_t)alignment);
+            void *topPtr = high.ALLOC(16, (uint32_t)alignment);
+            BM_ASSERT((size_t)bottomPtr % alignment == 0, "Bottom allocation is not aligned");
+            BM_ASSERT((size_t)topPtr % alignment == 0, "Top allocation is not aligned");
+        }
+
+        parent.FREE(offset);
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void BuddyAllocatorTests(mem_interface *mem)
+{
+    printf("BuddyAllocatorTests: ");
+
+    {
+        buddy_allocator<mem_interface> allocator(mem, Megabytes(64), 64);
+
+        std::vector<void *> entries;
+        for (int i = 0; i < 5000; ++i)
+        {
+            size_t size = (rand() % Kilobytes(16)) + 1;
+            void *ptr = allocator.ALLOC(size, 16);
+            BM_ASSERT(ptr, "Buddy allocator ran out of memory");
+            BM_ASSERT(allocator.GetBlockSize(ptr) >= size, "Buddy block is smaller than the request");
+            memset(ptr, 0xFA, size);
+            entries.push_back(ptr);
+        }
+
+        for (void *ptr : entries)
+        {
+            allocator.FREE(ptr);
+        }
+
+        // Everything should have coalesced back into a single block.
+        void *whole = allocator.ALLOC(Megabytes(64), 16);
+        BM_ASSERT(whole, "Buddy blocks did not coalesce");
+        allocator.FREE(whole);
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface, typename allocator_interface>
+static void CAllocTests(mem_interface *mem, allocator_interface *parentAllocator)
+{
+    printf("CAllocTests: ");
+
+    auto isZero = [](void *ptr, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            if (((uint8_t *)ptr)[i] != 0) return false;
+        }
+
+        return true;
+    };
+
+    {
+        // Dirty the heap, free half of it and purge, then zeroed allocations land on
+        // dirty, purged and never touched memory alike.
+        best_fit_allocator<mem_interface> allocator(mem, Gigabytes(1), Megabytes(2));
+
+        std::vector<void *> entries;
+        for (int i = 0; i < 2000; ++i)
+        {
+            size_t size = (rand() % Kilobytes(40)) + 1;
+            void *ptr = allocator.ALLOC(size, 16);
+            memset(ptr, 0xFA, size);
+            entries.push_back(ptr);
+        }
+
+        for (size_t i = 0; i < entries.size(); i += 2)
+        {
+            allocator.FREE(entries[i]);
+        }
+
+        allocator.Purge();
+
+        for (size_t i = 0; i < entries.size(); i += 2)
+        {
+            size_t size = (rand() % Kilobytes(80)) + 1;
+            entries[i] = allocator.CALLOC(size, 16);
+            BM_ASSERT(isZero(entries[i], size), "best_fit CALLOC returned dirty memory");
+            memset(entries[i], 0xFB, size);
+        }
+
+        allocator.Reset(Megabytes(4));
+        void *ptr = allocator.CALLOC(Megabytes(8), 16);
+        BM_ASSERT(isZero(ptr, Megabytes(8)), "best_fit CALLOC returned dirty memory after Reset");
+
+        allocator.DetectCorruption();
+    }
+
+    {
+        linear_allocator<mem_interface> allocator(mem, Megabytes(64));
+        void *ptr = allocator.ALLOC(Kilobytes(100), 16);
+        memset(ptr, 0xFA, Kilobytes(100));
+
+        allocator.Reset();
+        ptr = allocator.CALLOC(Kilobytes(200), 16);
+        BM_ASSERT(isZero(ptr, Kilobytes(200)), "linear CALLOC returned dirty memory");
+    }
+
+    {
+        // The bottom stack grows into memory the top stack used.
+        double_stack_allocator<mem_interface> stack(mem, Megabytes(1));
+        void *top = stack.AllocTop(Kilobytes(512), 16);
+        memset(top, 0xFA, Kilobytes(512));
+        stack.FreeTop(top);
+
+        void *bottom = stack.CAllocBottom(Kilobytes(900), 16);
+        BM_ASSERT(isZero(bottom, Kilobytes(900)), "double stack CALLOC returned dirty memory");
+    }
+
+    {
+        // Reused blocks are cleared, blocks on pages the arena never touched come back from the OS.
+        buddy_allocator<mem_interface> allocator(mem, Megabytes(16), 64);
+
+        std::vector<void *> entries;
+        for (int i = 0; i < 500; ++i)
+        {
+            size_t size = (rand() % Kilobytes(16)) + 1;
+            void *ptr = allocator.ALLOC(size, 16);
+            memset(ptr, 0xFA, size);
+            entries.push_back(ptr);
+        }
+
+        for (size_t i = 0; i < entries.size(); i += 2)
+        {
+            allocator.FREE(entries[i]);
+        }
+
+        for (int i = 0; i < 500; ++i)
+        {
+            size_t size = (rand() % Kilobytes(24)) + 1;
+            void *ptr = allocator.CALLOC(size, 16);
+            BM_ASSERT(isZero(ptr, size), "Buddy CALLOC returned dirty memory");
+            memset(ptr, 0xFB, size);
+        }
+    }
+
+    {
+        // A child reserving from a parent gets dirty memory back, Commit has to clear it.
+        using parent_t = best_fit_allocator<mem_interface>;
+        parent_t parent(mem, Megabytes(16));
+        void *dirty = parent.ALLOC(Megabytes(1), 16);
+        memset(dirty, 0xFA, Megabytes(1));
+        parent.FREE(dirty);
+
+        allocator_mem_interface<parent_t> parentMem(&parent, 16);
+        {
+            linear_allocator<allocator_mem_interface<parent_t>> child(&parentMem, Megabytes(1));
+            void *ptr = child.CALLOC(Kilobytes(512), 16);
+            BM_ASSERT(isZero(ptr, Kilobytes(512)), "CALLOC over allocator_mem_interface returned dirty memory");
+        }
+
+        {
+            // The two ends meet inside one 16 byte granule, committing the top must not clear the bottom.
+            double_stack_allocator<allocator_mem_interface<parent_t>> stack(&parentMem, Kilobytes(4));
+            uint8_t *low = (uint8_t *)stack.AllocBottom(Kilobytes(2) + 8, 1);
+            memset(low, 0xFA, Kilobytes(2) + 8);
+            stack.AllocTop(Kilobytes(2) - 8, 1);
+            BM_ASSERT(low[Kilobytes(2) + 7] == 0xFA, "Committing the top stack cleared the bottom stack");
+        }
+    }
+
+    {
+        fixed_size_allocator<allocator_interface> allocator(parentAllocator, 64, 48, 16);
+        void *ptr = allocator.ALLOC(48, 16);
+        memset(ptr, 0xFA, 48);
+        allocator.FREE(ptr);
+
+        ptr = allocator.CALLOC(48, 16);
+        BM_ASSERT(isZero(ptr, 48), "fixed size CALLOC returned dirty memory");
+        allocator.FREE(ptr);
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void LatencyHistogramTests(mem_interface *mem)
+{
+    printf("LatencyHistogramTests: ");
+
+    {
+        latency_histogram *histogram = new latency_histogram;
+        histogram->Reset();
+
+        for (uint64_t value = 1; value <= 1000; ++value)
+        {
+            histogram->Record(value);
+        }
+
+        BM_ASSERT(histogram->m_count == 1000 && histogram->m_max == 1000, "Histogram lost values");
+
+        // Each bucket is at most 1/16th wide.
+        uint64_t p50 = histogram->Percentile(50.0);
+        uint64_t p99 = histogram->Percentile(99.0);
+        BM_ASSERT(p50 >= 500 && p50 <= 500 + 500 / 16, "Histogram p50 is off");
+        BM_ASSERT(p99 >= 990 && p99 <= 990 + 990 / 16, "Histogram p99 is off");
+        BM_ASSERT(histogram->Percentile(100.0) == 1000, "Histogram max is off");
+
+        for (uint32_t i = 0; i < latency_histogram::bucket_count; ++i)
+        {
+            BM_ASSERT(latency_histogram::BucketIndex(latency_histogram::BucketHighest(i)) == i, "Histogram bucket bounds disagree");
+        }
+
+        delete histogram;
+    }
+
+    // The heap decommits through the recorder when it is destroyed, so it has to outlive it.
+    latency_recorder<4> *recorder = new latency_recorder<4>();
+    {
+        // More threads than the recorder has slots, so the shared slot is used too.
+        timed_memory_interface<mem_interface, 4> timedMem(mem, recorder);
+        best_fit_allocator<timed_memory_interface<mem_interface, 4>> bestFit(&timedMem, Megabytes(256));
+        allocator_spin_lock<best_fit_allocator<timed_memory_interface<mem_interface, 4>>> locked(&bestFit);
+        timed_allocator<allocator_spin_lock<best_fit_allocator<timed_memory_interface<mem_interface, 4>>>, 4> timed(&locked, recorder);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 6; ++t)
+        {
+            threads.emplace_back([&timed]() {
+                for (int i = 0; i < 1000; ++i)
+                {
+                    void *ptr = timed.ALLOC(Kilobytes(4), 16);
+                    memset(ptr, 0xFA, Kilobytes(4));
+                    timed.FREE(ptr);
+                }
+            });
+        }
+
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        latency_histogram *merged = new latency_histogram;
+        recorder->Merge(LatencyAlloc, merged);
+        BM_ASSERT(merged->m_count == 6000, "Recorder lost allocs");
+        recorder->Merge(LatencyFree, merged);
+        BM_ASSERT(merged->m_count == 6000, "Recorder lost frees");
+        recorder->Merge(LatencyCommit, merged);
+        BM_ASSERT(merged->m_count > 0, "Recorder missed the commit path");
+
+        delete merged;
+    }
+
+    delete recorder;
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void SamplingAllocatorTests(mem_interface *mem)
+{
+    printf("SamplingAllocatorTests: ");
+
+    {
+        using sampled_t = sampling_allocator<best_fit_allocator<mem_interface>, 1024>;
+        best_fit_allocator<mem_interface> bestFit(mem, Gigabytes(1));
+        sampled_t *sampled = new sampled_t(&bestFit, Kilobytes(64));
+
+        // About 16MB in, so about 250 samples.
+        std::vector<void *> entries;
+        for (int i = 0; i < 4000; ++i)
+        {
+            size_t size = (rand() % Kilobytes(8)) + 1;
+            void *ptr = sampled->ALLOC(size, 16);
+            memset(ptr, 0xFA, size);
+            entries.push_back(ptr);
+        }
+
+        BM_ASSERT(sampled->m_sampleCount > 100 && sampled->m_sampleCount < 1000, "Sample count is far from the sample rate");
+        BM_ASSERT(sampled->WriteHeapProfile("heap.prof"), "Failed to write the heap profile");
+
+        for (size_t i = 0; i < entries.size(); i += 2)
+        {
+            sampled->FREE(entries[i]);
+        }
+
+        for (size_t i = 1; i < entries.size(); i += 2)
+        {
+            sampled->FREE(entries[i]);
+        }
+
+        BM_ASSERT(sampled->m_sampleCount == 0, "Freed blocks are still sampled");
+        delete sampled;
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void CallsiteStatsTests(mem_interface *mem)
+{
+    printf("CallsiteStatsTests: ");
+
+    {
+        using stats_t = callsite_stats_allocator<best_fit_allocator<mem_interface>, 64>;
+        best_fit_allocator<mem_interface> bestFit(mem, Megabytes(256));
+        stats_t *stats = new stats_t(&bestFit);
+
+        std::vector<void *> small;
+        std::vector<void *> large;
+        for (int i = 0; i < 100; ++i)
+        {
+            small.push_back(stats->ALLOC(48, 16));
+            large.push_back(stats->ALLOC(Kilobytes(4), 16));
+            memset(small.back(), 0xFA, 48);
+            memset(large.back(), 0xFA, Kilobytes(4));
+        }
+
+        // The 16 byte prefix keeps the caller's alignment.
+        void *aligned = stats->ALLOC(100, 16);
+        BM_ASSERT(((size_t)aligned & 15) == 0, "Callsite stats broke the alignment");
+        void *grown = stats->REALLOC(aligned, 200);
+        if (grown)
+        {
+            aligned = grown;
+        }
+        stats->FREE(aligned);
+
+        for (void *ptr : small)
+        {
+            stats->FREE(ptr);
+        }
+
+        uint32_t callsites = 0;
+        for (uint32_t i = 0; i <= 64; ++i)
+        {
+            const typename stats_t::callsite &entry = stats->m_callsites[i];
+            if (!entry.allocs)
+            {
+                continue;
+            }
+
+            ++callsites;
+            if (entry.bytes == 100 * 48)
+            {
+                BM_ASSERT(entry.frees == 100 && entry.liveBytes == 0, "Frees weren't charged to the allocating callsite");
+                BM_ASSERT(entry.sizes[6] == 100, "48 byte blocks should land in the 64 byte size class");
+            }
+            else if (entry.bytes == 100 * Kilobytes(4))
+            {
+                BM_ASSERT(entry.frees == 0 && entry.liveBytes == 100 * Kilobytes(4), "Live bytes are off");
+            }
+        }
+
+        BM_ASSERT(callsites == 3, "Expected one entry per callsite");
+
+        // Every live block in the layout dump is named after the line that allocated it.
+        FILE *layout = tmpfile();
+        BM_ASSERT(bestFit.DumpLayout(layout, HeapLayoutCsv, stats_t::LayoutCallsite, stats), "Failed to write the heap layout");
+        rewind(layout);
+
+        char row[1024];
+        uint32_t named = 0;
+        while (fgets(row, sizeof(row), layout))
+        {
+            if (strstr(row, ",0,") && strstr(row, "test.cpp:"))
+            {
+                ++named;
+            }
+        }
+
+        fclose(layout);
+        BM_ASSERT(named == 100, "Expected the live 4KB blocks in the layout");
+
+        for (void *ptr : large)
+        {
+            stats->FREE(ptr);
+        }
+
+        // Copies of one file name, as two translation units can pass, print as one callsite.
+        static const char firstCopy[] = "shared_header.h";
+        static const char secondCopy[] = "shared_header.h";
+        stats->FREE(stats->AllocInternal(32, 16, 7, firstCopy));
+        stats->FREE(stats->AllocInternal(32, 16, 7, secondCopy));
+
+        FILE *report = tmpfile();
+        stats->Print(report, 64);
+        rewind(report);
+
+        uint32_t rows = 0;
+        while (fgets(row, sizeof(row), report))
+        {
+            if (strstr(row, "shared_header.h:7"))
+            {
+                unsigned long long allocs = 0;
+                sscanf(row + strlen("shared_header.h:7"), "%llu", &allocs);
+                BM_ASSERT(allocs == 2, "Callsites with the same name were not merged");
+                ++rows;
+            }
+        }
+
+        fclose(report);
+        BM_ASSERT(rows == 1, "Expected one row per callsite name");
+
+        delete stats;
+    }
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface, typename allocator_interface>
+static void CombinatorTests(mem_interface *mem, allocator_interface *parentAllocator)
+{
+    printf("CombinatorTests: ");
+
+    using pool_t = fixed_size_allocator<allocator_interface>;
+    pool_t pool16(parentAllocator, 256, 16, 16);
+    pool_t pool32(parentAllocator, 256, 32, 16);
+    pool_t pool48(parentAllocator, 256, 48, 16);
+    pool_t pool64(parentAllocator, 256, 64, 16);
+    pool_t *pools[] = { &pool16, &pool32, &pool48, &pool64 };
+
+    using small_t = bucketizer<pool_t, 0, 64, 16>;
+    small_t small(pools);
+
+    // Large requests go to a small buddy arena first, then overflow into a best fit heap.
+    buddy_allocator<mem_interface> buddy(mem, Megabytes(4), 4096);
+    best_fit_allocator<mem_interface> bestFit(mem, Gigabytes(1));
+
+    using large_t = fallback_allocator<buddy_allocator<mem_interface>, best_fit_allocator<mem_interface>>;
+    large_t large(&buddy, &bestFit);
+
+    segregator<64, small_t, large_t> allocator(&small, &large);
+
+    std::vector<void *> entries;
+    for (int i = 0; i < 5000; ++i)
+    {
+        size_t size = (i % 3) ? (rand() % 64) + 1 : (rand() % Kilobytes(64)) + 65;
+        void *ptr = allocator.ALLOC(size, 16);
+        BM_ASSERT(ptr, "Combined allocator failed to allocate");
+        BM_ASSERT(allocator.Owns(ptr), "Combined allocator does not own its own allocation");
+        memset(ptr, 0xFA, size);
+        entries.push_back(ptr);
+    }
+
+    for (void *ptr : entries)
+    {
+        allocator.FREE(ptr);
+    }
+
+    bestFit.DetectCorruption();
+
+    printf("SUCCESS\n");
+}
+
+template <typename mem_interface>
+static void PageMapTests(mem_interface *mem)
+{
+    printf("PageMapTests: ");
+
+    using map_t = page_map<mem_interface>;
+    using mapped_mem_t = page_map_memory_interface<mem_interface, map_t>;
+    map_t pageMap(mem);
+
+    // best_fit doesn't expose block sizes, the thunk reports the largest size the test asks for.
+    page_map_owner bestFitOwner = MakePageMapOwner<best_fit_allocator<mapped_mem_t>>(nullptr, 0, [](void *, void *) -> size_t { return 1024; });
+    mapped_mem_t bestFitMem(mem, &pageMap, &bestFitOwner);
+    best_fit_allocator<mapped_mem_t> bestFit(&bestFitMem, Gigabytes(1));
+    bestFitOwner.allocator = &bestFit;
+
+    page_map_owner linearOwner = MakePageMapOwner<linear_allocator<mapped_mem_t>>(nullptr, 64);
+    mapped_mem_t linearMem(mem, &pageMap, &linearOwner);
+    linear_allocator<mapped_mem_t> linear(&linearMem, Megabytes(16));
+    linearOwner.allocator = &linear;
+
+    std::vector<void *> entries;
+    for (int i = 0; i < 1000; ++i)
+    {
+        void *ptr = (i & 1) ? bestFit.ALLOC((rand() % 1024) + 1, 16) : linear.ALLOC(64, 16);
+        BM_ASSERT(pageMap.Lookup(ptr) == ((i & 1) ? &bestFitOwner : &linearOwner), "Page map returned the wrong owner");
+        entries.push_back(ptr);
+    }
+
+    BM_ASSERT(pageMap.GetUsableSize(entries[0]) == 64, "Page map returned the wrong size class");
+    BM_ASSERT(pageMap.GetUsableSize(entries[1]) == 1024, "Page map did not ask the owner for the usable size");
+    BM_ASSERT(pageMap.Lookup(&entries) == nullptr, "Page map found an owner for unregistered memory");
+
+    for (void *ptr : entries)
+    {
+        PAGE_MAP_FREE(&pageMap, ptr);
+    }
+
+    bestFit.DetectCorruption();
+
+    printf("SUCCESS\n");
+}
+
 LONG WINAPI CrashHandler(EXCEPTION_POINTERS *exceptionInfo)
 {
     typedef ULONG (*RtlNtStatusToDosError_t)(NTSTATUS);
@@ -253,6 +1357,10 @@ void SlowRandomAllocTests(allocator_t *allocator)
 
     std::map<void *, size_t> allocations;
 
+    // Per op latencies alongside the single worst op.
+    latency_recorder<> *latencies = new latency_recorder<>();
+    timed_allocator<allocator_t> timedAllocator(allocator, latencies);
+
     uint64_t maxTimedOp = 0;
     int timedOpIndex = -1;
 
@@ -266,7 +1374,7 @@ void SlowRandomAllocTests(allocator_t *allocator)
         if (val < 6)
         {
             size_t size = (rand() % Megabytes(512)) + 1; // atleast one byte
-            void *ptr = allocator->ALLOC(size, 1);
+            void *ptr = timedAllocator.ALLOC(size, 1);
             memset(ptr, 0xFA, size);
 
             allocations[ptr] = size;
@@ -285,7 +1393,7 @@ void SlowRandomAllocTests(allocator_t *allocator)
 
             size_t oldSize = it->second;
             size_t newSize = it->second + (rand() % Megabytes(10));
-            void *ptr = allocator->REALLOC(it->first, newSize);
+            void *ptr = timedAllocator.REALLOC(it->first, newSize);
             (void)ptr;
             (void)oldSize;
 
@@ -326,7 +1434,7 @@ void SlowRandomAllocTests(allocator_t *allocator)
             }
 #endif
                         
-            allocator->FREE(it->first);
+            timedAllocator.FREE(it->first);
             allocations.erase(it);
         }
 
@@ -340,12 +1448,14 @@ void SlowRandomAllocTests(allocator_t *allocator)
 
     for (auto it = allocations.begin(); it != allocations.end(); ++it)
     {
-        allocator->FREE(it->first);
+        timedAllocator.FREE(it->first);
     }
 
     uint64_t total = __rdtsc() - begin;
     printf("SUCCESS [Elapsed=%llu]\n", total);
     printf("Max Op [Elapsed=%llu, Index=%i]\n", maxTimedOp, timedOpIndex);
+    PrintLatencyReport(latencies, stdout);
+    delete latencies;
 }
 
 int main()
@@ -358,6 +1468,19 @@ int main()
 
     win32_virtual_memory_interface mem;
     // MemoryInterfaceTests(&mem);
+    AlignedReserveTests(&mem);
+    LinearAllocatorTests(&mem);
+    BestFitResetTests(&mem);
+    BestFitPurgeTests(&mem);
+    BestFitPlacementTests(&mem);
+    BestFitStatsTests(&mem);
+    PreCommitterTests(&mem);
+    NumaHeapSetTests(&mem);
+    DoubleStackAllocatorTests(&mem);
+    BuddyAllocatorTests(&mem);
+    LatencyHistogramTests(&mem);
+    SamplingAllocatorTests(&mem);
+    CallsiteStatsTests(&mem);
 
     // Reserve 8 gigabytes
     best_fit_allocator<win32_virtual_memory_interface> bestFit(&mem, Gigabytes(8));
@@ -366,6 +1489,15 @@ int main()
     SlowRandomAllocTests(&finalAlloc);
 
     FixedAllocatorTests(&finalAlloc);
+    BitmapFixedAllocatorTests(&finalAlloc);
+    MagazineAllocatorTests(&finalAlloc);
+    ObjectPoolTests(&finalAlloc);
+    CombinatorTests(&mem, &finalAlloc);
+    CAllocTests(&mem, &finalAlloc);
+    PageMapTests(&mem);
+
+    TimedBlockReport(stdout);
+    TimedBlockWriteChromeTrace("timed_blocks.json");
 
     fclose(testLog);
     testLog = nullptr;
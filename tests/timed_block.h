@@ -1,12 +1,325 @@
+#pragma once
+
+#include "latency_histogram.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Scoped hot path profiler. BM_TIMED_BLOCK("name") times the rest of the enclosing scope.
+// Blocks nest: a block's exclusive time is its inclusive time minus that of the blocks
+// timed inside it. Each thread records into its own buffers without locks or atomics,
+// and the buffers are kept after the thread exits, so they can be reported afterwards.
+//
+// Include this before the allocator headers to turn their BM_TIMED_BLOCK hooks on, and
+// define BM_TIMED_BLOCK_IMPLEMENTATION in one file.
+// TimedBlockReport prints call counts, inclusive and exclusive time per label.
+// TimedBlockWriteChromeTrace writes every block as an event for chrome://tracing or Perfetto.
+// Both read other threads' buffers unsynchronized, call them once those threads are done.
+//
+// Labels are grouped by pointer within a thread and by string across threads, so pass
+// string literals.
+
+// Events kept per thread for the Chrome trace, later blocks are dropped. 0 turns it off.
+#if !defined(BM_TIMED_BLOCK_EVENTS)
+#define BM_TIMED_BLOCK_EVENTS (1 << 16)
+#endif
+
+// Distinct labels per thread, a power of 2.
+#if !defined(BM_TIMED_BLOCK_LABELS)
+#define BM_TIMED_BLOCK_LABELS 256
+#endif
+
+#define BM_TIMED_BLOCK_MAX_DEPTH 64
+
+struct timed_block_event
+{
+    const char *label;
+    uint64_t begin;
+    uint64_t elapsed;
+};
+
+struct timed_block_label
+{
+    const char *label;
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+};
+
+struct timed_block_thread
+{
+    timed_block_thread *next;
+    uint32_t id;
+    uint32_t depth;
+
+    // Time spent in the children of the open block at each depth.
+    uint64_t childTicks[BM_TIMED_BLOCK_MAX_DEPTH + 1];
+
+    timed_block_label labels[BM_TIMED_BLOCK_LABELS];
+
+    timed_block_event *events;
+    uint64_t eventCount;
+    uint64_t droppedEvents;
+    uint64_t droppedLabels;
+};
 
 struct timed_block
 {
-    timed_block(const char *named);
-    timed_block()=delete;
+    timed_block(const char *label);
+    timed_block() = delete;
+    timed_block(const timed_block &) = delete;
     ~timed_block();
+
+    const char *m_label;
+    timed_block_thread *m_thread;
+    uint64_t m_begin;
 };
 
-timed_block::timed_block(const char *named)
+timed_block_thread *TimedBlockRegisterThread();
+void TimedBlockReport(FILE *out);
+bool TimedBlockWriteChromeTrace(const char *path);
+
+// Not thread safe.
+void TimedBlockReset();
+
+#if !defined(BM_TIMED_BLOCK)
+#define BM_TIMED_BLOCK_CONCAT2(a, b) a##b
+#define BM_TIMED_BLOCK_CONCAT(a, b) BM_TIMED_BLOCK_CONCAT2(a, b)
+#define BM_TIMED_BLOCK(name) timed_block BM_TIMED_BLOCK_CONCAT(timedBlock, __LINE__)(name)
+#endif
+
+inline timed_block_thread *TimedBlockThread()
+{
+    static thread_local timed_block_thread *thread = nullptr;
+    if (!thread)
+    {
+        thread = TimedBlockRegisterThread();
+    }
+
+    return thread;
+}
+
+inline timed_block::timed_block(const char *label)
+    : m_label(label),
+      m_thread(TimedBlockThread())
+{
+    uint32_t depth = ++m_thread->depth;
+    if (depth <= BM_TIMED_BLOCK_MAX_DEPTH)
+    {
+        m_thread->childTicks[depth] = 0;
+    }
+
+    m_begin = LatencyNow();
+}
+
+inline timed_block::~timed_block()
+{
+    uint64_t elapsed = LatencyNow() - m_begin;
+
+    uint32_t depth = m_thread->depth--;
+    uint64_t exclusive = elapsed;
+    if (depth <= BM_TIMED_BLOCK_MAX_DEPTH)
+    {
+        uint64_t children = m_thread->childTicks[depth];
+        exclusive = children < elapsed ? elapsed - children : 0;
+        m_thread->childTicks[depth - 1] += elapsed;
+    }
+
+    uint32_t mask = BM_TIMED_BLOCK_LABELS - 1;
+    uint32_t slot = (uint32_t)((uintptr_t)m_label >> 3) & mask;
+    for (uint32_t probe = 0;; ++probe, slot = (slot + 1) & mask)
+    {
+        if (probe == BM_TIMED_BLOCK_LABELS)
+        {
+            ++m_thread->droppedLabels;
+            break;
+        }
+
+        timed_block_label *entry = &m_thread->labels[slot];
+        if (entry->label == m_label || !entry->label)
+        {
+            entry->label = m_label;
+            ++entry->calls;
+            entry->inclusive += elapsed;
+            entry->exclusive += exclusive;
+            break;
+        }
+    }
+
+    if (m_thread->eventCount < BM_TIMED_BLOCK_EVENTS)
+    {
+        m_thread->events[m_thread->eventCount++] = { m_label, m_begin, elapsed };
+    }
+    else
+    {
+        ++m_thread->droppedEvents;
+    }
+}
+
+#if defined(BM_TIMED_BLOCK_IMPLEMENTATION)
+#include "platform.h"
+#include <string.h>
+
+static timed_block_thread *g_timedBlockThreads = nullptr;
+static uint32_t g_timedBlockThreadCount = 0;
+
+timed_block_thread *TimedBlockRegisterThread()
+{
+    timed_block_thread *thread = new timed_block_thread;
+    memset(thread, 0, sizeof(*thread));
+    thread->events = BM_TIMED_BLOCK_EVENTS > 0 ? new timed_block_event[BM_TIMED_BLOCK_EVENTS] : nullptr;
+
+    uint32_t id;
+    do
+    {
+        id = g_timedBlockThreadCount;
+    } while (ICE(&g_timedBlockThreadCount, id + 1, id) != id);
+
+    thread->id = id;
+
+    timed_block_thread *head;
+    do
+    {
+        head = g_timedBlockThreads;
+        thread->next = head;
+    } while (ICEP(&g_timedBlockThreads, thread, head) != head);
+
+    return thread;
+}
+
+void TimedBlockReport(FILE *out)
+{
+    static const uint32_t max_labels = 1024;
+    timed_block_label *totals = new timed_block_label[max_labels];
+    uint32_t labelCount = 0;
+    uint64_t droppedLabels = 0;
+    uint64_t droppedEvents = 0;
+
+    for (timed_block_thread *thread = g_timedBlockThreads; thread; thread = thread->next)
+    {
+        droppedLabels += thread->droppedLabels;
+        droppedEvents += thread->droppedEvents;
+        for (uint32_t i = 0; i < BM_TIMED_BLOCK_LABELS; ++i)
+        {
+            timed_block_label *entry = &thread->labels[i];
+            if (!entry->label)
+            {
+                continue;
+            }
+
+            uint32_t found = 0;
+            while (found < labelCount && strcmp(totals[found].label, entry->label) != 0)
+            {
+                ++found;
+            }
+
+            if (found == labelCount)
+            {
+                if (labelCount == max_labels)
+                {
+                    droppedLabels += entry->calls;
+                    continue;
+                }
+
+                totals[labelCount++] = { entry->label, 0, 0, 0 };
+            }
+
+            totals[found].calls += entry->calls;
+            totals[found].inclusive += entry->inclusive;
+            totals[found].exclusive += entry->exclusive;
+        }
+    }
+
+    // Most exclusive time first.
+    for (uint32_t i = 1; i < labelCount; ++i)
+    {
+        timed_block_label entry = totals[i];
+        uint32_t j = i;
+        while (j > 0 && totals[j - 1].exclusive < entry.exclusive)
+        {
+            totals[j] = totals[j - 1];
+            --j;
+        }
+
+        totals[j] = entry;
+    }
+
+    double ticksPerNanosecond = LatencyTicksPerNanosecond();
+    fprintf(out, "%-32s %12s %14s %14s %12s\n", "block", "calls", "inclusive ms", "exclusive ms", "mean ns");
+    for (uint32_t i = 0; i < labelCount; ++i)
+    {
+        fprintf(out, "%-32s %12llu %14.3f %14.3f %12.0f\n",
+                totals[i].label,
+                (unsigned long long)totals[i].calls,
+                (double)totals[i].inclusive / ticksPerNanosecond / 1e6,
+                (double)totals[i].exclusive / ticksPerNanosecond / 1e6,
+                (double)totals[i].inclusive / ticksPerNanosecond / (double)totals[i].calls);
+    }
+
+    if (droppedLabels)
+    {
+        fprintf(out, "%llu blocks had no room for their label\n", (unsigned long long)droppedLabels);
+    }
+
+    if (droppedEvents && BM_TIMED_BLOCK_EVENTS > 0)
+    {
+        fprintf(out, "%llu blocks are missing from the trace, raise BM_TIMED_BLOCK_EVENTS\n", (unsigned long long)droppedEvents);
+    }
+
+    delete[] totals;
+}
+
+bool TimedBlockWriteChromeTrace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        return false;
+    }
+
+    uint64_t start = UINT64_MAX;
+    for (timed_block_thread *thread = g_timedBlockThreads; thread; thread = thread->next)
+    {
+        for (uint64_t i = 0; i < thread->eventCount; ++i)
+        {
+            if (thread->events[i].begin < start)
+            {
+                start = thread->events[i].begin;
+            }
+        }
+    }
+
+    // Chrome wants microseconds.
+    double ticksPerMicrosecond = LatencyTicksPerNanosecond() * 1e3;
+    bool first = true;
+
+    fputs("{\"traceEvents\":[\n", file);
+    for (timed_block_thread *thread = g_timedBlockThreads; thread; thread = thread->next)
+    {
+        for (uint64_t i = 0; i < thread->eventCount; ++i)
+        {
+            const timed_block_event &event = thread->events[i];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n",
+                    event.label,
+                    thread->id,
+                    (double)(event.begin - start) / ticksPerMicrosecond,
+                    (double)event.elapsed / ticksPerMicrosecond);
+            first = false;
+        }
+    }
+
+    fputs("\n]}\n", file);
+    return fclose(file) == 0;
+}
+
+void TimedBlockReset()
 {
-    
+    for (timed_block_thread *thread = g_timedBlockThreads; thread; thread = thread->next)
+    {
+        memset(thread->labels, 0, sizeof(thread->labels));
+        thread->eventCount = 0;
+        thread->droppedEvents = 0;
+        thread->droppedLabels = 0;
+    }
 }
+#endif
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "memory_interface.h"
+#include "allocator_interface.h"
+#include "latency_histogram.h"
+#include <stdint.h>
+
+// Times every call into the wrapped allocator and records it in a latency_recorder, one
+// histogram per op. CAlloc counts as an alloc. Wrap the allocator under test, and pair it
+// with a timed_memory_interface on the same recorder to see the commit path as well.
+//
+// A = Allocator type.
+template <typename A, uint32_t MaxThreads = 16>
+struct timed_allocator
+{
+    timed_allocator(A *allocator, latency_recorder<MaxThreads> *recorder);
+
+    A *m_allocator;
+    latency_recorder<MaxThreads> *m_recorder;
+
+    DECLARE_ALLOCATOR_INTERFACE_METHODS();
+    bool Owns(void *addr);
+};
+
+// Times Commit and DeCommit. Reserve and Release are only forwarded.
+//
+// MI = Memory interface the calls are forwarded to.
+template <typename MI, uint32_t MaxThreads = 16>
+struct timed_memory_interface
+{
+    timed_memory_interface(MI *memory, latency_recorder<MaxThreads> *recorder);
+
+    MI *m_memory;
+    latency_recorder<MaxThreads> *m_recorder;
+
+    DECLARE_MEMORY_INTERFACE_METHODS();
+};
+
+template <typename A, uint32_t MaxThreads>
+timed_allocator<A, MaxThreads>::timed_allocator(A *allocator, latency_recorder<MaxThreads> *recorder)
+    : m_allocator(allocator),
+      m_recorder(recorder)
+{
+}
+
+template <typename A, uint32_t MaxThreads>
+void *timed_allocator<A, MaxThreads>::AllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    uint64_t begin = LatencyNow();
+    void *result = m_allocator->AllocInternal(size, alignment, line, file);
+    m_recorder->Record(LatencyAlloc, LatencyNow() - begin);
+    return result;
+}
+
+template <typename A, uint32_t MaxThreads>
+void timed_allocator<A, MaxThreads>::FreeInternal(void *addr, int line, const char *file)
+{
+    uint64_t begin = LatencyNow();
+    m_allocator->FreeInternal(addr, line, file);
+    m_recorder->Record(LatencyFree, LatencyNow() - begin);
+}
+
+template <typename A, uint32_t MaxThreads>
+void *timed_allocator<A, MaxThreads>::ReAllocInternal(void *addr, size_t size, int line, const char *file)
+{
+    uint64_t begin = LatencyNow();
+    void *result = m_allocator->ReAllocInternal(addr, size, line, file);
+    m_recorder->Record(LatencyReAlloc, LatencyNow() - begin);
+    return result;
+}
+
+template <typename A, uint32_t MaxThreads>
+void *timed_allocator<A, MaxThreads>::CAllocInternal(size_t size, uint32_t alignment, int line, const char *file)
+{
+    uint64_t begin = LatencyNow();
+    void *result = m_allocator->CAllocInternal(size, alignment, line, file);
+    m_recorder->Record(LatencyAlloc, LatencyNow() - begin);
+    return result;
+}
+
+template <typename A, uint32_t MaxThreads>
+bool timed_allocator<A, MaxThreads>::Owns(void *addr)
+{
+    return m_allocator->Owns(addr);
+}
+
+template <typename MI, uint32_t MaxThreads>
+timed_memory_interface<MI, MaxThreads>::timed_memory_interface(MI *memory, latency_recorder<MaxThreads> *recorder)
+    : m_memory(memory),
+      m_recorder(recorder)
+{
+}
+
+template <typename MI, uint32_t MaxThreads>
+void timed_memory_interface<MI, MaxThreads>::Commit(void *addr, size_t size, size_t *actual)
+{
+    uint64_t begin = LatencyNow();
+    m_memory->Commit(addr, size, actual);
+    m_recorder->Record(LatencyCommit, LatencyNow() - begin);
+}
+
+template <typename MI, uint32_t MaxThreads>
+void *timed_memory_interface<MI, MaxThreads>::Reserve(size_t size, size_t *actual)
+{
+    return m_memory->Reserve(size, actual);
+}
+
+template <typename MI, uint32_t MaxThreads>
+void *timed_memory_interface<MI, MaxThreads>::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    return m_memory->Reserve(size, alignment, actual);
+}
+
+template <typename MI, uint32_t MaxThreads>
+void timed_memory_interface<MI, MaxThreads>::DeCommit(void *addr, size_t size)
+{
+    uint64_t begin = LatencyNow();
+    m_memory->DeCommit(addr, size);
+    m_recorder->Record(LatencyDeCommit, LatencyNow() - begin);
+}
+
+template <typename MI, uint32_t MaxThreads>
+void timed_memory_interface<MI, MaxThreads>::Release(void *addr, size_t size)
+{
+    m_memory->Release(addr, size);
+}
+
+template <typename MI, uint32_t MaxThreads>
+size_t timed_memory_interface<MI, MaxThreads>::GetPageSize()
+{
+    return m_memory->GetPageSize();
+}
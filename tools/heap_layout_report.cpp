@@ -0,0 +1,537 @@
+// Reads a heap layout written by best_fit_allocator::DumpLayout, binary or CSV, and reports
+// where the free memory is and how well the committed pages are used, to show why a heap
+// keeps committing more.
+//
+// free sizes    Free blocks by size, log2 buckets. Many small holes next to a few large
+//               requests means new requests don't fit the holes left behind.
+// by address    The committed range split into equal bands. Free memory spread over every
+//               band instead of gathering at the end means live blocks pin the whole heap.
+// pages         How much of each page holds allocated blocks, headers included. Pages that
+//               are mostly free can't be purged while anything on them is live.
+// callsites     With callsites in the dump, whose blocks sit on the sparsest pages.
+//
+// usage: heap_layout_report <layout> [--bands n] [--page bytes] [--top n]
+
+#include "heap_layout.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct layout_block
+{
+    uint64_t addr;
+    uint64_t size;
+    bool free;
+
+    // Index into layout::callsites, -1 for none.
+    int32_t callsite;
+};
+
+struct layout
+{
+    heap_layout_header header;
+    std::vector<layout_block> blocks;
+    std::vector<std::string> callsites;
+};
+
+static bool GetVarint(FILE *file, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7)
+    {
+        int byte = fgetc(file);
+        if (byte == EOF)
+        {
+            return false;
+        }
+
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool LoadBinary(FILE *file, layout *heap)
+{
+    uint32_t version;
+    if (fread(&version, sizeof(version), 1, file) != 1 || version != heap_layout_version)
+    {
+        return false;
+    }
+
+    heap_layout_header &header = heap->header;
+    if (!GetVarint(file, &header.base) || !GetVarint(file, &header.reserved) || !GetVarint(file, &header.committed) ||
+        !GetVarint(file, &header.headerSize) || !GetVarint(file, &header.granularity) || !GetVarint(file, &header.blockCount))
+    {
+        return false;
+    }
+
+    // The writer's ids map to callsite indices, names repeat under new ids.
+    std::vector<int32_t> ids(1, -1);
+    std::unordered_map<std::string, int32_t> names;
+
+    uint64_t addr = header.base;
+    for (uint64_t i = 0; i < header.blockCount; ++i)
+    {
+        uint64_t sizeAndFree;
+        uint64_t id;
+        if (!GetVarint(file, &sizeAndFree) || !GetVarint(file, &id))
+        {
+            return false;
+        }
+
+        if (id == ids.size())
+        {
+            uint64_t line;
+            uint64_t length;
+            if (!GetVarint(file, &line) || !GetVarint(file, &length) || length > 4096)
+            {
+                return false;
+            }
+
+            std::string name(length, '\0');
+            if (length && fread(&name[0], 1, length, file) != length)
+            {
+                return false;
+            }
+
+            name += ":" + std::to_string(line);
+            auto found = names.find(name);
+            if (found == names.end())
+            {
+                found = names.emplace(name, (int32_t)heap->callsites.size()).first;
+                heap->callsites.push_back(name);
+            }
+
+            ids.push_back(found->second);
+        }
+        else if (id > ids.size())
+        {
+            return false;
+        }
+
+        layout_block block = { addr, sizeAndFree >> 1, (sizeAndFree & 1) != 0, ids[id] };
+        heap->blocks.push_back(block);
+        addr += header.headerSize + block.size;
+    }
+
+    return true;
+}
+
+static bool LoadCsv(FILE *file, layout *heap)
+{
+    heap_layout_header &header = heap->header;
+    unsigned long long fields[6];
+    if (fscanf(file, "# heap layout base 0x%llx reserved %llu committed %llu header %llu granularity %llu blocks %llu\n",
+               &fields[0], &fields[1], &fields[2], &fields[3], &fields[4], &fields[5]) != 6)
+    {
+        return false;
+    }
+
+    header = { fields[0], fields[1], fields[2], fields[3], fields[4], fields[5] };
+
+    char line[2048];
+    if (!fgets(line, sizeof(line), file))
+    {
+        return false;
+    }
+
+    std::unordered_map<std::string, int32_t> names;
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned long long addr;
+        unsigned long long size;
+        int free;
+        int consumed = 0;
+        if (sscanf(line, "0x%llx,%llu,%d,%n", &addr, &size, &free, &consumed) != 3 || !consumed)
+        {
+            return false;
+        }
+
+        layout_block block = { addr, size, free != 0, -1 };
+
+        std::string name(line + consumed);
+        while (!name.empty() && (name.back() == '\n' || name.back() == '\r'))
+        {
+            name.pop_back();
+        }
+
+        if (!name.empty())
+        {
+            auto found = names.find(name);
+            if (found == names.end())
+            {
+                found = names.emplace(name, (int32_t)heap->callsites.size()).first;
+                heap->callsites.push_back(name);
+            }
+
+            block.callsite = found->second;
+        }
+
+        heap->blocks.push_back(block);
+    }
+
+    return heap->blocks.size() == header.blockCount;
+}
+
+static bool Load(const char *path, layout *heap)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    char magic[sizeof(heap_layout_magic)];
+    bool loaded;
+    if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, heap_layout_magic, sizeof(magic)) == 0)
+    {
+        loaded = LoadBinary(file, heap);
+    }
+    else
+    {
+        rewind(file);
+        loaded = LoadCsv(file, heap);
+    }
+
+    fclose(file);
+    return loaded;
+}
+
+static uint32_t Log2Bucket(uint64_t size)
+{
+    uint32_t bucket = 0;
+    while (bucket < 63 && ((uint64_t)1 << (bucket + 1)) <= size)
+    {
+        ++bucket;
+    }
+
+    return bucket;
+}
+
+static void PrintSummary(const layout &heap)
+{
+    uint64_t allocatedBytes = 0;
+    uint64_t allocatedBlocks = 0;
+    uint64_t freeBytes = 0;
+    uint64_t largestFree = 0;
+    for (const layout_block &block : heap.blocks)
+    {
+        if (block.free)
+        {
+            freeBytes += block.size;
+            largestFree = std::max(largestFree, block.size);
+        }
+        else
+        {
+            allocatedBytes += block.size;
+            ++allocatedBlocks;
+        }
+    }
+
+    printf("committed %llu of %llu reserved, %zu blocks, %llu byte headers, %llu byte granules\n",
+           (unsigned long long)heap.header.committed,
+           (unsigned long long)heap.header.reserved,
+           heap.blocks.size(),
+           (unsigned long long)heap.header.headerSize,
+           (unsigned long long)heap.header.granularity);
+    printf("allocated %llu bytes in %llu blocks, free %llu bytes in %llu blocks\n",
+           (unsigned long long)allocatedBytes,
+           (unsigned long long)allocatedBlocks,
+           (unsigned long long)freeBytes,
+           (unsigned long long)(heap.blocks.size() - allocatedBlocks));
+    printf("largest free block %llu, external fragmentation %.3f\n\n",
+           (unsigned long long)largestFree,
+           freeBytes ? 1.0 - (double)largestFree / (double)freeBytes : 0.0);
+}
+
+static void PrintFreeSizes(const layout &heap)
+{
+    uint64_t counts[64] = {};
+    uint64_t bytes[64] = {};
+    uint64_t total = 0;
+    for (const layout_block &block : heap.blocks)
+    {
+        if (block.free && block.size)
+        {
+            uint32_t bucket = Log2Bucket(block.size);
+            ++counts[bucket];
+            bytes[bucket] += block.size;
+            total += block.size;
+        }
+    }
+
+    printf("free sizes\n%-24s %10s %14s %7s\n", "size", "holes", "bytes", "share");
+    for (uint32_t bucket = 0; bucket < 64; ++bucket)
+    {
+        if (!counts[bucket])
+        {
+            continue;
+        }
+
+        char range[64];
+        snprintf(range, sizeof(range), "[%llu, %llu)", 1ull << bucket, bucket < 63 ? 1ull << (bucket + 1) : ~0ull);
+        printf("%-24s %10llu %14llu %6.1f%%\n",
+               range,
+               (unsigned long long)counts[bucket],
+               (unsigned long long)bytes[bucket],
+               100.0 * (double)bytes[bucket] / (double)total);
+    }
+
+    printf("\n");
+}
+
+static void PrintByAddress(const layout &heap, uint32_t bands)
+{
+    uint64_t committed = heap.header.committed;
+    uint64_t bandSize = std::max<uint64_t>((committed + bands - 1) / bands, 1);
+
+    std::vector<uint64_t> freeBytes(bands, 0);
+    std::vector<uint64_t> holes(bands, 0);
+    std::vector<uint64_t> largest(bands, 0);
+
+    for (const layout_block &block : heap.blocks)
+    {
+        if (!block.free)
+        {
+            continue;
+        }
+
+        // A hole counts in the band it starts in, its bytes in every band it covers.
+        uint64_t begin = block.addr + heap.header.headerSize - heap.header.base;
+        uint64_t end = begin + block.size;
+        uint32_t first = (uint32_t)std::min<uint64_t>(begin / bandSize, bands - 1);
+        ++holes[first];
+        largest[first] = std::max(largest[first], block.size);
+
+        for (uint64_t offset = begin; offset < end;)
+        {
+            uint32_t band = (uint32_t)std::min<uint64_t>(offset / bandSize, bands - 1);
+            uint64_t bandEnd = band == bands - 1 ? end : std::min(end, (uint64_t)(band + 1) * bandSize);
+            freeBytes[band] += bandEnd - offset;
+            offset = bandEnd;
+        }
+    }
+
+    printf("by address\n%-24s %10s %14s %14s %7s\n", "offset", "holes", "free bytes", "largest", "free");
+    for (uint32_t band = 0; band < bands; ++band)
+    {
+        uint64_t begin = (uint64_t)band * bandSize;
+        if (begin >= committed)
+        {
+            break;
+        }
+
+        uint64_t size = std::min(bandSize, committed - begin);
+        char range[64];
+        snprintf(range, sizeof(range), "%llu", (unsigned long long)begin);
+        printf("%-24s %10llu %14llu %14llu %6.1f%%\n",
+               range,
+               (unsigned long long)holes[band],
+               (unsigned long long)freeBytes[band],
+               (unsigned long long)largest[band],
+               100.0 * (double)freeBytes[band] / (double)size);
+    }
+
+    printf("\n");
+}
+
+static void PrintPages(const layout &heap, uint64_t pageSize, uint32_t top)
+{
+    uint64_t committed = heap.header.committed;
+    uint64_t pageCount = (committed + pageSize - 1) / pageSize;
+    std::vector<uint64_t> used(pageCount, 0);
+
+    for (const layout_block &block : heap.blocks)
+    {
+        if (block.free)
+        {
+            continue;
+        }
+
+        uint64_t begin = block.addr - heap.header.base;
+        uint64_t end = std::min(begin + heap.header.headerSize + block.size, committed);
+        for (uint64_t offset = begin; offset < end;)
+        {
+            uint64_t page = offset / pageSize;
+            uint64_t pageEnd = std::min(end, (page + 1) * pageSize);
+            used[page] += pageEnd - offset;
+            offset = pageEnd;
+        }
+    }
+
+    // Bucket 0 is empty pages, 11 full ones, the rest tenths in between.
+    uint64_t counts[12] = {};
+    uint64_t sparse = 0;
+    uint64_t sparseLive = 0;
+    for (uint64_t page = 0; page < pageCount; ++page)
+    {
+        uint64_t size = std::min(pageSize, committed - page * pageSize);
+        uint32_t bucket;
+        if (used[page] == 0)
+        {
+            bucket = 0;
+        }
+        else if (used[page] >= size)
+        {
+            bucket = 11;
+        }
+        else
+        {
+            bucket = 1 + (uint32_t)((used[page] * 10) / size);
+            bucket = std::min<uint32_t>(bucket, 10);
+        }
+
+        ++counts[bucket];
+        if (used[page] && used[page] * 4 < size)
+        {
+            ++sparse;
+            sparseLive += used[page];
+        }
+    }
+
+    printf("pages of %llu bytes, %llu committed\n%-24s %10s %7s\n", (unsigned long long)pageSize, (unsigned long long)pageCount, "used", "pages", "share");
+    for (uint32_t bucket = 0; bucket < 12; ++bucket)
+    {
+        if (!counts[bucket])
+        {
+            continue;
+        }
+
+        char range[32];
+        if (bucket == 0)
+        {
+            snprintf(range, sizeof(range), "empty");
+        }
+        else if (bucket == 11)
+        {
+            snprintf(range, sizeof(range), "full");
+        }
+        else
+        {
+            snprintf(range, sizeof(range), "%u%% - %u%%", (bucket - 1) * 10, bucket * 10);
+        }
+
+        printf("%-24s %10llu %6.1f%%\n", range, (unsigned long long)counts[bucket], 100.0 * (double)counts[bucket] / (double)pageCount);
+    }
+
+    printf("%llu pages are less than a quarter used, pinned by %llu live bytes\n\n", (unsigned long long)sparse, (unsigned long long)sparseLive);
+
+    if (heap.callsites.empty() || !sparse)
+    {
+        return;
+    }
+
+    // Live bytes on those pages, by the callsite that allocated them.
+    std::vector<uint64_t> pinned(heap.callsites.size(), 0);
+    for (const layout_block &block : heap.blocks)
+    {
+        if (block.free || block.callsite < 0)
+        {
+            continue;
+        }
+
+        uint64_t begin = block.addr - heap.header.base;
+        uint64_t end = std::min(begin + heap.header.headerSize + block.size, committed);
+        for (uint64_t offset = begin; offset < end;)
+        {
+            uint64_t page = offset / pageSize;
+            uint64_t size = std::min(pageSize, committed - page * pageSize);
+            uint64_t pageEnd = std::min(end, (page + 1) * pageSize);
+            if (used[page] * 4 < size)
+            {
+                pinned[block.callsite] += pageEnd - offset;
+            }
+
+            offset = pageEnd;
+        }
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < pinned.size(); ++i)
+    {
+        if (pinned[i])
+        {
+            order.push_back(i);
+        }
+    }
+
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return pinned[a] > pinned[b]; });
+
+    printf("callsites on sparse pages\n%-48s %14s\n", "callsite", "live bytes");
+    for (uint32_t i = 0; i < order.size() && i < top; ++i)
+    {
+        printf("%-48s %14llu\n", heap.callsites[order[i]].c_str(), (unsigned long long)pinned[order[i]]);
+    }
+
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = nullptr;
+    uint32_t bands = 16;
+    uint64_t pageSize = 0;
+    uint32_t top = 16;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--bands") == 0 && i + 1 < argc)
+        {
+            bands = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--page") == 0 && i + 1 < argc)
+        {
+            pageSize = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+        {
+            top = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argv[i][0] != '-' && !path)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s <layout> [--bands n] [--page bytes] [--top n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!path || !bands)
+    {
+        fprintf(stderr, "usage: %s <layout> [--bands n] [--page bytes] [--top n]\n", argv[0]);
+        return 1;
+    }
+
+    layout heap;
+    if (!Load(path, &heap))
+    {
+        fprintf(stderr, "%s is not a heap layout\n", path);
+        return 1;
+    }
+
+    if (!pageSize)
+    {
+        pageSize = heap.header.granularity ? heap.header.granularity : 4096;
+    }
+
+    printf("%s\n", path);
+    PrintSummary(heap);
+    PrintFreeSizes(heap);
+    PrintByAddress(heap, bands);
+    PrintPages(heap, pageSize, top);
+    return 0;
+}
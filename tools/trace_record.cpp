@@ -0,0 +1,147 @@
+// Records an allocation trace of a small multithreaded workload, as an example of capturing
+// one and as input for trace_replay.
+//
+// Each thread keeps a window of blocks from 16 bytes to 64KB and replaces, grows (up to
+// 256KB) or frees one at random, on a shared spin locked best_fit_allocator.
+//
+// usage: trace_record <trace> [--ops n] [--threads n]
+
+#define MEM_TRACKING_ENABLED
+#define BM_ALLOC_TRACE
+#define BM_ALLOC_TRACE_IMPLEMENTATION
+#include "alloc_trace.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define BM_WIN32_MEMORY_INTERFACE_IMPLEMENTATION
+#include "win32_memory_interface.h"
+using os_memory_interface = win32_virtual_memory_interface;
+#else
+#define BM_POSIX_MEMORY_INTERFACE_IMPLEMENTATION
+#include "posix_memory_interface.h"
+using os_memory_interface = posix_virtual_memory_interface;
+#endif
+
+#include "allocator_spinlock.h"
+#include "best_fit_allocator.h"
+#include "benchmarks/bench_util.h"
+
+using heap_type = best_fit_allocator<os_memory_interface>;
+using allocator_type = allocator_spin_lock<heap_type>;
+
+static void Workload(allocator_type *allocator, uint64_t ops, uint64_t seed)
+{
+    const size_t window = 1024;
+    rng random = { seed };
+
+    std::vector<void *> blocks(window, nullptr);
+    std::vector<size_t> sizes(window, 0);
+
+    for (uint64_t i = 0; i < ops; ++i)
+    {
+        size_t slot = (size_t)(random.Next() % window);
+        uint64_t choice = random.Next() % 8;
+
+        if (blocks[slot] && choice == 0 && sizes[slot] < 256 * 1024)
+        {
+            size_t size = sizes[slot] + sizes[slot] / 2;
+            void *grown = allocator->REALLOC(blocks[slot], size);
+            if (!grown)
+            {
+                grown = allocator->ALLOC(size, 16);
+                memcpy(grown, blocks[slot], sizes[slot]);
+                allocator->FREE(blocks[slot]);
+            }
+
+            blocks[slot] = grown;
+            sizes[slot] = size;
+            continue;
+        }
+
+        if (blocks[slot])
+        {
+            allocator->FREE(blocks[slot]);
+            blocks[slot] = nullptr;
+        }
+
+        if (choice < 6)
+        {
+            sizes[slot] = random.LogUniform(4, 16);
+            blocks[slot] = choice == 1 ? allocator->CALLOC(sizes[slot], 16) : allocator->ALLOC(sizes[slot], choice == 2 ? 8 : 16);
+        }
+    }
+
+    for (void *block : blocks)
+    {
+        if (block)
+        {
+            allocator->FREE(block);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = nullptr;
+    uint64_t ops = 100000;
+    uint32_t threads = 2;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc)
+        {
+            ops = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (argv[i][0] != '-' && !path)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s <trace> [--ops n] [--threads n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!path || threads == 0)
+    {
+        fprintf(stderr, "usage: %s <trace> [--ops n] [--threads n]\n", argv[0]);
+        return 1;
+    }
+
+    os_memory_interface memory;
+    heap_type heap(&memory, (size_t)8 * 1024 * 1024 * 1024);
+    allocator_type allocator(&heap);
+
+    if (!AllocTraceBegin(path))
+    {
+        fprintf(stderr, "can't write %s\n", path);
+        return 1;
+    }
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back(Workload, &allocator, ops / threads, 0x9E3779B97F4A7C15ull * (i + 1));
+    }
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    AllocTraceEnd();
+
+    printf("wrote %s\n", path);
+    return 0;
+}
@@ -0,0 +1,445 @@
+// Replays an allocation trace recorded with alloc_trace.h against several allocators and
+// compares their speed and footprint on the same sequence of requests.
+//
+// The trace is replayed on one thread, in the order the records were written. Addresses are
+// mapped to dense slots before the timed loop, so the replay itself does no hashing. Frees
+// of blocks allocated before the trace began are dropped.
+//
+// ops/sec       Trace records replayed per second.
+// peak commit   Highest committed bytes, as seen by the memory interface.
+// peak live     Highest sum of live request sizes.
+// frag          (peak commit - peak live) / peak commit.
+//
+// --layout writes the best_fit heap for tools/heap_layout_report at the point in the trace
+// where the most bytes are live, CSV when the path ends in .csv. The time it takes isn't
+// counted.
+//
+// usage: trace_replay <trace> [--allocator name] [--repeat n] [--layout path]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define BM_WIN32_MEMORY_INTERFACE_IMPLEMENTATION
+#include "win32_memory_interface.h"
+using os_memory_interface = win32_virtual_memory_interface;
+#else
+#define BM_POSIX_MEMORY_INTERFACE_IMPLEMENTATION
+#include "posix_memory_interface.h"
+using os_memory_interface = posix_virtual_memory_interface;
+#endif
+
+#define BM_ALLOC_TRACE_IMPLEMENTATION
+#include "alloc_trace.h"
+#define BM_MALLOCATOR_IMPLEMENTATION
+#include "mallocator.h"
+#include "best_fit_allocator.h"
+#include "buddy_allocator.h"
+#include "counting_memory_interface.h"
+#include "benchmarks/bench_util.h"
+
+struct replay_op
+{
+    alloc_trace_op op;
+    uint32_t alignment;
+    uint32_t slot;
+
+    // The slot of the block being resized, for realloc.
+    uint32_t oldSlot;
+    size_t size;
+};
+
+struct replay_trace
+{
+    std::vector<replay_op> ops;
+    uint32_t slotCount;
+    uint32_t threadCount;
+    uint64_t duration;
+
+    // The op after which the most requested bytes are live.
+    size_t peakOp;
+};
+
+struct replay_result
+{
+    uint64_t ops;
+    uint64_t failed;
+    double seconds;
+    size_t peakLive;
+};
+
+static bool LoadTrace(const char *path, replay_trace *trace)
+{
+    alloc_trace_reader reader;
+    if (!reader.Open(path))
+    {
+        return false;
+    }
+
+    // Every alloc and realloc gets a new slot, so a slot is one block from birth to death.
+    std::unordered_map<uint64_t, uint32_t> live;
+    trace->slotCount = 0;
+    trace->threadCount = 0;
+    trace->duration = 0;
+
+    alloc_trace_record record;
+    while (reader.Next(&record))
+    {
+        replay_op op = { record.op, record.alignment, 0, 0, (size_t)record.size };
+
+        if (record.thread >= trace->threadCount)
+        {
+            trace->threadCount = record.thread + 1;
+        }
+
+        trace->duration = record.timestamp;
+
+        if (record.op != AllocTraceAlloc)
+        {
+            uint64_t addr = record.op == AllocTraceFree ? record.addr : record.oldAddr;
+            auto found = live.find(addr);
+            if (found == live.end())
+            {
+                continue;
+            }
+
+            op.oldSlot = found->second;
+            live.erase(found);
+
+            if (record.op == AllocTraceFree)
+            {
+                op.slot = op.oldSlot;
+                trace->ops.push_back(op);
+                continue;
+            }
+        }
+
+        op.slot = trace->slotCount++;
+        live[record.addr] = op.slot;
+        trace->ops.push_back(op);
+    }
+
+    reader.Close();
+
+    std::vector<size_t> sizes(trace->slotCount, 0);
+    size_t liveBytes = 0;
+    size_t peakBytes = 0;
+    trace->peakOp = 0;
+    for (size_t i = 0; i < trace->ops.size(); ++i)
+    {
+        const replay_op &op = trace->ops[i];
+        if (op.op != AllocTraceAlloc)
+        {
+            liveBytes -= sizes[op.oldSlot];
+            sizes[op.oldSlot] = 0;
+        }
+
+        if (op.op != AllocTraceFree)
+        {
+            sizes[op.slot] = op.size;
+            liveBytes += op.size;
+        }
+
+        if (liveBytes > peakBytes)
+        {
+            peakBytes = liveBytes;
+            trace->peakOp = i;
+        }
+    }
+    return true;
+}
+
+// Only best_fit_allocator has a layout to write.
+template <typename A>
+static bool DumpLayout(A *, const char *)
+{
+    return false;
+}
+
+template <typename MI, size_t MA>
+static bool DumpLayout(best_fit_allocator<MI, MA> *allocator, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        return false;
+    }
+
+    size_t length = strlen(path);
+    bool csv = length >= 4 && strcmp(path + length - 4, ".csv") == 0;
+    bool written = allocator->DumpLayout(file, csv ? HeapLayoutCsv : HeapLayoutBinary);
+    return fclose(file) == 0 && written;
+}
+
+template <typename A>
+static replay_result Replay(A *allocator, const replay_trace &trace, const char *layoutPath)
+{
+    std::vector<void *> blocks(trace.slotCount, nullptr);
+    std::vector<size_t> sizes(trace.slotCount, 0);
+
+    uint64_t failed = 0;
+    size_t live = 0;
+    size_t peakLive = 0;
+
+    clock_type::time_point begin = clock_type::now();
+    double dumpSeconds = 0.0;
+    for (size_t i = 0; i <= trace.ops.size(); ++i)
+    {
+        if (layoutPath && i == trace.peakOp + 1)
+        {
+            clock_type::time_point dumpBegin = clock_type::now();
+            if (!DumpLayout(allocator, layoutPath))
+            {
+                fprintf(stderr, "Failed to write %s\n", layoutPath);
+            }
+
+            dumpSeconds = Elapsed(dumpBegin);
+        }
+
+        if (i == trace.ops.size())
+        {
+            break;
+        }
+
+        const replay_op &op = trace.ops[i];
+        switch (op.op)
+        {
+        case AllocTraceAlloc:
+            blocks[op.slot] = allocator->ALLOC(op.size, op.alignment);
+            break;
+
+        case AllocTraceFree:
+            if (blocks[op.slot])
+            {
+                allocator->FREE(blocks[op.slot]);
+                blocks[op.slot] = nullptr;
+                live -= sizes[op.slot];
+            }
+            continue;
+
+        case AllocTraceReAlloc:
+        {
+            void *old = blocks[op.oldSlot];
+            blocks[op.oldSlot] = nullptr;
+
+            if (!old)
+            {
+                blocks[op.slot] = allocator->ALLOC(op.size, 16);
+                break;
+            }
+
+            live -= sizes[op.oldSlot];
+            blocks[op.slot] = allocator->REALLOC(old, op.size);
+            if (!blocks[op.slot])
+            {
+                // The allocators only resize in place, moving is up to the caller.
+                void *moved = allocator->ALLOC(op.size, 16);
+                if (moved)
+                {
+                    size_t oldSize = sizes[op.oldSlot];
+                    memcpy(moved, old, oldSize < op.size ? oldSize : op.size);
+                }
+
+                allocator->FREE(old);
+                blocks[op.slot] = moved;
+            }
+            break;
+        }
+        }
+
+        if (!blocks[op.slot])
+        {
+            ++failed;
+            continue;
+        }
+
+        sizes[op.slot] = op.size;
+        live += op.size;
+        if (live > peakLive)
+        {
+            peakLive = live;
+        }
+    }
+
+    replay_result result = { (uint64_t)trace.ops.size(), failed, Elapsed(begin) - dumpSeconds, peakLive };
+
+    // Free what the trace left live, outside the timed loop.
+    for (void *block : blocks)
+    {
+        if (block)
+        {
+            allocator->FREE(block);
+        }
+    }
+
+    return result;
+}
+
+// Each fixture builds a fresh allocator for one replay.
+struct best_fit_fixture
+{
+    static constexpr const char *name = "best_fit";
+
+    using memory_type = counting_memory_interface<os_memory_interface>;
+    using allocator_type = best_fit_allocator<memory_type>;
+
+    best_fit_fixture()
+        : memory(&os),
+          allocator(&memory, (size_t)8 * 1024 * 1024 * 1024)
+    {
+    }
+
+    size_t PeakCommitted() { return memory.m_peakCommitted; }
+
+    os_memory_interface os;
+    memory_type memory;
+    allocator_type allocator;
+};
+
+struct best_fit_2m_fixture
+{
+    static constexpr const char *name = "best_fit_2m";
+
+    using memory_type = counting_memory_interface<os_memory_interface>;
+    using allocator_type = best_fit_allocator<memory_type>;
+
+    best_fit_2m_fixture()
+        : memory(&os),
+          allocator(&memory, (size_t)8 * 1024 * 1024 * 1024, 2 * 1024 * 1024)
+    {
+    }
+
+    size_t PeakCommitted() { return memory.m_peakCommitted; }
+
+    os_memory_interface os;
+    memory_type memory;
+    allocator_type allocator;
+};
+
+struct buddy_fixture
+{
+    static constexpr const char *name = "buddy";
+
+    using memory_type = counting_memory_interface<os_memory_interface>;
+    using allocator_type = buddy_allocator<memory_type>;
+
+    // The side tables are sized by the reservation, keep it modest.
+    buddy_fixture()
+        : memory(&os),
+          allocator(&memory, (size_t)1024 * 1024 * 1024, 64)
+    {
+    }
+
+    size_t PeakCommitted() { return memory.m_peakCommitted; }
+
+    os_memory_interface os;
+    memory_type memory;
+    allocator_type allocator;
+};
+
+struct malloc_fixture
+{
+    static constexpr const char *name = "malloc";
+
+    using allocator_type = mallocator;
+
+    // The system heap doesn't say.
+    size_t PeakCommitted() { return 0; }
+
+    allocator_type allocator;
+};
+
+template <typename F>
+static void Run(const replay_trace &trace, const char *only, uint32_t repeat, const char *layoutPath)
+{
+    if (only && strcmp(only, F::name) != 0)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < repeat; ++i)
+    {
+        F *fixture = new F();
+        replay_result result = Replay(&fixture->allocator, trace, i == 0 ? layoutPath : nullptr);
+        size_t peakCommitted = fixture->PeakCommitted();
+        delete fixture;
+
+        printf("%-12s %12llu %14.0f %8llu %14zu %14zu ",
+               F::name,
+               (unsigned long long)result.ops,
+               (double)result.ops / result.seconds,
+               (unsigned long long)result.failed,
+               peakCommitted,
+               result.peakLive);
+
+        if (peakCommitted)
+        {
+            printf("%7.1f%%\n", 100.0 * (double)(peakCommitted - (result.peakLive < peakCommitted ? result.peakLive : peakCommitted)) / (double)peakCommitted);
+        }
+        else
+        {
+            printf("%8s\n", "-");
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = nullptr;
+    const char *only = nullptr;
+    uint32_t repeat = 1;
+    const char *layoutPath = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc)
+        {
+            only = argv[++i];
+        }
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            repeat = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc)
+        {
+            layoutPath = argv[++i];
+        }
+        else if (argv[i][0] != '-' && !path)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s <trace> [--allocator name] [--repeat n] [--layout path]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!path)
+    {
+        fprintf(stderr, "usage: %s <trace> [--allocator name] [--repeat n] [--layout path]\n", argv[0]);
+        return 1;
+    }
+
+    replay_trace trace;
+    if (!LoadTrace(path, &trace))
+    {
+        fprintf(stderr, "%s is not an allocation trace\n", path);
+        return 1;
+    }
+
+    printf("%s: %zu ops, %u threads, %.3f s recorded\n\n",
+           path, trace.ops.size(), trace.threadCount, (double)trace.duration / 1e9);
+    printf("%-12s %12s %14s %8s %14s %14s %8s\n",
+           "allocator", "ops", "ops/sec", "failed", "peak commit", "peak live", "frag");
+
+    Run<best_fit_fixture>(trace, only, repeat, layoutPath);
+    Run<best_fit_2m_fixture>(trace, only, repeat, nullptr);
+    Run<buddy_fixture>(trace, only, repeat, nullptr);
+    Run<malloc_fixture>(trace, only, repeat, nullptr);
+    return 0;
+}
@@ -4,12 +4,19 @@
 
 #include <Windows.h>
 
+enum win32_memory_interface_flags : uint32_t
+{
+    // Fault committed pages in during Commit, so first touch doesn't take page faults.
+    Win32MemoryPopulate = 1 << 0,
+};
+
 struct win32_virtual_memory_interface
 {
 	win32_virtual_memory_interface(const win32_virtual_memory_interface &) = delete;
-	win32_virtual_memory_interface();
+	win32_virtual_memory_interface(uint32_t flags = 0);
 
 	DWORD page_size;
+	uint32_t flags;
 
     DECLARE_MEMORY_INTERFACE_METHODS();
 };
@@ -29,7 +36,8 @@ struct win32_virtual_memory_interface
 #define BM_ASSERT(val, msg) assert(val)
 #endif
 
-win32_virtual_memory_interface::win32_virtual_memory_interface()
+win32_virtual_memory_interface::win32_virtual_memory_interface(uint32_t flags)
+	: flags(flags)
 {
 	SYSTEM_INFO system_info;
 	GetSystemInfo(&system_info);
@@ -43,6 +51,16 @@ void win32_virtual_memory_interface::Commit(void *addr, size_t size, size_t *act
 
 	void *result = VirtualAlloc(addr, *actual_commit, MEM_COMMIT, PAGE_READWRITE);
     BM_ASSERT(result, "Failed to commit memory");
+
+    if (flags & Win32MemoryPopulate)
+    {
+        // Touch every page with an atomic write that leaves the contents alone in case the
+        // range is in use.
+        for (size_t offset = 0; offset < *actual_commit; offset += page_size)
+        {
+            InterlockedOr((LONG volatile *)((uint8_t *)addr + offset), 0);
+        }
+    }
 }
 
 void *win32_virtual_memory_interface::Reserve(size_t size, size_t *actual)
@@ -55,15 +73,56 @@ void *win32_virtual_memory_interface::Reserve(size_t size, size_t *actual)
 	return page_base;
 }
 
+void *win32_virtual_memory_interface::Reserve(size_t size, size_t alignment, size_t *actual)
+{
+    BM_ASSERT(alignment && !(alignment & (alignment - 1)), "Alignment must be a power of 2");
+    if (alignment <= page_size)
+    {
+        return Reserve(size, actual);
+    }
+
+    *actual = size + ((~(size & (page_size - 1)) + 1) & (page_size - 1));
+
+    // VirtualFree can't release part of a reservation, so find an aligned address inside
+    // an oversized reservation, release it, and reserve again at that address. Another
+    // thread may take the range in between, in which case try again.
+    for (int attempt = 0; attempt < 16; ++attempt)
+    {
+        void *probe = VirtualAlloc(nullptr, *actual + alignment, MEM_RESERVE, PAGE_READWRITE);
+        BM_ASSERT(probe, "Failed to reserve memory");
+        if (!probe)
+        {
+            return nullptr;
+        }
+
+        void *aligned = (void *)(((size_t)probe + alignment - 1) & ~(alignment - 1));
+        VirtualFree(probe, 0, MEM_RELEASE);
+
+        void *page_base = VirtualAlloc(aligned, *actual, MEM_RESERVE, PAGE_READWRITE);
+        if (page_base)
+        {
+            return page_base;
+        }
+    }
+
+    BM_ASSERT(false, "Failed to reserve aligned memory");
+    return nullptr;
+}
+
 void win32_virtual_memory_interface::DeCommit(void *addr, size_t size)
 {
-	BM_ASSERT(VirtualFree(addr, size, MEM_DECOMMIT), "Failed to de-commit memory");
+    // Kept out of BM_ASSERT, which may compile to nothing. Decommitted pages read back as zero.
+    BOOL result = VirtualFree(addr, size, MEM_DECOMMIT);
+    BM_ASSERT(result, "Failed to de-commit memory");
+    (void)result;
 }
 
 void win32_virtual_memory_interface::Release(void *addr, size_t size)
 {
     (void)size;
-	BM_ASSERT(VirtualFree(addr, 0, MEM_RELEASE), "Failed to release memory");
+    BOOL result = VirtualFree(addr, 0, MEM_RELEASE);
+    BM_ASSERT(result, "Failed to release memory");
+    (void)result;
 }
 
 size_t win32_virtual_memory_interface::GetPageSize()